@@ -0,0 +1,159 @@
+// Global operator new/delete replacements, only compiled in when
+// ENABLE_ALLOCATION_TRACKING is on.
+#include "allocationTracker.hpp"
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+namespace
+{
+struct Counters
+{
+    std::atomic<uint64_t> allocations{0};
+    std::atomic<uint64_t> bytes{0};
+    std::atomic<uint64_t> deallocations{0};
+};
+
+std::array<Counters, static_cast<size_t>(AllocationOperation::Count)> counters;
+thread_local AllocationOperation currentOperation = AllocationOperation::Other;
+
+// Every block starts with a header holding the operation it was allocated
+// for, so that its free is charged there too, whichever scope frees it.
+// The header keeps the default alignment of what follows it.
+constexpr size_t headerSize = alignof(std::max_align_t);
+
+AllocationOperation& owner(void* p)
+{
+    return *reinterpret_cast<AllocationOperation*>(static_cast<char*>(p) -
+                                                   headerSize);
+}
+
+void* recordAllocation(void* block, size_t offset, size_t size)
+{
+    auto* p = static_cast<char*>(block) + offset;
+    owner(p) = currentOperation;
+    auto& current = counters[static_cast<size_t>(currentOperation)];
+    current.allocations.fetch_add(1, std::memory_order_relaxed);
+    current.bytes.fetch_add(size, std::memory_order_relaxed);
+    return p;
+}
+
+// Returns the block `p` was carved from.
+void* recordDeallocation(void* p, size_t offset)
+{
+    counters[static_cast<size_t>(owner(p))].deallocations.fetch_add(
+        1, std::memory_order_relaxed);
+    return static_cast<char*>(p) - offset;
+}
+
+void* allocate(size_t size)
+{
+    if (void* block = std::malloc(headerSize + size))
+    {
+        return recordAllocation(block, headerSize, size);
+    }
+    throw std::bad_alloc();
+}
+
+// Alignments beyond the default put the header in a prefix of `alignment`
+// bytes, which is at least headerSize.
+void* allocateAligned(size_t size, std::align_val_t alignment)
+{
+    const auto align = static_cast<size_t>(alignment);
+    // aligned_alloc wants the size to be a multiple of the alignment.
+    const size_t rounded = (size + align - 1) / align * align;
+    if (void* block = std::aligned_alloc(align, align + rounded))
+    {
+        return recordAllocation(block, align, size);
+    }
+    throw std::bad_alloc();
+}
+
+void deallocate(void* p)
+{
+    if (p)
+    {
+        std::free(recordDeallocation(p, headerSize));
+    }
+}
+
+void deallocateAligned(void* p, std::align_val_t alignment)
+{
+    if (p)
+    {
+        std::free(recordDeallocation(p, static_cast<size_t>(alignment)));
+    }
+}
+} // namespace
+
+AllocationOperation exchangeAllocationOperation(AllocationOperation operation)
+{
+    auto previous = currentOperation;
+    currentOperation = operation;
+    return previous;
+}
+
+AllocationCounters allocationCounters(AllocationOperation operation)
+{
+    const auto& current = counters[static_cast<size_t>(operation)];
+    return {current.allocations.load(std::memory_order_relaxed),
+            current.bytes.load(std::memory_order_relaxed),
+            current.deallocations.load(std::memory_order_relaxed)};
+}
+
+void* operator new(size_t size) { return allocate(size); }
+void* operator new[](size_t size) { return allocate(size); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+    try
+    {
+        return allocate(size);
+    }
+    catch (const std::bad_alloc&)
+    {
+        return nullptr;
+    }
+}
+void* operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+    return operator new(size, std::nothrow);
+}
+void* operator new(size_t size, std::align_val_t alignment)
+{
+    return allocateAligned(size, alignment);
+}
+void* operator new[](size_t size, std::align_val_t alignment)
+{
+    return allocateAligned(size, alignment);
+}
+
+void operator delete(void* p) noexcept { deallocate(p); }
+void operator delete[](void* p) noexcept { deallocate(p); }
+void operator delete(void* p, size_t) noexcept { deallocate(p); }
+void operator delete[](void* p, size_t) noexcept { deallocate(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept
+{
+    deallocate(p);
+}
+void operator delete[](void* p, const std::nothrow_t&) noexcept
+{
+    deallocate(p);
+}
+void operator delete(void* p, std::align_val_t alignment) noexcept
+{
+    deallocateAligned(p, alignment);
+}
+void operator delete[](void* p, std::align_val_t alignment) noexcept
+{
+    deallocateAligned(p, alignment);
+}
+void operator delete(void* p, size_t, std::align_val_t alignment) noexcept
+{
+    deallocateAligned(p, alignment);
+}
+void operator delete[](void* p, size_t, std::align_val_t alignment) noexcept
+{
+    deallocateAligned(p, alignment);
+}
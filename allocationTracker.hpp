@@ -0,0 +1,110 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+
+// Operations that heap allocations are attributed to. Allocations made
+// outside of any AllocationScope end up in Other.
+enum class AllocationOperation
+{
+    Other,
+    Parse,
+    Get,
+    Change,
+    Emit,
+    SignalHandling,
+    Count
+};
+
+struct AllocationCounters
+{
+    uint64_t allocations{0};
+    uint64_t bytes{0};
+    // Frees of blocks allocated by the operation, in whatever scope they
+    // happen.
+    uint64_t deallocations{0};
+};
+
+constexpr const char* allocationOperationName(AllocationOperation operation)
+{
+    switch (operation)
+    {
+        case AllocationOperation::Parse:
+            return "parse";
+        case AllocationOperation::Get:
+            return "get";
+        case AllocationOperation::Change:
+            return "change";
+        case AllocationOperation::Emit:
+            return "emit";
+        case AllocationOperation::SignalHandling:
+            return "signal";
+        default:
+            return "other";
+    }
+}
+
+#ifdef ALLOCATION_TRACKING
+
+constexpr bool allocationTrackingEnabled = true;
+
+// Implemented next to the global operator new/delete replacements.
+AllocationOperation exchangeAllocationOperation(AllocationOperation operation);
+AllocationCounters allocationCounters(AllocationOperation operation);
+
+// Attributes allocations made by the current thread to `operation` for the
+// lifetime of the scope. Scopes nest; the innermost one wins.
+class AllocationScope
+{
+  public:
+    explicit AllocationScope(AllocationOperation operation)
+        : previous(exchangeAllocationOperation(operation))
+    {
+    }
+
+    ~AllocationScope() { exchangeAllocationOperation(previous); }
+
+    AllocationScope(const AllocationScope&) = delete;
+    AllocationScope& operator=(const AllocationScope&) = delete;
+
+  private:
+    AllocationOperation previous;
+};
+
+#else
+
+constexpr bool allocationTrackingEnabled = false;
+
+inline AllocationCounters allocationCounters(AllocationOperation)
+{
+    return {};
+}
+
+class AllocationScope
+{
+  public:
+    explicit AllocationScope(AllocationOperation) {}
+};
+
+#endif
+
+// Per-operation counters since process start; empty unless the build has
+// ENABLE_ALLOCATION_TRACKING switched on.
+inline std::map<std::string, AllocationCounters> allocationReport()
+{
+    std::map<std::string, AllocationCounters> report;
+    if (!allocationTrackingEnabled)
+    {
+        return report;
+    }
+    for (size_t i = 0; i < static_cast<size_t>(AllocationOperation::Count); ++i)
+    {
+        const auto operation = static_cast<AllocationOperation>(i);
+        report[allocationOperationName(operation)] =
+            allocationCounters(operation);
+    }
+    return report;
+}
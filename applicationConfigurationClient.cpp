@@ -0,0 +1,638 @@
+#include "applicationConfigurationClient.hpp"
+#include "allocationTracker.hpp"
+#include "configurationBundle.hpp"
+#include "variantUtils.hpp"
+#include <filesystem>
+#include <spdlog/spdlog.h>
+
+static void logAllocationReport()
+{
+    for (const auto& [operation, counters] : allocationReport())
+    {
+        spdlog::debug("Allocations in {}: {} ({} bytes), {} frees", operation,
+                      counters.allocations, counters.bytes,
+                      counters.deallocations);
+    }
+}
+
+ConfigurationConnection::ConfigurationConnection(
+    sdbus::IConnection& connection, ResyncPolicy resyncPolicy,
+    ConfigurationTransport transport)
+    : connection(connection), transport(transport), resyncPolicy(resyncPolicy)
+{
+    std::string applicationsNamespace = applicationsObjectPath;
+    applicationsNamespace.pop_back();
+    // Messages from a peer carry no sender.
+    const std::string sender =
+        transport == ConfigurationTransport::Bus
+            ? std::string("sender='") + serviceName + "',"
+            : std::string();
+    configurationUpdatedSlot = connection.addMatch(
+        "type='signal'," + sender + "interface='" + interfaceName +
+            "',member='configurationUpdated',path_namespace='" +
+            applicationsNamespace + "'",
+        [this](sdbus::Message message)
+        { this->handleConfigurationUpdated(std::move(message)); },
+        sdbus::return_slot);
+
+    if (transport == ConfigurationTransport::Bus)
+    {
+        // A new owner of the service name means the manager (re)started.
+        nameOwnerChangedSlot = connection.addMatch(
+            std::string("type='signal',sender='org.freedesktop.DBus',"
+                        "interface='org.freedesktop.DBus',"
+                        "member='NameOwnerChanged',arg0='") +
+                serviceName + "'",
+            [this](sdbus::Message message)
+            { this->handleNameOwnerChanged(std::move(message)); },
+            sdbus::return_slot);
+    }
+
+    // Last: if anything above throws, no joinable thread is left behind to
+    // std::terminate() the unwinding.
+    resyncThread = std::thread([this]() { resyncLoop(); });
+}
+
+ConfigurationConnection::~ConfigurationConnection()
+{
+    {
+        std::lock_guard<std::mutex> lock(resyncMutex);
+        running = false;
+    }
+    resyncCondition.notify_all();
+    resyncThread.join();
+}
+
+sdbus::ServiceName ConfigurationConnection::destination() const
+{
+    return sdbus::ServiceName{
+        transport == ConfigurationTransport::Bus ? serviceName : ""};
+}
+
+void ConfigurationConnection::attach(ApplicationConfigurationClient* client)
+{
+    {
+        std::lock_guard<std::mutex> lock(clientsMutex);
+        if (!clients.emplace(client->getObjectPath(), client).second)
+        {
+            throw std::invalid_argument("Application already attached: " +
+                                        client->getObjectPath());
+        }
+    }
+    std::lock_guard<std::mutex> lock(resyncMutex);
+    attached.insert(client);
+}
+
+// Once this returns, neither a signal nor a resync touches `client` again,
+// except for the delivery that called it from one of the client's callbacks.
+void ConfigurationConnection::detach(ApplicationConfigurationClient* client)
+{
+    const auto self = std::this_thread::get_id();
+    {
+        std::unique_lock<std::mutex> lock(clientsMutex);
+        clients.erase(client->getObjectPath());
+        clientsCondition.wait(
+            lock,
+            [this, client, self]()
+            { return signalInFlight != client || signalThread == self; });
+    }
+    std::unique_lock<std::mutex> lock(resyncMutex);
+    attached.erase(client);
+    if (auto it = scheduledResyncs.find(client); it != scheduledResyncs.end())
+    {
+        pendingResyncs.erase(it->second);
+        scheduledResyncs.erase(it);
+    }
+    resyncCondition.wait(
+        lock,
+        [this, client, self]()
+        { return resyncInFlight != client || resyncThread.get_id() == self; });
+}
+
+void ConfigurationConnection::scheduleResync(
+    ApplicationConfigurationClient* client, std::chrono::milliseconds maxDelay)
+{
+    {
+        std::lock_guard<std::mutex> lock(resyncMutex);
+        if (!attached.count(client) || scheduledResyncs.count(client))
+        {
+            return;
+        }
+        scheduleLocked(client, jitter(maxDelay), resyncPolicy.initialDelay);
+    }
+    resyncCondition.notify_all();
+}
+
+void ConfigurationConnection::scheduleLocked(
+    ApplicationConfigurationClient* client, std::chrono::milliseconds delay,
+    std::chrono::milliseconds limit)
+{
+    auto it = pendingResyncs.emplace(Clock::now() + delay, Resync{client, limit});
+    scheduledResyncs[client] = it;
+}
+
+// Signals from the shared match rule are routed to their handle by object
+// path, and only unpacked when some handle is interested. Callbacks run
+// without clientsMutex, so they may attach or detach handles; a concurrent
+// detach() of this handle waits for the delivery to finish.
+void ConfigurationConnection::handleConfigurationUpdated(sdbus::Message message)
+{
+    ApplicationConfigurationClient* client = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(clientsMutex);
+        auto it = clients.find(message.getPath());
+        if (it == clients.end())
+        {
+            return;
+        }
+        client = it->second;
+        signalInFlight = client;
+        signalThread = std::this_thread::get_id();
+    }
+    try
+    {
+        uint64_t generation = 0;
+        uint64_t version = 0;
+        uint64_t contentHash = 0;
+        config_dict changed;
+        message >> generation >> version >> contentHash >> changed;
+        client->handleConfigurationUpdated(generation, version, contentHash,
+                                           changed);
+    }
+    catch (...)
+    {
+        finishSignal();
+        throw;
+    }
+    finishSignal();
+}
+
+void ConfigurationConnection::finishSignal()
+{
+    {
+        std::lock_guard<std::mutex> lock(clientsMutex);
+        signalInFlight = nullptr;
+        signalThread = std::thread::id();
+    }
+    clientsCondition.notify_all();
+}
+
+void ConfigurationConnection::handleNameOwnerChanged(sdbus::Message message)
+{
+    std::string name;
+    std::string oldOwner;
+    std::string newOwner;
+    message >> name >> oldOwner >> newOwner;
+    if (newOwner.empty())
+    {
+        spdlog::warn("Configuration manager left the bus");
+        return;
+    }
+    spdlog::info("Configuration manager appeared as {}", newOwner);
+
+    std::lock_guard<std::mutex> lock(resyncMutex);
+    for (auto* client : attached)
+    {
+        if (!scheduledResyncs.count(client))
+        {
+            scheduleLocked(client, jitter(resyncPolicy.initialDelay),
+                           resyncPolicy.initialDelay);
+        }
+    }
+    resyncCondition.notify_all();
+}
+
+void ConfigurationConnection::resyncLoop()
+{
+    std::unique_lock<std::mutex> lock(resyncMutex);
+    while (running)
+    {
+        if (pendingResyncs.empty())
+        {
+            resyncCondition.wait(
+                lock, [this]() { return !running || !pendingResyncs.empty(); });
+            continue;
+        }
+        auto next = pendingResyncs.begin();
+        if (next->first > Clock::now())
+        {
+            resyncCondition.wait_until(lock, next->first);
+            continue;
+        }
+
+        Resync resync = next->second;
+        scheduledResyncs.erase(resync.client);
+        pendingResyncs.erase(next);
+        resyncInFlight = resync.client;
+        lock.unlock();
+        const bool synchronized = resync.client->fetch();
+        lock.lock();
+        resyncInFlight = nullptr;
+        resyncCondition.notify_all();
+
+        if (!synchronized && running && attached.count(resync.client) &&
+            !scheduledResyncs.count(resync.client))
+        {
+            const auto delay = jitter(resync.limit);
+            spdlog::debug("Resync of {} failed, retrying in {}ms",
+                          resync.client->getObjectPath(), delay.count());
+            scheduleLocked(resync.client, delay,
+                           std::min(resync.limit * 2, resyncPolicy.maxDelay));
+        }
+    }
+}
+
+std::chrono::milliseconds
+ConfigurationConnection::jitter(std::chrono::milliseconds limit)
+{
+    if (limit.count() <= 0)
+    {
+        return std::chrono::milliseconds::zero();
+    }
+    std::uniform_int_distribution<int64_t> distribution(0, limit.count() - 1);
+    return std::chrono::milliseconds(distribution(random));
+}
+
+ApplicationConfigurationClient::ApplicationConfigurationClient(
+    ConfigurationConnection& configurationConnection,
+    const std::string& applicationName, std::shared_ptr<Executor> executor)
+    : configurationConnection(configurationConnection),
+      applicationName(applicationName),
+      objectPath(std::string(ConfigurationConnection::applicationsObjectPath) +
+                 applicationName),
+      executor(std::move(executor))
+{
+    proxy = sdbus::createProxy(configurationConnection.getConnection(),
+                               configurationConnection.destination(),
+                               sdbus::ObjectPath{objectPath});
+    configurationConnection.attach(this);
+}
+
+ApplicationConfigurationClient::~ApplicationConfigurationClient()
+{
+    configurationConnection.detach(this);
+}
+
+void ApplicationConfigurationClient::onChange(const std::string& pattern,
+                                              change_callback callback)
+{
+    auto shared = std::make_shared<const change_callback>(std::move(callback));
+    std::lock_guard<std::mutex> lock(callbacksMutex);
+    if (!pattern.empty() && pattern.back() == '*')
+    {
+        auto prefix = pattern.substr(0, pattern.size() - 1);
+        prefixLengths.insert(prefix.size());
+        prefixCallbacks[std::move(prefix)].push_back(std::move(shared));
+    }
+    else
+    {
+        keyCallbacks[pattern].push_back(std::move(shared));
+    }
+}
+
+bool ApplicationConfigurationClient::fetch()
+{
+    uint64_t knownGeneration = 0;
+    uint64_t knownVersion = 0;
+    {
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        knownGeneration = generation;
+        knownVersion = version;
+    }
+
+    uint64_t currentGeneration = 0;
+    uint64_t currentVersion = 0;
+    uint64_t currentHash = 0;
+    bool complete = false;
+    config_dict values;
+    try
+    {
+        proxy->callMethod("GetConfigurationSince")
+            .onInterface(ConfigurationConnection::interfaceName)
+            .withArguments(knownGeneration, knownVersion)
+            .storeResultsTo(currentGeneration, currentVersion, currentHash,
+                            complete, values);
+    }
+    catch (const sdbus::Error& e)
+    {
+        spdlog::debug("Could not fetch configuration of {}: {}",
+                      applicationName, e.what());
+        return false;
+    }
+
+    std::vector<ConfigurationChange> changes;
+    bool outOfSync = false;
+    {
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        if (currentGeneration == generation && currentVersion <= version)
+        {
+            // A signal already brought us this far.
+            return true;
+        }
+        if (complete)
+        {
+            for (auto it = cache.begin(); it != cache.end();)
+            {
+                if (values.count(it->first))
+                {
+                    ++it;
+                    continue;
+                }
+                contentHash -= configurationEntryHash(it->first, it->second);
+                it = cache.erase(it);
+            }
+        }
+        changes = updateCache(values);
+        generation = currentGeneration;
+        version = currentVersion;
+        if (contentHash != currentHash)
+        {
+            if (complete)
+            {
+                spdlog::error("Content hash of {} differs from the manager's",
+                              applicationName);
+            }
+            else
+            {
+                // Forget the version so that the retry fetches everything.
+                spdlog::warn("Content hash of {} differs after an "
+                             "incremental fetch, refetching",
+                             applicationName);
+                generation = 0;
+                version = 0;
+                outOfSync = true;
+            }
+        }
+    }
+    spdlog::info("Synchronized {} to version {} ({} fetch, {} keys)",
+                 applicationName, currentVersion,
+                 complete ? "full" : "incremental", values.size());
+    dispatch(std::move(changes));
+    writeCache();
+    return !outOfSync;
+}
+
+void ApplicationConfigurationClient::requestResync(
+    std::chrono::milliseconds maxInitialDelay)
+{
+    configurationConnection.scheduleResync(this, maxInitialDelay);
+}
+
+bool ApplicationConfigurationClient::loadCache(const std::string& path)
+{
+    {
+        std::lock_guard<std::mutex> lock(cacheFileMutex);
+        cachePath = path;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<ConfigurationChange> changes;
+    uint64_t cachedVersion = 0;
+    try
+    {
+        ConfigurationBundle bundle(path);
+        auto index = bundle.findApplication(applicationName);
+        if (!index)
+        {
+            throw std::runtime_error("Cache does not contain " +
+                                     applicationName);
+        }
+        ConfigurationArena values(0);
+        bundle.readApplication(*index, values.values());
+        config_dict cached;
+        for (const auto& [key, value] : values.values())
+        {
+            cached.emplace_hint(cached.end(), std::string(key), value);
+        }
+
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        if (generation != 0)
+        {
+            // Already synchronized with the manager, which is newer.
+            return false;
+        }
+        changes = updateCache(cached);
+        generation = bundle.applicationGeneration(*index);
+        version = cachedVersion = bundle.applicationVersion(*index);
+    }
+    catch (const std::exception& e)
+    {
+        spdlog::info("No usable configuration cache for {}: {}",
+                     applicationName, e.what());
+        return false;
+    }
+    spdlog::info("Loaded cached configuration of {} at version {} in {}us",
+                 applicationName, cachedVersion,
+                 std::chrono::duration_cast<std::chrono::microseconds>(
+                     std::chrono::steady_clock::now() - start)
+                     .count());
+    dispatch(std::move(changes));
+    return true;
+}
+
+std::optional<sdbus::Variant>
+ApplicationConfigurationClient::get(const std::string& key) const
+{
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    auto it = cache.find(key);
+    if (it == cache.end())
+    {
+        return std::nullopt;
+    }
+    return it->second;
+}
+
+sdbus::UnixFd ApplicationConfigurationClient::getValue(const std::string& key)
+{
+    sdbus::UnixFd fd;
+    proxy->callMethod("GetValue")
+        .onInterface(ConfigurationConnection::interfaceName)
+        .withArguments(key)
+        .storeResultsTo(fd);
+    return fd;
+}
+
+uint64_t ApplicationConfigurationClient::getContentHash() const
+{
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    return contentHash;
+}
+
+void ApplicationConfigurationClient::handleConfigurationUpdated(
+    uint64_t updateGeneration, uint64_t updateVersion, uint64_t updateHash,
+    const config_dict& changed)
+{
+    {
+        AllocationScope scope(AllocationOperation::SignalHandling);
+        spdlog::debug("Configuration update {} received for {} ({} keys)",
+                      updateVersion, applicationName, changed.size());
+        std::vector<ConfigurationChange> changes;
+        bool missed = false;
+        bool outOfSync = false;
+        {
+            std::lock_guard<std::mutex> lock(cacheMutex);
+            if (updateGeneration == generation && updateVersion <= version)
+            {
+                return;
+            }
+            missed = updateGeneration != generation ||
+                     updateVersion != version + 1;
+            if (!missed)
+            {
+                changes = updateCache(changed);
+                version = updateVersion;
+                if (contentHash != updateHash)
+                {
+                    // Out of sync without a gap in versions; only a full
+                    // fetch can repair that.
+                    spdlog::warn("Content hash of {} differs at version {}",
+                                 applicationName, updateVersion);
+                    generation = 0;
+                    version = 0;
+                    outOfSync = true;
+                }
+            }
+        }
+        if (missed)
+        {
+            spdlog::info("Missed updates of {}, resynchronizing",
+                         applicationName);
+            requestResync();
+        }
+        else
+        {
+            dispatch(std::move(changes));
+            writeCache();
+            if (outOfSync)
+            {
+                requestResync();
+            }
+        }
+    }
+    logAllocationReport();
+}
+
+// Only the keys whose values differ from the cache are turned into changes;
+// untouched entries are neither copied nor dispatched.
+std::vector<ConfigurationChange>
+ApplicationConfigurationClient::updateCache(const config_dict& newConfig)
+{
+    std::vector<ConfigurationChange> changes;
+    for (const auto& [key, value] : newConfig)
+    {
+        auto it = cache.find(key);
+        if (it == cache.end())
+        {
+            changes.push_back({key, std::nullopt, value});
+            cache.emplace(key, value);
+            contentHash += configurationEntryHash(key, value);
+        }
+        else if (!variantEquals(it->second, value))
+        {
+            changes.push_back({key, it->second, value});
+            contentHash -= configurationEntryHash(key, it->second);
+            contentHash += configurationEntryHash(key, value);
+            it->second = value;
+        }
+    }
+    return changes;
+}
+
+void ApplicationConfigurationClient::writeCache()
+{
+    std::lock_guard<std::mutex> fileLock(cacheFileMutex);
+    if (cachePath.empty())
+    {
+        return;
+    }
+    config_dict snapshot;
+    uint64_t snapshotGeneration = 0;
+    uint64_t snapshotVersion = 0;
+    {
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        if (generation == 0)
+        {
+            // Never synchronized, or out of sync; keep the last known good
+            // state.
+            return;
+        }
+        snapshot = cache;
+        snapshotGeneration = generation;
+        snapshotVersion = version;
+    }
+    try
+    {
+        const auto parent = std::filesystem::path(cachePath).parent_path();
+        if (!parent.empty())
+        {
+            std::filesystem::create_directories(parent);
+        }
+        writeFileAtomically(
+            cachePath,
+            encodeConfigurationBundle(
+                std::vector<BundleApplication<config_dict>>{
+                    {applicationName, &snapshot, snapshotVersion,
+                     snapshotGeneration}}),
+            false);
+    }
+    catch (const std::exception& e)
+    {
+        spdlog::warn("Could not write configuration cache {}: {}", cachePath,
+                     e.what());
+    }
+}
+
+void ApplicationConfigurationClient::dispatch(
+    std::vector<ConfigurationChange> changes)
+{
+    for (auto& change : changes)
+    {
+        auto callbacks = matchingCallbacks(change.key);
+        if (callbacks.empty())
+        {
+            continue;
+        }
+        auto shared =
+            std::make_shared<const ConfigurationChange>(std::move(change));
+        for (auto& callback : callbacks)
+        {
+            executor->post(
+                [callback = std::move(callback), shared]()
+                {
+                    try
+                    {
+                        (*callback)(*shared);
+                    }
+                    catch (const std::exception& e)
+                    {
+                        spdlog::error("Change callback for {} failed: {}",
+                                      shared->key, e.what());
+                    }
+                });
+        }
+    }
+}
+
+std::vector<std::shared_ptr<const change_callback>>
+ApplicationConfigurationClient::matchingCallbacks(const std::string& key) const
+{
+    std::vector<std::shared_ptr<const change_callback>> result;
+    std::lock_guard<std::mutex> lock(callbacksMutex);
+    if (auto it = keyCallbacks.find(key); it != keyCallbacks.end())
+    {
+        result.insert(result.end(), it->second.begin(), it->second.end());
+    }
+    for (size_t length : prefixLengths)
+    {
+        if (length > key.size())
+        {
+            break;
+        }
+        auto it = prefixCallbacks.find(key.substr(0, length));
+        if (it != prefixCallbacks.end())
+        {
+            result.insert(result.end(), it->second.begin(), it->second.end());
+        }
+    }
+    return result;
+}
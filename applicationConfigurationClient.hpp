@@ -0,0 +1,236 @@
+#pragma once
+
+#include "executor.hpp"
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <sdbus-c++/sdbus-c++.h>
+#include <set>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+using config_dict = std::map<std::string, sdbus::Variant>;
+
+// One changed key as seen by a callback. Variants share their underlying
+// message, so handing them out does not copy payloads.
+struct ConfigurationChange
+{
+    std::string key;
+    // Empty when the key was not known before.
+    std::optional<sdbus::Variant> oldValue;
+    sdbus::Variant newValue;
+};
+
+using change_callback = std::function<void(const ConfigurationChange&)>;
+
+// Delays between resync attempts. Each delay is drawn uniformly from
+// [0, limit) where the limit doubles per failed attempt up to `maxDelay`,
+// so clients restarted together spread their fetches out.
+struct ResyncPolicy
+{
+    std::chrono::milliseconds initialDelay{500};
+    std::chrono::milliseconds maxDelay{30000};
+};
+
+class ApplicationConfigurationClient;
+
+// How a ConfigurationConnection reaches the manager.
+enum class ConfigurationTransport
+{
+    // Through the bus daemon, addressed by the manager's well-known name.
+    Bus,
+    // A direct connection to the manager's --peer-socket, e.g. from
+    // sdbus::createDirectBusConnection("unix:path=<socket>"). Calls and
+    // signals skip the bus daemon; a restarted manager is not noticed until
+    // the caller reconnects.
+    Peer
+};
+
+// Shares one D-Bus connection between any number of application handles.
+// A single wildcard match rule receives the updates of every application
+// and routes them by object path; one background thread performs all
+// resyncs. The caller keeps running the connection's event loop.
+class ConfigurationConnection
+{
+  public:
+    explicit ConfigurationConnection(
+        sdbus::IConnection& connection,
+        ResyncPolicy resyncPolicy = ResyncPolicy{},
+        ConfigurationTransport transport = ConfigurationTransport::Bus);
+    ~ConfigurationConnection();
+
+    ConfigurationConnection(const ConfigurationConnection&) = delete;
+    ConfigurationConnection& operator=(const ConfigurationConnection&) = delete;
+
+    sdbus::IConnection& getConnection() { return connection; }
+
+    static constexpr const char* serviceName =
+        "com.system.configurationManager";
+    static constexpr const char* interfaceName =
+        "com.system.configurationManager.Application.Configuration";
+    static constexpr const char* applicationsObjectPath =
+        "/com/system/configurationManager/Application/";
+
+  private:
+    friend class ApplicationConfigurationClient;
+
+    // Peers are not addressed by name.
+    sdbus::ServiceName destination() const;
+
+    void attach(ApplicationConfigurationClient* client);
+    void detach(ApplicationConfigurationClient* client);
+    void scheduleResync(ApplicationConfigurationClient* client,
+                        std::chrono::milliseconds maxDelay);
+
+    void handleConfigurationUpdated(sdbus::Message message);
+    void finishSignal();
+    void handleNameOwnerChanged(sdbus::Message message);
+
+    using Clock = std::chrono::steady_clock;
+    struct Resync
+    {
+        ApplicationConfigurationClient* client;
+        std::chrono::milliseconds limit;
+    };
+    // Expects resyncMutex to be held.
+    void scheduleLocked(ApplicationConfigurationClient* client,
+                        std::chrono::milliseconds delay,
+                        std::chrono::milliseconds limit);
+    void resyncLoop();
+    // Expects resyncMutex to be held.
+    std::chrono::milliseconds jitter(std::chrono::milliseconds limit);
+
+    sdbus::IConnection& connection;
+    const ConfigurationTransport transport;
+
+    // Object path -> handle.
+    std::mutex clientsMutex;
+    std::condition_variable clientsCondition;
+    std::unordered_map<std::string, ApplicationConfigurationClient*> clients;
+    // The handle a signal is being delivered to, outside clientsMutex, and
+    // the event loop thread delivering it.
+    ApplicationConfigurationClient* signalInFlight{nullptr};
+    std::thread::id signalThread;
+
+    const ResyncPolicy resyncPolicy;
+    std::mutex resyncMutex;
+    std::condition_variable resyncCondition;
+    std::unordered_set<ApplicationConfigurationClient*> attached;
+    std::multimap<Clock::time_point, Resync> pendingResyncs;
+    std::unordered_map<ApplicationConfigurationClient*,
+                       std::multimap<Clock::time_point, Resync>::iterator>
+        scheduledResyncs;
+    ApplicationConfigurationClient* resyncInFlight{nullptr};
+    bool running{true};
+    std::mt19937_64 random{std::random_device{}()};
+    std::thread resyncThread;
+
+    // Last, so that no signal is delivered into destroyed members.
+    sdbus::Slot configurationUpdatedSlot;
+    sdbus::Slot nameOwnerChangedSlot;
+};
+
+// Client side of one application's configuration object exported by the
+// manager. Keeps the last known configuration with its version and
+// dispatches incoming changes to callbacks registered per key or key prefix.
+// Missed versions (a gap in signals, or a manager restart) are caught up
+// with a version-conditional fetch in the background.
+class ApplicationConfigurationClient
+{
+  public:
+    ApplicationConfigurationClient(
+        ConfigurationConnection& configurationConnection,
+        const std::string& applicationName,
+        std::shared_ptr<Executor> executor = std::make_shared<InlineExecutor>());
+
+    ~ApplicationConfigurationClient();
+
+    ApplicationConfigurationClient(const ApplicationConfigurationClient&) =
+        delete;
+    ApplicationConfigurationClient&
+    operator=(const ApplicationConfigurationClient&) = delete;
+
+    // `pattern` is either an exact key or a prefix ending in '*' ("*" alone
+    // matches every key).
+    void onChange(const std::string& pattern, change_callback callback);
+
+    // Fetches whatever changed since the cached version and dispatches it.
+    // Returns false if the manager could not be reached, or if an
+    // incremental result did not add up to the manager's content hash.
+    bool fetch();
+
+    // Schedules fetch() on the resync thread, retrying with backoff, after
+    // a random delay of up to `maxInitialDelay`.
+    void requestResync(std::chrono::milliseconds maxInitialDelay =
+                           std::chrono::milliseconds::zero());
+
+    // Serves the last known good configuration cached in `path` right away
+    // and rewrites the file whenever a newer version has been applied.
+    // Callbacks registered so far receive the cached values as changes.
+    // Returns false if there was no usable cache; the file is written from
+    // then on all the same. Call before fetching, then requestResync() to
+    // reconcile with the manager.
+    bool loadCache(const std::string& path);
+
+    std::optional<sdbus::Variant> get(const std::string& key) const;
+
+    // Fetches the sealed memfd behind a value whose cached entry is a blob
+    // handle (see isBlobHandle()). Map it read-only; its content never
+    // changes. Throws sdbus::Error if the key is not stored as a blob.
+    sdbus::UnixFd getValue(const std::string& key);
+
+    const std::string& getObjectPath() const { return objectPath; }
+
+    // Content hash of the cached configuration; equals the manager's
+    // ContentHash property whenever the cache is in sync.
+    uint64_t getContentHash() const;
+
+  private:
+    friend class ConfigurationConnection;
+
+    void handleConfigurationUpdated(uint64_t generation, uint64_t version,
+                                    uint64_t contentHash,
+                                    const config_dict& changed);
+    // Expects cacheMutex to be held.
+    std::vector<ConfigurationChange> updateCache(const config_dict& newConfig);
+    void dispatch(std::vector<ConfigurationChange> changes);
+    void writeCache();
+    std::vector<std::shared_ptr<const change_callback>>
+    matchingCallbacks(const std::string& key) const;
+
+    ConfigurationConnection& configurationConnection;
+    std::string applicationName;
+    std::string objectPath;
+    std::shared_ptr<Executor> executor;
+
+    mutable std::mutex cacheMutex;
+    config_dict cache;
+    uint64_t generation{0};
+    uint64_t version{0};
+    // Maintained incrementally by updateCache(), see configurationEntryHash().
+    uint64_t contentHash{0};
+
+    // Snapshots are taken under cacheFileMutex, so the file never goes back
+    // to an older version.
+    std::mutex cacheFileMutex;
+    std::string cachePath;
+
+    // Dispatch table: exact keys, and prefixes looked up by every prefix
+    // length that has at least one subscription.
+    mutable std::mutex callbacksMutex;
+    using callback_list = std::vector<std::shared_ptr<const change_callback>>;
+    std::unordered_map<std::string, callback_list> keyCallbacks;
+    std::unordered_map<std::string, callback_list> prefixCallbacks;
+    std::set<size_t> prefixLengths;
+
+    // Method calls only; signals arrive through the shared match rule.
+    std::unique_ptr<sdbus::IProxy> proxy;
+};
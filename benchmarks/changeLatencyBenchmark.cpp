@@ -0,0 +1,198 @@
+#include "CLI/CLI.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <sdbus-c++/sdbus-c++.h>
+#include <spdlog/sinks/stdout_color_sinks.h>
+#include <spdlog/spdlog.h>
+#include <string>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace fs = std::filesystem;
+using Clock = std::chrono::steady_clock;
+
+static void initialize_logging()
+{
+    auto logger = spdlog::stdout_color_mt("change_latency_benchmark");
+    logger->set_level(spdlog::level::info);
+    spdlog::set_default_logger(logger);
+}
+
+static pid_t spawnManager(const std::string& managerPath,
+                          const std::vector<std::string>& arguments)
+{
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        throw std::runtime_error("fork failed: " +
+                                 std::string(strerror(errno)));
+    }
+    if (pid == 0)
+    {
+        std::vector<char*> argv{const_cast<char*>(managerPath.c_str())};
+        for (const auto& argument : arguments)
+        {
+            argv.push_back(const_cast<char*>(argument.c_str()));
+        }
+        argv.push_back(nullptr);
+        execv(managerPath.c_str(), argv.data());
+        _exit(127);
+    }
+    return pid;
+}
+
+// Round-trip times of `iterations` calls, in microseconds, sorted.
+static std::vector<double> measure(const std::function<void()>& call,
+                                   size_t iterations)
+{
+    std::vector<double> samples;
+    samples.reserve(iterations);
+    for (size_t i = 0; i < iterations; ++i)
+    {
+        const auto start = Clock::now();
+        call();
+        samples.push_back(
+            std::chrono::duration<double, std::micro>(Clock::now() - start)
+                .count());
+    }
+    std::sort(samples.begin(), samples.end());
+    return samples;
+}
+
+static void report(const std::string& name, const std::vector<double>& samples)
+{
+    auto percentile = [&samples](double p)
+    {
+        return samples[std::min(samples.size() - 1,
+                                static_cast<size_t>(p * samples.size()))];
+    };
+    std::cout << name << "_p50_us: " << percentile(0.50) << "\n"
+              << name << "_p99_us: " << percentile(0.99) << "\n"
+              << name << "_max_us: " << samples.back() << "\n";
+}
+
+// ChangeConfiguration latency of one manager run, with its signals emitted
+// before or after the reply.
+static std::vector<double> measureManager(const std::string& managerPath,
+                                          const fs::path& configDir,
+                                          bool signalsBeforeReply,
+                                          size_t iterations)
+{
+    std::vector<std::string> arguments{"--config-dir", configDir.string()};
+    if (signalsBeforeReply)
+    {
+        arguments.push_back("--signals-before-reply");
+    }
+    pid_t manager = spawnManager(managerPath, arguments);
+
+    const sdbus::InterfaceName interfaceName{
+        "com.system.configurationManager.Application.Configuration"};
+    auto connection = sdbus::createSessionBusConnection();
+    auto proxy = sdbus::createProxy(
+        *connection, sdbus::ServiceName{"com.system.configurationManager"},
+        sdbus::ObjectPath{"/com/system/configurationManager/Application/"
+                          "largeApplication"});
+
+    const auto deadline = Clock::now() + std::chrono::seconds(30);
+    for (;;)
+    {
+        try
+        {
+            std::map<std::string, sdbus::Variant> configuration;
+            proxy->callMethod("GetConfiguration")
+                .onInterface(interfaceName)
+                .storeResultsTo(configuration);
+            break;
+        }
+        catch (const sdbus::Error&)
+        {
+            if (Clock::now() > deadline)
+                throw std::runtime_error("Manager did not start");
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    }
+
+    int64_t counter = 0;
+    auto change = [&proxy, &interfaceName, &counter]()
+    {
+        proxy->callMethod("ChangeConfiguration")
+            .onInterface(interfaceName)
+            .withArguments(std::string("Counter"), sdbus::Variant(++counter));
+    };
+    measure(change, iterations / 10 + 1);
+    auto samples = measure(change, iterations);
+
+    proxy.reset();
+    kill(manager, SIGTERM);
+    waitpid(manager, nullptr, 0);
+    return samples;
+}
+
+int main(int argc, char* argv[])
+{
+    initialize_logging();
+
+    try
+    {
+        size_t iterations = 2000;
+        size_t keys = 10000;
+        std::string managerPath = "./manager";
+
+        CLI::App app{"ChangeConfiguration latency with signals emitted "
+                     "before and after the reply"};
+        app.add_option("-n,--iterations", iterations, "Calls per mode")
+            ->check(CLI::PositiveNumber)
+            ->default_val(2000);
+        app.add_option("-k,--keys", keys,
+                       "Keys in the configuration every signal carries")
+            ->check(CLI::PositiveNumber)
+            ->default_val(10000);
+        app.add_option("--manager", managerPath, "Path to the manager binary")
+            ->default_val("./manager");
+
+        CLI11_PARSE(app, argc, argv);
+
+        const fs::path workDir =
+            fs::temp_directory_path() /
+            ("configurationManagerChange." + std::to_string(getpid()));
+        fs::create_directories(workDir / "configs");
+        {
+            std::ofstream configFile(workDir / "configs" /
+                                     "largeApplication.json");
+            configFile << "{\"Counter\": 0";
+            for (size_t i = 0; i < keys; ++i)
+            {
+                configFile << ", \"Key" << i << "\": \"Value " << i << "\"";
+            }
+            configFile << "}";
+        }
+
+        std::cout << "iterations: " << iterations << "\n"
+                  << "keys: " << keys << "\n";
+        report("signals_before_reply",
+               measureManager(managerPath, workDir / "configs", true,
+                              iterations));
+        report("signals_after_reply",
+               measureManager(managerPath, workDir / "configs", false,
+                              iterations));
+        std::cout.flush();
+
+        fs::remove_all(workDir);
+    }
+    catch (const std::exception& e)
+    {
+        spdlog::critical("Benchmark failed: {}", e.what());
+        return 1;
+    }
+    return 0;
+}
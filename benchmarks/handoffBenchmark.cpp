@@ -0,0 +1,223 @@
+#include "CLI/CLI.hpp"
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <sdbus-c++/sdbus-c++.h>
+#include <spdlog/sinks/stdout_color_sinks.h>
+#include <spdlog/spdlog.h>
+#include <string>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace fs = std::filesystem;
+using Clock = std::chrono::steady_clock;
+
+static void initialize_logging()
+{
+    auto logger = spdlog::stdout_color_mt("handoff_benchmark");
+    logger->set_level(spdlog::level::info);
+    spdlog::set_default_logger(logger);
+}
+
+static void writeConfigs(const fs::path& configDir, size_t applications)
+{
+    fs::create_directories(configDir);
+    for (size_t i = 0; i < applications; ++i)
+    {
+        std::ofstream configFile(configDir /
+                                 ("handoffApplication" + std::to_string(i) +
+                                  ".json"));
+        configFile << R"({"Timeout": 1000, "TimeoutPhrase": "Hey"})";
+    }
+}
+
+static pid_t spawnManager(const std::string& managerPath,
+                          const std::vector<std::string>& arguments)
+{
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        throw std::runtime_error("fork failed: " +
+                                 std::string(strerror(errno)));
+    }
+    if (pid == 0)
+    {
+        std::vector<char*> argv{const_cast<char*>(managerPath.c_str())};
+        for (const auto& argument : arguments)
+        {
+            argv.push_back(const_cast<char*>(argument.c_str()));
+        }
+        argv.push_back(nullptr);
+        execv(managerPath.c_str(), argv.data());
+        _exit(127);
+    }
+    return pid;
+}
+
+// Tracks the longest stretch without a successful call.
+struct Availability
+{
+    std::atomic<uint64_t> calls{0};
+    std::atomic<uint64_t> failures{0};
+    std::atomic<int64_t> maxGapUs{0};
+
+    void run(const std::function<void()>& call, const std::atomic<bool>& running)
+    {
+        auto lastSuccess = Clock::now();
+        while (running)
+        {
+            ++calls;
+            try
+            {
+                call();
+                const auto now = Clock::now();
+                const auto gap =
+                    std::chrono::duration_cast<std::chrono::microseconds>(
+                        now - lastSuccess)
+                        .count();
+                if (gap > maxGapUs)
+                {
+                    maxGapUs = gap;
+                }
+                lastSuccess = now;
+            }
+            catch (const sdbus::Error&)
+            {
+                ++failures;
+            }
+        }
+    }
+};
+
+int main(int argc, char* argv[])
+{
+    initialize_logging();
+
+    try
+    {
+        size_t applications = 1000;
+        std::string managerPath = "./manager";
+        int settleMs = 500;
+
+        CLI::App app{"Restart handoff benchmark for the Configuration Manager"};
+        app.add_option("-n,--applications", applications,
+                       "Number of generated application configs")
+            ->check(CLI::PositiveNumber)
+            ->default_val(1000);
+        app.add_option("--manager", managerPath, "Path to the manager binary")
+            ->default_val("./manager");
+        app.add_option("--settle", settleMs,
+                       "Milliseconds to keep measuring around the handoff")
+            ->check(CLI::PositiveNumber)
+            ->default_val(500);
+
+        CLI11_PARSE(app, argc, argv);
+
+        const fs::path workDir =
+            fs::temp_directory_path() /
+            ("configurationManagerHandoff." + std::to_string(getpid()));
+        const std::string socketPath = (workDir / "handoff.sock").string();
+        writeConfigs(workDir / "configs", applications);
+
+        const std::string objectPath =
+            "/com/system/configurationManager/Application/handoffApplication0";
+        const std::string interfaceName =
+            "com.system.configurationManager.Application.Configuration";
+
+        pid_t predecessor = spawnManager(
+            managerPath, {"--config-dir", (workDir / "configs").string(),
+                          "--handoff-socket", socketPath});
+
+        auto connection = sdbus::createSessionBusConnection();
+        auto proxy = sdbus::createProxy(
+            *connection,
+            sdbus::ServiceName{"com.system.configurationManager"},
+            sdbus::ObjectPath{objectPath});
+        auto read = [&proxy, &interfaceName]()
+        {
+            std::map<std::string, sdbus::Variant> configuration;
+            proxy->callMethod("GetConfiguration")
+                .onInterface(interfaceName)
+                .storeResultsTo(configuration);
+        };
+        int64_t counter = 0;
+        auto write = [&proxy, &interfaceName, &counter]()
+        {
+            proxy->callMethod("ChangeConfiguration")
+                .onInterface(interfaceName)
+                .withArguments(std::string("Counter"),
+                               sdbus::Variant(++counter));
+        };
+
+        const auto deadline = Clock::now() + std::chrono::seconds(60);
+        while (!fs::exists(socketPath) && Clock::now() < deadline)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        for (;;)
+        {
+            try
+            {
+                read();
+                break;
+            }
+            catch (const sdbus::Error&)
+            {
+                if (Clock::now() > deadline)
+                    throw std::runtime_error("Manager did not start");
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+        }
+
+        std::atomic<bool> running{true};
+        Availability reads;
+        Availability writes;
+        std::thread reader([&]() { reads.run(read, running); });
+        std::thread writer([&]() { writes.run(write, running); });
+        std::this_thread::sleep_for(std::chrono::milliseconds(settleMs));
+
+        const auto start = Clock::now();
+        pid_t successor =
+            spawnManager(managerPath, {"--take-over", socketPath,
+                                       "--handoff-socket", socketPath});
+        int status = 0;
+        waitpid(predecessor, &status, 0);
+        const auto handoff = Clock::now() - start;
+        std::this_thread::sleep_for(std::chrono::milliseconds(settleMs));
+        running = false;
+        reader.join();
+        writer.join();
+
+        kill(successor, SIGTERM);
+        waitpid(successor, nullptr, 0);
+        fs::remove_all(workDir);
+
+        std::cout << "applications: " << applications << "\n"
+                  << "handoff_ms: "
+                  << std::chrono::duration_cast<std::chrono::milliseconds>(
+                         handoff)
+                         .count()
+                  << "\n"
+                  << "read_calls: " << reads.calls << "\n"
+                  << "read_failures: " << reads.failures << "\n"
+                  << "read_max_gap_us: " << reads.maxGapUs << "\n"
+                  << "write_calls: " << writes.calls << "\n"
+                  << "write_failures: " << writes.failures << "\n"
+                  << "write_max_gap_us: " << writes.maxGapUs << std::endl;
+    }
+    catch (const std::exception& e)
+    {
+        spdlog::critical("Benchmark failed: {}", e.what());
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,215 @@
+#include "CLI/CLI.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <sdbus-c++/sdbus-c++.h>
+#include <spdlog/sinks/stdout_color_sinks.h>
+#include <spdlog/spdlog.h>
+#include <string>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace fs = std::filesystem;
+using Clock = std::chrono::steady_clock;
+
+static void initialize_logging()
+{
+    auto logger = spdlog::stdout_color_mt("peer_benchmark");
+    logger->set_level(spdlog::level::info);
+    spdlog::set_default_logger(logger);
+}
+
+static pid_t spawnManager(const std::string& managerPath,
+                          const std::vector<std::string>& arguments)
+{
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        throw std::runtime_error("fork failed: " +
+                                 std::string(strerror(errno)));
+    }
+    if (pid == 0)
+    {
+        std::vector<char*> argv{const_cast<char*>(managerPath.c_str())};
+        for (const auto& argument : arguments)
+        {
+            argv.push_back(const_cast<char*>(argument.c_str()));
+        }
+        argv.push_back(nullptr);
+        execv(managerPath.c_str(), argv.data());
+        _exit(127);
+    }
+    return pid;
+}
+
+// Round-trip times of `iterations` calls, in microseconds, sorted.
+static std::vector<double> measure(const std::function<void()>& call,
+                                   size_t iterations)
+{
+    std::vector<double> samples;
+    samples.reserve(iterations);
+    for (size_t i = 0; i < iterations; ++i)
+    {
+        const auto start = Clock::now();
+        call();
+        samples.push_back(
+            std::chrono::duration<double, std::micro>(Clock::now() - start)
+                .count());
+    }
+    std::sort(samples.begin(), samples.end());
+    return samples;
+}
+
+static void report(const std::string& name, const std::vector<double>& samples)
+{
+    auto percentile = [&samples](double p)
+    {
+        return samples[std::min(samples.size() - 1,
+                                static_cast<size_t>(p * samples.size()))];
+    };
+    std::cout << name << "_p50_us: " << percentile(0.50) << "\n"
+              << name << "_p99_us: " << percentile(0.99) << "\n"
+              << name << "_max_us: " << samples.back() << "\n";
+}
+
+int main(int argc, char* argv[])
+{
+    initialize_logging();
+
+    try
+    {
+        size_t iterations = 10000;
+        std::string managerPath = "./manager";
+
+        CLI::App app{"Brokered versus peer-to-peer call latency for the "
+                     "Configuration Manager"};
+        app.add_option("-n,--iterations", iterations,
+                       "Calls per transport and method")
+            ->check(CLI::PositiveNumber)
+            ->default_val(10000);
+        app.add_option("--manager", managerPath, "Path to the manager binary")
+            ->default_val("./manager");
+
+        CLI11_PARSE(app, argc, argv);
+
+        const fs::path workDir =
+            fs::temp_directory_path() /
+            ("configurationManagerPeer." + std::to_string(getpid()));
+        const std::string socketPath = (workDir / "peer.sock").string();
+        fs::create_directories(workDir / "configs");
+        {
+            std::ofstream configFile(workDir / "configs" /
+                                     "peerApplication.json");
+            configFile << R"({"Timeout": 1000, "TimeoutPhrase": "Hey"})";
+        }
+
+        pid_t manager = spawnManager(
+            managerPath, {"--config-dir", (workDir / "configs").string(),
+                          "--peer-socket", socketPath});
+
+        const sdbus::ObjectPath objectPath{
+            "/com/system/configurationManager/Application/peerApplication"};
+        const sdbus::InterfaceName interfaceName{
+            "com.system.configurationManager.Application.Configuration"};
+
+        auto busConnection = sdbus::createSessionBusConnection();
+        auto busProxy = sdbus::createProxy(
+            *busConnection,
+            sdbus::ServiceName{"com.system.configurationManager"}, objectPath);
+
+        const auto deadline = Clock::now() + std::chrono::seconds(30);
+        std::unique_ptr<sdbus::IConnection> peerConnection;
+        while (!peerConnection)
+        {
+            try
+            {
+                if (fs::exists(socketPath))
+                {
+                    peerConnection = sdbus::createDirectBusConnection(
+                        "unix:path=" + socketPath);
+                }
+            }
+            catch (const sdbus::Error&)
+            {
+            }
+            if (!peerConnection)
+            {
+                if (Clock::now() > deadline)
+                    throw std::runtime_error("Manager did not start");
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+        }
+        // Peers do not address the manager by name.
+        auto peerProxy = sdbus::createProxy(*peerConnection,
+                                            sdbus::ServiceName{}, objectPath);
+
+        auto read = [&interfaceName](sdbus::IProxy& proxy)
+        {
+            return [&proxy, &interfaceName]()
+            {
+                std::map<std::string, sdbus::Variant> configuration;
+                proxy.callMethod("GetConfiguration")
+                    .onInterface(interfaceName)
+                    .storeResultsTo(configuration);
+            };
+        };
+        int64_t counter = 0;
+        auto write = [&interfaceName, &counter](sdbus::IProxy& proxy)
+        {
+            return [&proxy, &interfaceName, &counter]()
+            {
+                proxy.callMethod("ChangeConfiguration")
+                    .onInterface(interfaceName)
+                    .withArguments(std::string("Counter"),
+                                   sdbus::Variant(++counter));
+            };
+        };
+
+        for (;;)
+        {
+            try
+            {
+                read(*busProxy)();
+                break;
+            }
+            catch (const sdbus::Error&)
+            {
+                if (Clock::now() > deadline)
+                    throw std::runtime_error("Manager did not start");
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+        }
+
+        // Warm both paths up before measuring.
+        measure(read(*busProxy), iterations / 10 + 1);
+        measure(read(*peerProxy), iterations / 10 + 1);
+
+        std::cout << "iterations: " << iterations << "\n";
+        report("bus_get", measure(read(*busProxy), iterations));
+        report("peer_get", measure(read(*peerProxy), iterations));
+        report("bus_change", measure(write(*busProxy), iterations));
+        report("peer_change", measure(write(*peerProxy), iterations));
+        std::cout.flush();
+
+        peerProxy.reset();
+        peerConnection.reset();
+        kill(manager, SIGTERM);
+        waitpid(manager, nullptr, 0);
+        fs::remove_all(workDir);
+    }
+    catch (const std::exception& e)
+    {
+        spdlog::critical("Benchmark failed: {}", e.what());
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,219 @@
+#include "CLI/CLI.hpp"
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sdbus-c++/sdbus-c++.h>
+#include <spdlog/sinks/stdout_color_sinks.h>
+#include <spdlog/spdlog.h>
+#include <string>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+using Clock = std::chrono::steady_clock;
+using allocation_stats =
+    std::map<std::string, sdbus::Struct<uint64_t, uint64_t, uint64_t>>;
+
+static void initialize_logging()
+{
+    auto logger = spdlog::stdout_color_mt("registration_benchmark");
+    logger->set_level(spdlog::level::info);
+    spdlog::set_default_logger(logger);
+}
+
+static void writeConfigs(const fs::path& configDir, size_t applications)
+{
+    fs::create_directories(configDir);
+    for (size_t i = 0; i < applications; ++i)
+    {
+        std::ofstream configFile(configDir /
+                                 ("benchApplication" + std::to_string(i) +
+                                  ".json"));
+        configFile << R"({"Timeout": 1000, "TimeoutPhrase": "Hey"})";
+    }
+}
+
+static pid_t spawnManager(const std::string& managerPath,
+                          const fs::path& configDir,
+                          const std::string& registration)
+{
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        throw std::runtime_error("fork failed: " +
+                                 std::string(strerror(errno)));
+    }
+    if (pid == 0)
+    {
+        execl(managerPath.c_str(), managerPath.c_str(), "--config-dir",
+              configDir.c_str(), "--registration", registration.c_str(),
+              static_cast<char*>(nullptr));
+        _exit(127);
+    }
+    return pid;
+}
+
+// The manager only requests its name after every object is registered, so
+// the first successful call marks the end of the registration phase.
+static bool waitUntilServing(sdbus::IConnection& connection, pid_t manager,
+                             const std::string& lastApplication,
+                             std::chrono::seconds timeout)
+{
+    auto proxy = sdbus::createProxy(
+        connection,
+        static_cast<sdbus::ServiceName>("com.system.configurationManager"),
+        static_cast<sdbus::ObjectPath>(
+            "/com/system/configurationManager/Application/" +
+            lastApplication));
+    const auto deadline = Clock::now() + timeout;
+    while (Clock::now() < deadline)
+    {
+        if (waitpid(manager, nullptr, WNOHANG) == manager)
+        {
+            spdlog::error("Manager exited before serving requests");
+            return false;
+        }
+        try
+        {
+            std::map<std::string, sdbus::Variant> configuration;
+            proxy->callMethod("GetConfiguration")
+                .onInterface(
+                    "com.system.configurationManager.Application.Configuration")
+                .storeResultsTo(configuration);
+            return true;
+        }
+        catch (const sdbus::Error&)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    }
+    return false;
+}
+
+// Empty unless the manager was built with ENABLE_ALLOCATION_TRACKING.
+static allocation_stats readAllocationStats(sdbus::IConnection& connection)
+{
+    allocation_stats stats;
+    try
+    {
+        auto proxy = sdbus::createProxy(
+            connection,
+            static_cast<sdbus::ServiceName>("com.system.configurationManager"),
+            static_cast<sdbus::ObjectPath>("/com/system/configurationManager"));
+        proxy->callMethod("GetAllocationStats")
+            .onInterface("com.system.configurationManager.Stats")
+            .storeResultsTo(stats);
+    }
+    catch (const sdbus::Error& e)
+    {
+        spdlog::warn("Could not read allocation stats: {}", e.what());
+    }
+    return stats;
+}
+
+static std::map<std::string, std::string> readMemoryStatus(pid_t pid)
+{
+    std::map<std::string, std::string> status;
+    std::ifstream statusFile("/proc/" + std::to_string(pid) + "/status");
+    std::string line;
+    while (std::getline(statusFile, line))
+    {
+        if (line.rfind("VmRSS:", 0) == 0 || line.rfind("VmHWM:", 0) == 0)
+        {
+            auto colon = line.find(':');
+            auto value = line.substr(colon + 1);
+            value.erase(0, value.find_first_not_of(" \t"));
+            status[line.substr(0, colon)] = value;
+        }
+    }
+    return status;
+}
+
+int main(int argc, char* argv[])
+{
+    initialize_logging();
+
+    try
+    {
+        size_t applications = 100000;
+        std::string managerPath = "./manager";
+        std::string registration = "per-object";
+        int timeoutSeconds = 600;
+
+        CLI::App app{"Registration benchmark for the Configuration Manager"};
+        app.add_option("-n,--applications", applications,
+                       "Number of generated application configs")
+            ->check(CLI::PositiveNumber)
+            ->default_val(100000);
+        app.add_option("--manager", managerPath, "Path to the manager binary")
+            ->default_val("./manager");
+        app.add_option("--registration", registration,
+                       "Registration mode passed to the manager")
+            ->check(CLI::IsMember({"per-object", "fallback"}))
+            ->default_val("per-object");
+        app.add_option("--timeout", timeoutSeconds,
+                       "Seconds to wait for the manager to start serving")
+            ->check(CLI::PositiveNumber)
+            ->default_val(600);
+
+        CLI11_PARSE(app, argc, argv);
+
+        const fs::path configDir =
+            fs::temp_directory_path() /
+            ("configurationManagerBenchmark." + std::to_string(getpid()));
+        spdlog::info("Writing {} configs to {}", applications,
+                     configDir.string());
+        writeConfigs(configDir, applications);
+
+        auto connection = sdbus::createSessionBusConnection();
+        const auto start = Clock::now();
+        pid_t manager = spawnManager(managerPath, configDir, registration);
+        bool serving = waitUntilServing(
+            *connection, manager,
+            "benchApplication" + std::to_string(applications - 1),
+            std::chrono::seconds(timeoutSeconds));
+        const auto elapsed = Clock::now() - start;
+        auto memory = readMemoryStatus(manager);
+        auto allocations = serving ? readAllocationStats(*connection)
+                                   : allocation_stats{};
+
+        kill(manager, SIGTERM);
+        waitpid(manager, nullptr, 0);
+        fs::remove_all(configDir);
+
+        if (!serving)
+        {
+            spdlog::critical("Manager did not start serving in time");
+            return 1;
+        }
+
+        std::cout << "registration: " << registration << "\n"
+                  << "applications: " << applications << "\n"
+                  << "startup_ms: "
+                  << std::chrono::duration_cast<std::chrono::milliseconds>(
+                         elapsed)
+                         .count()
+                  << "\n"
+                  << "rss: " << memory["VmRSS"] << "\n"
+                  << "peak_rss: " << memory["VmHWM"] << "\n";
+        for (const auto& [operation, counters] : allocations)
+        {
+            std::cout << "allocations_" << operation << ": "
+                      << std::get<0>(counters) << " (" << std::get<1>(counters)
+                      << " bytes)\n";
+        }
+        std::cout << std::flush;
+    }
+    catch (const std::exception& e)
+    {
+        spdlog::critical("Benchmark failed: {}", e.what());
+        return 1;
+    }
+    return 0;
+}
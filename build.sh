@@ -3,6 +3,7 @@ set -e
 
 # Default values
 RUN_FORMAT=false
+BUILD_BENCHMARKS=false
 VERBOSE=false
 SHOW_HELP=false
 
@@ -15,6 +16,7 @@ Build script for the project
 
 Options:
   --format      Run clang-format before building
+  --benchmarks  Also build the benchmark executables
   -v, --verbose Show verbose build output
   -h, --help    Show this help message and exit
 EOF
@@ -27,6 +29,10 @@ while [[ $# -gt 0 ]]; do
             RUN_FORMAT=true
             shift
             ;;
+        --benchmarks)
+            BUILD_BENCHMARKS=true
+            shift
+            ;;
         -v|--verbose)
             VERBOSE=true
             shift
@@ -60,6 +66,10 @@ if [ "$VERBOSE" = true ]; then
     echo "Verbose output enabled"
 fi
 
+if [ "$BUILD_BENCHMARKS" = true ]; then
+    CMAKE_ARGS+=(-DBUILD_BENCHMARKS=ON)
+fi
+
 cmake "${CMAKE_ARGS[@]}" ..
 
 # Run formatting if requested
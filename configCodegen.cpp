@@ -0,0 +1,425 @@
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <nlohmann/json.hpp>
+#include <regex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Generates typed D-Bus adaptors and proxies from application schemas:
+//
+//   config_codegen <output-dir> <schema.json>...
+//
+// A schema names an application and the D-Bus type of each known key:
+//
+//   {"application": "confManagerApplication1",
+//    "keys": {"Timeout": "x", "TimeoutPhrase": "s"}}
+//
+// For every schema <application>Types.hpp, <application>Adaptor.hpp and
+// <application>Proxy.hpp are written, plus configurationAdaptors.hpp with
+// createTypedAdaptor() and createSchemaValidator() for the manager. Runs at build time, so it only
+// depends on nlohmann/json.
+
+using json = nlohmann::json;
+namespace fs = std::filesystem;
+
+namespace
+{
+const std::string typedInterfacePrefix =
+    "com.system.configurationManager.Typed.";
+
+struct Schema
+{
+    std::string application;
+    std::string source;
+    // Key -> D-Bus signature, in key order.
+    std::map<std::string, std::string> keys;
+};
+
+const std::map<std::string, std::string>& cppTypes()
+{
+    static const std::map<std::string, std::string> types{
+        {"s", "std::string"}, {"x", "int64_t"},
+        {"t", "uint64_t"},    {"d", "double"},
+        {"b", "bool"},        {"ay", "std::vector<uint8_t>"}};
+    return types;
+}
+
+// Names become C++ identifiers and D-Bus member names.
+void checkIdentifier(const std::string& name, const std::string& what)
+{
+    static const std::regex identifier("[A-Za-z_][A-Za-z0-9_]*");
+    if (!std::regex_match(name, identifier))
+    {
+        throw std::runtime_error(what + " '" + name +
+                                 "' is not a valid identifier");
+    }
+}
+
+Schema readSchema(const fs::path& path)
+{
+    std::ifstream file(path);
+    if (!file)
+    {
+        throw std::runtime_error("Could not open " + path.string());
+    }
+    const auto document = json::parse(file);
+    Schema schema;
+    schema.source = path.filename().string();
+    schema.application = document.at("application").get<std::string>();
+    checkIdentifier(schema.application, "Application");
+    // The build derives the generated file names from the schema file name.
+    if (path.stem().string() != schema.application)
+    {
+        throw std::runtime_error("Schema for " + schema.application +
+                                 " must be named " + schema.application +
+                                 ".json");
+    }
+    for (const auto& [key, type] : document.at("keys").items())
+    {
+        checkIdentifier(key, "Key");
+        const auto signature = type.get<std::string>();
+        if (!cppTypes().count(signature))
+        {
+            throw std::runtime_error("Key '" + key +
+                                     "' has unsupported type '" + signature +
+                                     "'");
+        }
+        schema.keys.emplace(key, signature);
+    }
+    if (schema.keys.empty())
+    {
+        throw std::runtime_error("Schema " + schema.source + " has no keys");
+    }
+    return schema;
+}
+
+std::string header(const Schema& schema)
+{
+    return "// Generated by config_codegen from " + schema.source +
+           "; do not edit.\n#pragma once\n\n";
+}
+
+std::string namespaceName(const Schema& schema)
+{
+    return "configuration_schema::" + schema.application;
+}
+
+std::string generateTypes(const Schema& schema)
+{
+    std::ostringstream out;
+    out << header(schema)
+        << "#include <cstdint>\n"
+           "#include <sdbus-c++/sdbus-c++.h>\n"
+           "#include <string>\n"
+           "#include <vector>\n\n"
+        << "namespace " << namespaceName(schema) << "\n{\n"
+        << "constexpr const char* applicationName = \"" << schema.application
+        << "\";\n"
+        << "constexpr const char* interfaceName =\n    \""
+        << typedInterfacePrefix << schema.application << "\";\n\n"
+        << "struct Configuration\n{\n";
+    for (const auto& [key, type] : schema.keys)
+    {
+        out << "    " << cppTypes().at(type) << " " << key << "{};\n";
+    }
+    out << "};\n} // namespace " << namespaceName(schema) << "\n\n"
+        << "SDBUSCPP_REGISTER_STRUCT(" << namespaceName(schema)
+        << "::Configuration";
+    for (const auto& [key, _] : schema.keys)
+    {
+        out << ", " << key;
+    }
+    out << ");\n";
+    return out.str();
+}
+
+std::string generateAdaptor(const Schema& schema)
+{
+    std::ostringstream out;
+    out << header(schema) << "#include \"" << schema.application
+        << "Types.hpp\"\n"
+           "#include \"typedAdaptor.hpp\"\n"
+           "#include <stdexcept>\n"
+           "#include <utility>\n\n"
+        << "namespace " << namespaceName(schema) << "\n{\n"
+        << "// Throws std::invalid_argument if `key` is in the schema and "
+           "`value`\n"
+           "// does not have its type.\n"
+           "inline void validate(const std::string& key, "
+           "const sdbus::Variant& value)\n"
+           "{\n";
+    for (const auto& [key, type] : schema.keys)
+    {
+        out << "    if (key == \"" << key << "\" &&\n"
+            << "        !value.containsValueOfType<" << cppTypes().at(type)
+            << ">())\n"
+            << "    {\n"
+            << "        throw std::invalid_argument(\"" << key
+            << " must be of type " << type << "\");\n"
+            << "    }\n";
+    }
+    out << "}\n\n"
+        << "class Adaptor : public TypedAdaptor\n{\n"
+           "  public:\n"
+           "    Adaptor(sdbus::IObject& object, configuration_reader read,\n"
+           "            configuration_writer write)\n"
+           "        : object(object), read(std::move(read)), "
+           "write(std::move(write))\n"
+           "    {\n"
+           "        object\n"
+           "            .addVTable(\n"
+           "                sdbus::registerMethod(\"Get\")\n"
+           "                    .withOutputParamNames(\"configuration\")\n"
+           "                    .implementedAs([this]() { return get(); }),\n";
+    for (const auto& [key, type] : schema.keys)
+    {
+        out << "                sdbus::registerMethod(\"Set" << key << "\")\n"
+            << "                    .withInputParamNames(\"value\")\n"
+            << "                    .implementedAs(\n"
+            << "                        [this](const " << cppTypes().at(type)
+            << "& value)\n"
+            << "                        { this->write(\"" << key
+            << "\", sdbus::Variant(value)); }),\n";
+    }
+    out << "                sdbus::registerSignal(\"Updated\")\n"
+           "                    .withParameters<uint64_t, Configuration>(\n"
+           "                        \"version\", \"configuration\"))\n"
+           "            .forInterface(sdbus::InterfaceName{interfaceName});\n"
+           "    }\n\n"
+           "    void emitUpdated() override\n"
+           "    {\n"
+           "        uint64_t version = 0;\n"
+           "        const auto configuration = get(version);\n"
+           "        object.emitSignal(\"Updated\")\n"
+           "            .onInterface(sdbus::InterfaceName{interfaceName})\n"
+           "            .withArguments(version, configuration);\n"
+           "    }\n\n"
+           "  private:\n"
+           "    Configuration get() const\n"
+           "    {\n"
+           "        uint64_t version = 0;\n"
+           "        return get(version);\n"
+           "    }\n\n"
+           "    Configuration get(uint64_t& version) const\n"
+           "    {\n"
+           "        const auto values = read(version);\n"
+           "        Configuration configuration;\n";
+    for (const auto& [key, type] : schema.keys)
+    {
+        out << "        configuration." << key << " = typedValue<"
+            << cppTypes().at(type) << ">(values, \"" << key << "\");\n";
+    }
+    out << "        return configuration;\n"
+           "    }\n\n"
+           "    sdbus::IObject& object;\n"
+           "    configuration_reader read;\n"
+           "    configuration_writer write;\n"
+           "};\n"
+        << "} // namespace " << namespaceName(schema) << "\n";
+    return out.str();
+}
+
+std::string generateProxy(const Schema& schema)
+{
+    std::ostringstream out;
+    out << header(schema) << "#include \"" << schema.application
+        << "Types.hpp\"\n"
+           "#include <algorithm>\n"
+           "#include <functional>\n"
+           "#include <memory>\n"
+           "#include <mutex>\n\n"
+        << "namespace " << namespaceName(schema) << "\n{\n"
+        << "// Typed access to the application's configuration object. "
+           "Updated\n"
+           "// callbacks run on the connection's event loop thread.\n"
+           "class Proxy\n{\n"
+           "  public:\n"
+           "    using updated_callback =\n"
+           "        std::function<void(uint64_t version, const Configuration&)>;\n"
+           "\n"
+           "    explicit Proxy(sdbus::IConnection& connection,\n"
+           "                   std::string serviceName =\n"
+           "                       \"com.system.configurationManager\")\n"
+           "        : proxy(sdbus::createProxy(connection,\n"
+           "                                   "
+           "sdbus::ServiceName{serviceName},\n"
+           "                                   "
+           "sdbus::ObjectPath{objectPathOf(serviceName)}))\n"
+           "    {\n"
+           "        proxy->uponSignal(\"Updated\")\n"
+           "            .onInterface(sdbus::InterfaceName{interfaceName})\n"
+           "            .call(\n"
+           "                [this](uint64_t version, const Configuration& "
+           "configuration)\n"
+           "                {\n"
+           "                    std::lock_guard<std::mutex> "
+           "lock(callbackMutex);\n"
+           "                    if (updated)\n"
+           "                    {\n"
+           "                        updated(version, configuration);\n"
+           "                    }\n"
+           "                });\n"
+           "    }\n\n"
+           "    Configuration get()\n"
+           "    {\n"
+           "        Configuration configuration;\n"
+           "        proxy->callMethod(\"Get\")\n"
+           "            .onInterface(sdbus::InterfaceName{interfaceName})\n"
+           "            .storeResultsTo(configuration);\n"
+           "        return configuration;\n"
+           "    }\n";
+    for (const auto& [key, type] : schema.keys)
+    {
+        out << "\n    void set" << key << "(const " << cppTypes().at(type)
+            << "& value)\n"
+            << "    {\n"
+            << "        proxy->callMethod(\"Set" << key << "\")\n"
+            << "            .onInterface(sdbus::InterfaceName{interfaceName})\n"
+            << "            .withArguments(value);\n"
+            << "    }\n";
+    }
+    out << "\n    void onUpdated(updated_callback callback)\n"
+           "    {\n"
+           "        std::lock_guard<std::mutex> lock(callbackMutex);\n"
+           "        updated = std::move(callback);\n"
+           "    }\n\n"
+           "  private:\n"
+           "    static std::string objectPathOf(std::string serviceName)\n"
+           "    {\n"
+           "        std::replace(serviceName.begin(), serviceName.end(), "
+           "'.', '/');\n"
+           "        return \"/\" + serviceName + \"/Application/\" + "
+           "applicationName;\n"
+           "    }\n\n"
+           "    std::mutex callbackMutex;\n"
+           "    updated_callback updated;\n"
+           "    // Last, so that no signal is delivered into destroyed "
+           "members.\n"
+           "    std::unique_ptr<sdbus::IProxy> proxy;\n"
+           "};\n"
+        << "} // namespace " << namespaceName(schema) << "\n";
+    return out.str();
+}
+
+std::string generateAdaptorIndex(const std::vector<Schema>& schemas)
+{
+    std::ostringstream out;
+    out << "// Generated by config_codegen; do not edit.\n#pragma once\n\n";
+    for (const auto& schema : schemas)
+    {
+        out << "#include \"" << schema.application << "Adaptor.hpp\"\n";
+    }
+    out << "#include \"typedAdaptor.hpp\"\n"
+           "#include <memory>\n"
+           "#include <string>\n\n"
+           "// Adaptor for `application`, or nothing if it has no schema.\n"
+           "inline std::unique_ptr<TypedAdaptor>\n"
+           "createTypedAdaptor(const std::string& application, "
+           "sdbus::IObject& object,\n"
+           "                   configuration_reader read, "
+           "configuration_writer write)\n"
+           "{\n";
+    for (const auto& schema : schemas)
+    {
+        out << "    if (application == \"" << schema.application << "\")\n"
+            << "    {\n"
+            << "        return std::make_unique<" << namespaceName(schema)
+            << "::Adaptor>(\n"
+            << "            object, std::move(read), std::move(write));\n"
+            << "    }\n";
+    }
+    out << "    return nullptr;\n}\n\n"
+           "// Schema check for changes of `application`, or nothing if it has "
+           "no\n"
+           "// schema.\n"
+           "inline configuration_validator\n"
+           "createSchemaValidator(const std::string& application)\n"
+           "{\n";
+    for (const auto& schema : schemas)
+    {
+        out << "    if (application == \"" << schema.application << "\")\n"
+            << "    {\n"
+            << "        return " << namespaceName(schema) << "::validate;\n"
+            << "    }\n";
+    }
+    out << "    return nullptr;\n}\n";
+    return out.str();
+}
+
+// Leaves unchanged files alone, so dependents are not rebuilt.
+void writeIfChanged(const fs::path& path, const std::string& content)
+{
+    {
+        std::ifstream existing(path, std::ios::binary);
+        if (existing)
+        {
+            std::ostringstream current;
+            current << existing.rdbuf();
+            if (current.str() == content)
+            {
+                return;
+            }
+        }
+    }
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file << content;
+    if (!file)
+    {
+        throw std::runtime_error("Could not write " + path.string());
+    }
+}
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        std::cerr << "Usage: " << argv[0] << " <output-dir> <schema.json>..."
+                  << std::endl;
+        return 2;
+    }
+
+    try
+    {
+        const fs::path outputDir = argv[1];
+        fs::create_directories(outputDir);
+
+        std::vector<Schema> schemas;
+        std::map<std::string, std::string> applications;
+        for (int i = 2; i < argc; ++i)
+        {
+            auto schema = readSchema(argv[i]);
+            auto [it, inserted] =
+                applications.emplace(schema.application, schema.source);
+            if (!inserted)
+            {
+                throw std::runtime_error("Application " + schema.application +
+                                         " is described by both " +
+                                         it->second + " and " + schema.source);
+            }
+            schemas.push_back(std::move(schema));
+        }
+
+        for (const auto& schema : schemas)
+        {
+            writeIfChanged(outputDir / (schema.application + "Types.hpp"),
+                           generateTypes(schema));
+            writeIfChanged(outputDir / (schema.application + "Adaptor.hpp"),
+                           generateAdaptor(schema));
+            writeIfChanged(outputDir / (schema.application + "Proxy.hpp"),
+                           generateProxy(schema));
+        }
+        writeIfChanged(outputDir / "configurationAdaptors.hpp",
+                       generateAdaptorIndex(schemas));
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "config_codegen: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
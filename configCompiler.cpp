@@ -0,0 +1,117 @@
+#include "CLI/CLI.hpp"
+#include "configurationBundle.hpp"
+#include "configurationParser.hpp"
+#include <chrono>
+#include <filesystem>
+#include <memory>
+#include <spdlog/sinks/stdout_color_sinks.h>
+#include <spdlog/spdlog.h>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+static void initialize_logging()
+{
+    auto logger = spdlog::stdout_color_mt("configc");
+    logger->set_level(spdlog::level::info);
+    spdlog::set_default_logger(logger);
+}
+
+int main(int argc, char* argv[])
+{
+    initialize_logging();
+
+    try
+    {
+        std::string configDir;
+        std::string output;
+
+        CLI::App app{"Compiles a config directory into one configuration "
+                     "bundle"};
+        app.add_option("config-dir", configDir,
+                       "Directory with JSON, CBOR or MessagePack configs")
+            ->required()
+            ->check(CLI::ExistingDirectory);
+        app.add_option("output", output,
+                       std::string("Bundle file, must end in ") +
+                           configurationBundleExtension)
+            ->required();
+
+        CLI11_PARSE(app, argc, argv);
+
+        if (!isConfigurationBundle(output))
+        {
+            throw std::runtime_error(std::string("Output must end in ") +
+                                     configurationBundleExtension);
+        }
+
+        const auto start = std::chrono::steady_clock::now();
+        std::vector<std::unique_ptr<ConfigurationArena>> arenas;
+        std::vector<BundleApplication<configuration_values>> applications;
+        std::unordered_set<std::string> names;
+        size_t sourceBytes = 0;
+        for (const auto& entry : fs::directory_iterator(configDir))
+        {
+            ConfigurationFormat format;
+            if (!entry.is_regular_file() ||
+                !configurationFormatFromExtension(
+                    entry.path().extension().string(), format))
+            {
+                continue;
+            }
+            auto name = entry.path().stem().string();
+            if (!names.insert(name).second)
+            {
+                throw std::runtime_error(
+                    "More than one config file for application " + name);
+            }
+            const auto size = static_cast<size_t>(entry.file_size());
+            auto arena = std::make_unique<ConfigurationArena>(size);
+            try
+            {
+                parseConfigurationFile(entry.path().string(), format,
+                                       arena->values());
+            }
+            catch (const std::exception& e)
+            {
+                throw std::runtime_error(entry.path().string() + ": " +
+                                         e.what());
+            }
+            sourceBytes += size;
+            applications.push_back({std::move(name), &arena->values()});
+            arenas.push_back(std::move(arena));
+        }
+        if (applications.empty())
+        {
+            throw std::runtime_error("No valid configuration files found in " +
+                                     configDir);
+        }
+
+        const auto bundle = encodeConfigurationBundle(applications);
+        writeFileAtomically(output, bundle);
+
+        // Read the result back the way the manager will.
+        ConfigurationBundle check(output);
+        for (size_t i = 0; i < check.applicationCount(); ++i)
+        {
+            ConfigurationArena arena(0);
+            check.readApplication(i, arena.values());
+        }
+
+        const auto elapsed =
+            std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - start);
+        spdlog::info("Compiled {} applications into {} ({} -> {} bytes) in "
+                     "{} ms",
+                     applications.size(), output, sourceBytes, bundle.size(),
+                     elapsed.count());
+    }
+    catch (const std::exception& e)
+    {
+        spdlog::critical("Compilation failed: {}", e.what());
+        return 1;
+    }
+    return 0;
+}
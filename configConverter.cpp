@@ -0,0 +1,123 @@
+#include "CLI/CLI.hpp"
+#include "configurationParser.hpp"
+#include <filesystem>
+#include <fstream>
+#include <nlohmann/json.hpp>
+#include <set>
+#include <spdlog/sinks/stdout_color_sinks.h>
+#include <spdlog/spdlog.h>
+#include <string>
+#include <vector>
+
+using json = nlohmann::json;
+namespace fs = std::filesystem;
+
+static void initialize_logging()
+{
+    auto logger = spdlog::stdout_color_mt("config_converter");
+    logger->set_level(spdlog::level::info);
+    spdlog::set_default_logger(logger);
+}
+
+static std::vector<uint8_t> decodeBase64(const std::string& text)
+{
+    static const std::string alphabet =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::vector<uint8_t> bytes;
+    bytes.reserve(text.size() * 3 / 4);
+    uint32_t buffer = 0;
+    int bits = 0;
+    for (char c : text)
+    {
+        if (c == '=' || c == '\n' || c == '\r')
+        {
+            continue;
+        }
+        auto index = alphabet.find(c);
+        if (index == std::string::npos)
+        {
+            throw std::runtime_error("Invalid base64 character");
+        }
+        buffer = (buffer << 6) | static_cast<uint32_t>(index);
+        bits += 6;
+        if (bits >= 8)
+        {
+            bits -= 8;
+            bytes.push_back(static_cast<uint8_t>((buffer >> bits) & 0xff));
+        }
+    }
+    return bytes;
+}
+
+int main(int argc, char* argv[])
+{
+    initialize_logging();
+
+    try
+    {
+        std::string input;
+        std::string output;
+        std::set<std::string> binaryKeys;
+
+        CLI::App app{"Converts JSON application configs to CBOR or MessagePack"};
+        app.add_option("input", input, "JSON config file")
+            ->required()
+            ->check(CLI::ExistingFile);
+        app.add_option("output", output,
+                       "Output file, its extension (.cbor or .msgpack) "
+                       "selects the format")
+            ->required();
+        app.add_option("--binary-key", binaryKeys,
+                       "Key whose base64 string value is stored as bytes (ay)");
+
+        CLI11_PARSE(app, argc, argv);
+
+        ConfigurationFormat format;
+        if (!configurationFormatFromExtension(
+                fs::path(output).extension().string(), format) ||
+            format == ConfigurationFormat::Json)
+        {
+            throw std::runtime_error("Output must end in .cbor or .msgpack");
+        }
+
+        std::ifstream inputFile(input);
+        auto config = json::parse(inputFile);
+        if (!config.is_object())
+        {
+            throw std::runtime_error("Config root must be an object");
+        }
+        for (const auto& key : binaryKeys)
+        {
+            auto it = config.find(key);
+            if (it == config.end() || !it->is_string())
+            {
+                throw std::runtime_error("Binary key '" + key +
+                                         "' must hold a base64 string");
+            }
+            *it = json::binary(decodeBase64(it->get<std::string>()));
+        }
+
+        const auto encoded = format == ConfigurationFormat::Cbor
+                                 ? json::to_cbor(config)
+                                 : json::to_msgpack(config);
+        std::ofstream outputFile(output, std::ios::binary);
+        outputFile.write(reinterpret_cast<const char*>(encoded.data()),
+                         static_cast<std::streamsize>(encoded.size()));
+        if (!outputFile)
+        {
+            throw std::runtime_error("Could not write " + output);
+        }
+
+        // Read the result back the way the manager will.
+        configuration_values values;
+        parseConfigurationFile(output, format, values);
+        spdlog::info("Wrote {} keys to {} ({} -> {} bytes)", values.size(),
+                     output, fs::file_size(input), encoded.size());
+    }
+    catch (const std::exception& e)
+    {
+        spdlog::critical("Conversion failed: {}", e.what());
+        return 1;
+    }
+    return 0;
+}
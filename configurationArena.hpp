@@ -0,0 +1,119 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <memory>
+#include <memory_resource>
+#include <sdbus-c++/sdbus-c++.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Forwards to `upstream` and counts what passes through.
+class CountingResource : public std::pmr::memory_resource
+{
+  public:
+    explicit CountingResource(std::pmr::memory_resource* upstream)
+        : upstream(upstream)
+    {
+    }
+
+    size_t allocations() const { return allocationCount; }
+    size_t bytes() const { return allocatedBytes; }
+
+  private:
+    void* do_allocate(size_t bytes, size_t alignment) override
+    {
+        ++allocationCount;
+        allocatedBytes += bytes;
+        return upstream->allocate(bytes, alignment);
+    }
+
+    void do_deallocate(void* p, size_t bytes, size_t alignment) override
+    {
+        upstream->deallocate(p, bytes, alignment);
+    }
+
+    bool do_is_equal(const memory_resource& other) const noexcept override
+    {
+        return this == &other;
+    }
+
+    std::pmr::memory_resource* upstream;
+    size_t allocationCount{0};
+    size_t allocatedBytes{0};
+};
+
+using configuration_values =
+    std::pmr::map<std::pmr::string, sdbus::Variant, std::less<>>;
+
+class SealedBlob;
+// Key -> memfd backing a value whose dictionary entry is a blob handle.
+using configuration_blobs =
+    std::unordered_map<std::string, std::shared_ptr<const SealedBlob>>;
+
+// Decides how a byte string is stored; the default keeps it as `ay`.
+using binary_sink = std::function<sdbus::Variant(
+    const std::string& key, const std::vector<uint8_t>& bytes)>;
+
+struct ArenaStats
+{
+    // Small allocations (map nodes, keys) served from the arena.
+    size_t allocations{0};
+    size_t bytes{0};
+    // Blocks the arena itself requested from the heap.
+    size_t chunks{0};
+    size_t chunkBytes{0};
+
+    ArenaStats& operator+=(const ArenaStats& other)
+    {
+        allocations += other.allocations;
+        bytes += other.bytes;
+        chunks += other.chunks;
+        chunkBytes += other.chunkBytes;
+        return *this;
+    }
+};
+
+// Storage for one parsed application configuration. Map nodes and keys are
+// carved out of a monotonic arena, so dropping the whole object releases
+// them in one go. Variant payloads are still owned by sd-bus messages, large
+// byte strings by the sealed memfds in blobs().
+class ConfigurationArena
+{
+  public:
+    explicit ConfigurationArena(size_t sizeHint)
+        : chunks(std::pmr::new_delete_resource()),
+          arena(std::max(sizeHint, minimalArenaSize), &chunks),
+          objects(&arena), entries(&objects)
+    {
+    }
+
+    ConfigurationArena(const ConfigurationArena&) = delete;
+    ConfigurationArena& operator=(const ConfigurationArena&) = delete;
+
+    configuration_values& values() { return entries; }
+    const configuration_values& values() const { return entries; }
+
+    configuration_blobs& blobs() { return blobStore; }
+    const configuration_blobs& blobs() const { return blobStore; }
+
+    ArenaStats stats() const
+    {
+        return {objects.allocations(), objects.bytes(), chunks.allocations(),
+                chunks.bytes()};
+    }
+
+  private:
+    // About one key and its node. Callers pass the file size, so small
+    // applications do not each pin a larger first chunk.
+    static constexpr size_t minimalArenaSize = 128;
+
+    CountingResource chunks;
+    std::pmr::monotonic_buffer_resource arena;
+    CountingResource objects;
+    configuration_values entries;
+    configuration_blobs blobStore;
+};
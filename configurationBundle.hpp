@@ -0,0 +1,554 @@
+#pragma once
+
+#include "configurationArena.hpp"
+#include "variantUtils.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Configurations of one or more applications in a single file: a whole
+// config directory compiled by `configc`, one application published by the
+// manager with --publish-dir, or a client's last known good configuration.
+//
+//   header | application index | value records | data
+//
+// The index is sorted by application name and every application's value
+// records are sorted by key, so the manager can map the file and decode
+// applications straight into their arenas. Names, keys, strings and byte
+// strings live once in the data section and are referenced by offset and
+// length. All integers are in host byte order; a bundle built on a host
+// with another byte order is rejected.
+constexpr char configurationBundleExtension[] = ".bundle";
+
+inline bool isConfigurationBundle(const std::string& path)
+{
+    const std::string_view extension = configurationBundleExtension;
+    return path.size() > extension.size() &&
+           path.compare(path.size() - extension.size(), extension.size(),
+                        extension.data()) == 0;
+}
+
+namespace bundle_format
+{
+constexpr char magic[8] = {'C', 'F', 'G', 'B', 'N', 'D', 'L', '\0'};
+constexpr uint32_t formatVersion = 2;
+constexpr uint32_t byteOrderMark = 0x01020304;
+
+struct Header
+{
+    char magic[8];
+    uint32_t formatVersion;
+    uint32_t byteOrder;
+    uint64_t applicationCount;
+    uint64_t applicationsOffset;
+    uint64_t valueCount;
+    uint64_t valuesOffset;
+    uint64_t dataOffset;
+    uint64_t dataSize;
+};
+
+struct Application
+{
+    uint64_t nameOffset;
+    uint32_t nameLength;
+    uint32_t valueCount;
+    uint64_t firstValue;
+    // Manager generation and version of a published or cached
+    // configuration, 0 in compiled bundles.
+    uint64_t generation;
+    uint64_t version;
+    uint64_t reserved;
+};
+
+// `type` is the D-Bus signature character ('y' standing for `ay`, 'r' for a
+// blob handle). Strings and byte strings point into the data section
+// through `payload` and `size`; a blob handle keeps its size in `payload`
+// and its hash in `size`; other values are stored in `payload` itself.
+struct Value
+{
+    uint64_t keyOffset;
+    uint32_t keyLength;
+    uint32_t type;
+    uint64_t payload;
+    uint64_t size;
+};
+
+static_assert(sizeof(Header) == 64, "Unexpected bundle header layout");
+static_assert(sizeof(Application) == 48, "Unexpected bundle index layout");
+static_assert(sizeof(Value) == 32, "Unexpected bundle value layout");
+} // namespace bundle_format
+
+// Read-only view of a bundle mapped into memory. Only the header is
+// checked on open; index entries and values are checked when touched, so
+// opening costs the same regardless of the bundle size.
+class ConfigurationBundle
+{
+  public:
+    explicit ConfigurationBundle(const std::string& path) : path(path)
+    {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            throw std::runtime_error("Could not open bundle " + path + ": " +
+                                     strerror(errno));
+        }
+        struct stat status;
+        if (fstat(fd, &status) < 0)
+        {
+            const std::string reason = strerror(errno);
+            ::close(fd);
+            throw std::runtime_error("Could not stat bundle " + path + ": " +
+                                     reason);
+        }
+        length = static_cast<size_t>(status.st_size);
+        if (length < sizeof(bundle_format::Header))
+        {
+            ::close(fd);
+            throw std::runtime_error("Bundle " + path + " is truncated");
+        }
+        void* mapped = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (mapped == MAP_FAILED)
+        {
+            throw std::runtime_error("Could not map bundle " + path + ": " +
+                                     strerror(errno));
+        }
+        base = static_cast<const uint8_t*>(mapped);
+        try
+        {
+            validateHeader();
+        }
+        catch (...)
+        {
+            munmap(const_cast<uint8_t*>(base), length);
+            throw;
+        }
+    }
+
+    ~ConfigurationBundle() { munmap(const_cast<uint8_t*>(base), length); }
+
+    ConfigurationBundle(const ConfigurationBundle&) = delete;
+    ConfigurationBundle& operator=(const ConfigurationBundle&) = delete;
+
+    size_t applicationCount() const { return header().applicationCount; }
+
+    std::string_view applicationName(size_t index) const
+    {
+        const auto& application = applications()[index];
+        return data(application.nameOffset, application.nameLength);
+    }
+
+    std::optional<size_t> findApplication(std::string_view name) const
+    {
+        size_t low = 0;
+        size_t high = applicationCount();
+        while (low < high)
+        {
+            const size_t middle = low + (high - low) / 2;
+            const auto candidate = applicationName(middle);
+            if (candidate == name)
+            {
+                return middle;
+            }
+            if (candidate < name)
+                low = middle + 1;
+            else
+                high = middle;
+        }
+        return std::nullopt;
+    }
+
+    uint64_t applicationGeneration(size_t index) const
+    {
+        return applications()[index].generation;
+    }
+
+    uint64_t applicationVersion(size_t index) const
+    {
+        return applications()[index].version;
+    }
+
+    // Looks `key` up by binary search and decodes only that value.
+    std::optional<sdbus::Variant> findValue(size_t index,
+                                            std::string_view key) const
+    {
+        const auto records = valueRecords(index);
+        size_t low = 0;
+        size_t high = records.second;
+        while (low < high)
+        {
+            const size_t middle = low + (high - low) / 2;
+            const auto& record = records.first[middle];
+            const auto candidate = data(record.keyOffset, record.keyLength);
+            if (candidate == key)
+            {
+                return decodeValue(record, key, nullptr);
+            }
+            if (candidate < key)
+                low = middle + 1;
+            else
+                high = middle;
+        }
+        return std::nullopt;
+    }
+
+    // Decodes the values of application `index` into `values`. Byte strings
+    // go through `binarySink` as they do when parsing a config file.
+    void readApplication(size_t index, configuration_values& values,
+                         const binary_sink& binarySink = nullptr) const
+    {
+        const auto [records, count] = valueRecords(index);
+        for (size_t i = 0; i < count; ++i)
+        {
+            const auto& record = records[i];
+            const auto key = data(record.keyOffset, record.keyLength);
+            // Records are sorted by key, so every insertion goes at the end.
+            values.emplace_hint(values.end(), key,
+                                decodeValue(record, key, binarySink));
+        }
+    }
+
+    // Bytes the bundle takes on disk.
+    size_t size() const { return length; }
+
+  private:
+    const bundle_format::Header& header() const
+    {
+        return *reinterpret_cast<const bundle_format::Header*>(base);
+    }
+
+    const bundle_format::Application* applications() const
+    {
+        return reinterpret_cast<const bundle_format::Application*>(
+            base + header().applicationsOffset);
+    }
+
+    // Value records of application `index` and their number.
+    std::pair<const bundle_format::Value*, size_t>
+    valueRecords(size_t index) const
+    {
+        const auto& application = applications()[index];
+        const auto& bundleHeader = header();
+        if (application.firstValue > bundleHeader.valueCount ||
+            application.valueCount >
+                bundleHeader.valueCount - application.firstValue)
+        {
+            throw std::runtime_error("Corrupt application entry in bundle " +
+                                     path);
+        }
+        const auto* records = reinterpret_cast<const bundle_format::Value*>(
+                                  base + bundleHeader.valuesOffset) +
+                              application.firstValue;
+        return {records, application.valueCount};
+    }
+
+    void validateHeader() const
+    {
+        const auto& bundleHeader = header();
+        if (std::memcmp(bundleHeader.magic, bundle_format::magic,
+                        sizeof(bundle_format::magic)) != 0)
+        {
+            throw std::runtime_error(path + " is not a configuration bundle");
+        }
+        if (bundleHeader.byteOrder != bundle_format::byteOrderMark)
+        {
+            throw std::runtime_error("Bundle " + path +
+                                     " was built for another byte order");
+        }
+        if (bundleHeader.formatVersion != bundle_format::formatVersion)
+        {
+            throw std::runtime_error(
+                "Unsupported bundle format version " +
+                std::to_string(bundleHeader.formatVersion) + " in " + path);
+        }
+        if (!fits(bundleHeader.applicationsOffset,
+                  bundleHeader.applicationCount,
+                  sizeof(bundle_format::Application)) ||
+            !fits(bundleHeader.valuesOffset, bundleHeader.valueCount,
+                  sizeof(bundle_format::Value)) ||
+            !fits(bundleHeader.dataOffset, bundleHeader.dataSize, 1) ||
+            bundleHeader.applicationsOffset % 8 != 0 ||
+            bundleHeader.valuesOffset % 8 != 0)
+        {
+            throw std::runtime_error("Bundle " + path + " is truncated");
+        }
+    }
+
+    // Whether `count` items of `itemSize` bytes at `offset` lie in the file.
+    bool fits(uint64_t offset, uint64_t count, uint64_t itemSize) const
+    {
+        return offset <= length && count <= (length - offset) / itemSize;
+    }
+
+    std::string_view data(uint64_t offset, uint64_t size) const
+    {
+        const auto& bundleHeader = header();
+        if (offset > bundleHeader.dataSize ||
+            size > bundleHeader.dataSize - offset)
+        {
+            throw std::runtime_error("Corrupt data reference in bundle " +
+                                     path);
+        }
+        return std::string_view(reinterpret_cast<const char*>(
+                                    base + bundleHeader.dataOffset + offset),
+                                size);
+    }
+
+    sdbus::Variant decodeValue(const bundle_format::Value& record,
+                               std::string_view key,
+                               const binary_sink& binarySink) const
+    {
+        switch (record.type)
+        {
+        case 's':
+            return sdbus::Variant(
+                std::string(data(record.payload, record.size)));
+        case 'x':
+            return sdbus::Variant(static_cast<int64_t>(record.payload));
+        case 't':
+            return sdbus::Variant(record.payload);
+        case 'd':
+        {
+            double value;
+            std::memcpy(&value, &record.payload, sizeof(value));
+            return sdbus::Variant(value);
+        }
+        case 'b':
+            return sdbus::Variant(record.payload != 0);
+        case 'r':
+            return sdbus::Variant(blob_handle{record.payload, record.size});
+        case 'y':
+        {
+            const auto bytes = data(record.payload, record.size);
+            std::vector<uint8_t> content(bytes.begin(), bytes.end());
+            if (binarySink)
+            {
+                return binarySink(std::string(key), content);
+            }
+            return sdbus::Variant(content);
+        }
+        default:
+            throw std::runtime_error("Unsupported value type in bundle " +
+                                     path + " at key '" + std::string(key) +
+                                     "'");
+        }
+    }
+
+    std::string path;
+    const uint8_t* base{nullptr};
+    size_t length{0};
+};
+
+// One application to encode; `Values` is any map from key to variant that
+// iterates in key order.
+template <typename Values> struct BundleApplication
+{
+    std::string name;
+    const Values* values;
+    uint64_t version{0};
+    uint64_t generation{0};
+};
+
+// Serializes `applications` into the bundle format. Names must be unique;
+// values may only hold s, x, t, d, b, ay and blob handles.
+template <typename Values>
+std::vector<uint8_t>
+encodeConfigurationBundle(std::vector<BundleApplication<Values>> applications)
+{
+    std::sort(applications.begin(), applications.end(),
+              [](const auto& a, const auto& b) { return a.name < b.name; });
+
+    std::vector<bundle_format::Application> index;
+    std::vector<bundle_format::Value> records;
+    std::string data;
+    // Keys in particular repeat across applications, so they are stored once.
+    std::unordered_map<std::string, uint64_t> interned;
+    auto intern = [&data, &interned](std::string_view text)
+    {
+        auto [it, inserted] = interned.emplace(std::string(text), data.size());
+        if (inserted)
+        {
+            data.append(text);
+        }
+        return it->second;
+    };
+
+    index.reserve(applications.size());
+    for (size_t i = 0; i < applications.size(); ++i)
+    {
+        const auto& [name, values, version, generation] = applications[i];
+        if (i > 0 && applications[i - 1].name == name)
+        {
+            throw std::runtime_error("Duplicate application " + name);
+        }
+        bundle_format::Application application{};
+        application.nameOffset = intern(name);
+        application.nameLength = static_cast<uint32_t>(name.size());
+        application.valueCount = static_cast<uint32_t>(values->size());
+        application.firstValue = records.size();
+        application.generation = generation;
+        application.version = version;
+        index.push_back(application);
+
+        for (const auto& entry : *values)
+        {
+            const std::string_view key = entry.first;
+            const sdbus::Variant& value = entry.second;
+            bundle_format::Value record{};
+            record.keyOffset = intern(key);
+            record.keyLength = static_cast<uint32_t>(key.size());
+            const char* signature = value.peekValueType();
+            const std::string type = signature ? signature : "";
+            if (type == "s")
+            {
+                const auto text = value.get<std::string>();
+                record.type = 's';
+                record.payload = intern(text);
+                record.size = text.size();
+            }
+            else if (type == "x")
+            {
+                record.type = 'x';
+                record.payload = static_cast<uint64_t>(value.get<int64_t>());
+            }
+            else if (type == "t")
+            {
+                record.type = 't';
+                record.payload = value.get<uint64_t>();
+            }
+            else if (type == "d")
+            {
+                const double number = value.get<double>();
+                record.type = 'd';
+                std::memcpy(&record.payload, &number, sizeof(number));
+            }
+            else if (type == "b")
+            {
+                record.type = 'b';
+                record.payload = value.get<bool>() ? 1 : 0;
+            }
+            else if (type == "ay")
+            {
+                const auto bytes = value.get<std::vector<uint8_t>>();
+                record.type = 'y';
+                record.payload = intern(std::string_view(
+                    reinterpret_cast<const char*>(bytes.data()), bytes.size()));
+                record.size = bytes.size();
+            }
+            else if (type == blobHandleSignature)
+            {
+                const auto handle = value.get<blob_handle>();
+                record.type = 'r';
+                record.payload = std::get<0>(handle);
+                record.size = std::get<1>(handle);
+            }
+            else
+            {
+                throw std::runtime_error("Unsupported value type '" + type +
+                                         "' at key '" + std::string(key) +
+                                         "' of " + name);
+            }
+            records.push_back(record);
+        }
+    }
+
+    bundle_format::Header header{};
+    std::memcpy(header.magic, bundle_format::magic, sizeof(header.magic));
+    header.formatVersion = bundle_format::formatVersion;
+    header.byteOrder = bundle_format::byteOrderMark;
+    header.applicationCount = index.size();
+    header.applicationsOffset = sizeof(header);
+    header.valueCount = records.size();
+    header.valuesOffset =
+        header.applicationsOffset + index.size() * sizeof(index[0]);
+    header.dataOffset =
+        header.valuesOffset + records.size() * sizeof(bundle_format::Value);
+    header.dataSize = data.size();
+
+    std::vector<uint8_t> bundle(header.dataOffset + data.size());
+    std::memcpy(bundle.data(), &header, sizeof(header));
+    if (!index.empty())
+    {
+        std::memcpy(bundle.data() + header.applicationsOffset, index.data(),
+                    index.size() * sizeof(index[0]));
+    }
+    if (!records.empty())
+    {
+        std::memcpy(bundle.data() + header.valuesOffset, records.data(),
+                    records.size() * sizeof(records[0]));
+    }
+    std::memcpy(bundle.data() + header.dataOffset, data.data(), data.size());
+    return bundle;
+}
+
+// Writes to a unique file next to `path` and renames it over `path`, so
+// readers never see a half-written file and concurrent writers do not share
+// a temporary. `durable` also syncs the content to disk first. The file
+// ends up readable by everyone (0644).
+inline void writeFileAtomically(const std::string& path,
+                                const std::vector<uint8_t>& content,
+                                bool durable = true)
+{
+    std::string temporary = path + ".XXXXXX";
+    int fd = mkostemp(temporary.data(), O_CLOEXEC);
+    if (fd < 0)
+    {
+        throw std::runtime_error("Could not create " + temporary + ": " +
+                                 strerror(errno));
+    }
+    if (fchmod(fd, 0644) < 0)
+    {
+        const std::string reason = strerror(errno);
+        ::close(fd);
+        unlink(temporary.c_str());
+        throw std::runtime_error("Could not change mode of " + temporary +
+                                 ": " + reason);
+    }
+    size_t written = 0;
+    while (written < content.size())
+    {
+        ssize_t r =
+            ::write(fd, content.data() + written, content.size() - written);
+        if (r < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (r <= 0)
+        {
+            const std::string reason = strerror(errno);
+            ::close(fd);
+            unlink(temporary.c_str());
+            throw std::runtime_error("Could not write " + temporary + ": " +
+                                     reason);
+        }
+        written += static_cast<size_t>(r);
+    }
+    if ((durable && fsync(fd) < 0) || ::close(fd) < 0)
+    {
+        const std::string reason = strerror(errno);
+        unlink(temporary.c_str());
+        throw std::runtime_error("Could not flush " + temporary + ": " +
+                                 reason);
+    }
+    if (rename(temporary.c_str(), path.c_str()) < 0)
+    {
+        const std::string reason = strerror(errno);
+        unlink(temporary.c_str());
+        throw std::runtime_error("Could not rename " + temporary + ": " +
+                                 reason);
+    }
+}
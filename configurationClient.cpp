@@ -1,15 +1,28 @@
 #include "CLI/CLI.hpp"
+#include "allocationTracker.hpp"
+#include "applicationConfigurationClient.hpp"
+#include "executor.hpp"
+#include <array>
 #include <atomic>
+#include <cerrno>
 #include <chrono>
+#include <condition_variable>
+#include <cstring>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
 #include <memory>
 #include <nlohmann/json.hpp>
+#include <poll.h>
+#include <pthread.h>
 #include <sdbus-c++/sdbus-c++.h>
 #include <spdlog/sinks/stdout_color_sinks.h>
 #include <spdlog/spdlog.h>
+#include <string_view>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
 #include <thread>
+#include <unistd.h>
 
 namespace fs = std::filesystem;
 using json = nlohmann::json;
@@ -21,43 +34,315 @@ static void initialize_logging()
     spdlog::set_default_logger(logger);
 }
 
+enum class OutputMode
+{
+    // Flush after every line, like std::endl.
+    Line,
+    // Collect lines in a reusable buffer and write it out once it grows
+    // past a size threshold or the flush interval has passed.
+    Buffered,
+    // Like Buffered, but a dedicated writer thread does the writing.
+    Thread
+};
+
+enum class TimerMode
+{
+    // sleep_for(period) after every tick; lateness accumulates.
+    Sleep,
+    // Periodic timerfd armed on absolute CLOCK_MONOTONIC deadlines.
+    Timerfd
+};
+
+struct ClientOptions
+{
+    int64_t timeout{1000};
+    // Overrides `timeout` when positive.
+    int64_t timeoutNs{0};
+    TimerMode timerMode{TimerMode::Sleep};
+    // -1 leaves the timeout thread unpinned.
+    int cpu{-1};
+    // Seconds between jitter reports, 0 only reports on shutdown.
+    int64_t jitterReportInterval{0};
+    std::string timeoutPhrase{"Hey"};
+    OutputMode outputMode{OutputMode::Line};
+    int64_t flushIntervalMs{100};
+    size_t flushBytes{64 * 1024};
+    // Last known good configuration served at startup; empty disables it.
+    std::string cachePath;
+    // Manager's --peer-socket to connect to directly instead of the bus.
+    std::string peerSocket;
+};
+
+// Output of the timeout thread. Buffered modes keep their buffers around,
+// so steady-state ticks neither allocate nor issue a write per line. Their
+// flusher thread writes out whatever is pending once the flush interval has
+// passed without a write, so the last lines never wait for the next tick.
+class TickOutput
+{
+  public:
+    TickOutput(OutputMode mode, size_t flushBytes, int64_t flushIntervalMs)
+        : mode(mode), flushBytes(flushBytes), flushIntervalMs(flushIntervalMs),
+          lastFlush(std::chrono::steady_clock::now())
+    {
+        if (flushIntervalMs <= 0)
+        {
+            throw std::invalid_argument("Flush interval must be positive");
+        }
+        pending.reserve(flushBytes);
+        writing.reserve(flushBytes);
+        if (mode != OutputMode::Line)
+        {
+            flusherThread = std::thread([this]() { flusherLoop(); });
+        }
+    }
+
+    ~TickOutput()
+    {
+        if (flusherThread.joinable())
+        {
+            {
+                std::lock_guard<std::mutex> lock(bufferMutex);
+                running = false;
+            }
+            bufferCondition.notify_all();
+            flusherThread.join();
+        }
+        writeAll(pending);
+    }
+
+    TickOutput(const TickOutput&) = delete;
+    TickOutput& operator=(const TickOutput&) = delete;
+
+    // Takes effect for the flush that is currently awaited.
+    void setFlushInterval(int64_t intervalMs)
+    {
+        if (intervalMs <= 0)
+        {
+            throw std::invalid_argument("Flush interval must be positive");
+        }
+        {
+            std::lock_guard<std::mutex> lock(bufferMutex);
+            flushIntervalMs = intervalMs;
+        }
+        bufferCondition.notify_all();
+    }
+
+    void writeLine(std::string_view line)
+    {
+        if (mode == OutputMode::Line)
+        {
+            std::cout << line << std::endl;
+            return;
+        }
+
+        std::unique_lock<std::mutex> lock(bufferMutex);
+        pending.append(line);
+        pending.push_back('\n');
+        if (mode == OutputMode::Thread)
+        {
+            if (pending.size() >= flushBytes)
+            {
+                lock.unlock();
+                bufferCondition.notify_all();
+            }
+            return;
+        }
+
+        const auto now = std::chrono::steady_clock::now();
+        if (pending.size() >= flushBytes ||
+            now - lastFlush >= std::chrono::milliseconds(flushIntervalMs))
+        {
+            writeAll(pending);
+            lastFlush = now;
+        }
+    }
+
+  private:
+    // The deadline is recomputed after every wakeup, so a shorter interval
+    // applies at once.
+    void flusherLoop()
+    {
+        std::unique_lock<std::mutex> lock(bufferMutex);
+        while (running)
+        {
+            const auto deadline =
+                lastFlush + std::chrono::milliseconds(flushIntervalMs);
+            const bool full =
+                mode == OutputMode::Thread && pending.size() >= flushBytes;
+            if (!full && std::chrono::steady_clock::now() < deadline)
+            {
+                bufferCondition.wait_until(lock, deadline);
+                continue;
+            }
+            lastFlush = std::chrono::steady_clock::now();
+            if (mode == OutputMode::Buffered)
+            {
+                // writeLine() writes under the lock too, which keeps the
+                // lines in order.
+                writeAll(pending);
+                continue;
+            }
+            // Swap instead of copying: both buffers keep their capacity.
+            std::swap(pending, writing);
+            lock.unlock();
+            writeAll(writing);
+            lock.lock();
+        }
+    }
+
+    static void writeAll(std::string& buffer)
+    {
+        size_t written = 0;
+        while (written < buffer.size())
+        {
+            ssize_t r = ::write(STDOUT_FILENO, buffer.data() + written,
+                                buffer.size() - written);
+            if (r < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (r <= 0)
+            {
+                break;
+            }
+            written += static_cast<size_t>(r);
+        }
+        buffer.clear();
+    }
+
+    const OutputMode mode;
+    const size_t flushBytes;
+
+    std::mutex bufferMutex;
+    std::condition_variable bufferCondition;
+    int64_t flushIntervalMs;
+    std::chrono::steady_clock::time_point lastFlush;
+    std::string pending;
+    std::string writing;
+    bool running{true};
+    std::thread flusherThread;
+};
+
+// Log2 histogram of how late ticks fire relative to their deadline.
+class TickJitter
+{
+  public:
+    void record(std::chrono::nanoseconds lateness, uint64_t missed)
+    {
+        const uint64_t ns =
+            lateness.count() > 0 ? static_cast<uint64_t>(lateness.count()) : 0;
+        size_t bucket = 0;
+        while (bucket + 1 < buckets.size() && (ns >> bucket) > 0)
+        {
+            ++bucket;
+        }
+        ++buckets[bucket];
+        ++ticks;
+        missedTicks += missed;
+        maxLateness = std::max(maxLateness, ns);
+        totalLateness += ns;
+    }
+
+    void report() const
+    {
+        if (ticks == 0)
+        {
+            return;
+        }
+        spdlog::info("Tick jitter: {} ticks, mean {}ns, max {}ns, {} missed",
+                     ticks, totalLateness / ticks, maxLateness, missedTicks);
+        for (size_t i = 0; i < buckets.size(); ++i)
+        {
+            if (buckets[i] != 0)
+            {
+                // Bucket i holds latenesses in [2^(i-1), 2^i) ns.
+                spdlog::info("  < {:>12}ns: {}", uint64_t{1} << i, buckets[i]);
+            }
+        }
+    }
+
+    void reset() { *this = TickJitter{}; }
+
+  private:
+    std::array<uint64_t, 40> buckets{};
+    uint64_t ticks{0};
+    uint64_t missedTicks{0};
+    uint64_t maxLateness{0};
+    uint64_t totalLateness{0};
+};
+
 class ClientApplication
 {
   public:
-    ClientApplication() : ClientApplication(1000, "Hey", true) {}
+    ClientApplication()
+        : ClientApplication(ClientOptions{}, std::make_shared<InlineExecutor>(),
+                            true)
+    {
+    }
 
-    ClientApplication(int64_t timeout, const std::string& timeoutPhrase)
-        : ClientApplication(timeout, timeoutPhrase, true)
+    ClientApplication(const ClientOptions& options,
+                      std::shared_ptr<Executor> executor)
+        : ClientApplication(options, std::move(executor), true)
     {
     }
 
-    ~ClientApplication() { stop(); }
+    ~ClientApplication()
+    {
+        stop();
+        close(tickWakeFd);
+    }
 
     void run() { connection->enterEventLoop(); }
 
   private:
-    ClientApplication(int64_t timeout, const std::string& timeoutPhrase,
-                      bool forceCreate)
-        : timeout(timeout), timeoutPhrase(timeoutPhrase),
+    ClientApplication(const ClientOptions& options,
+                      std::shared_ptr<Executor> executor, bool forceCreate)
+        : timeout(options.timeout), timeoutNs(options.timeoutNs),
+          timeoutPhrase(options.timeoutPhrase),
+          flushIntervalMs(options.flushIntervalMs), options(options),
           configPath(
               std::string(std::getenv("HOME")) +
               "/com.system.configurationManager/confManagerApplication1.json"),
-          forceCreateConf(forceCreate)
+          forceCreateConf(forceCreate), executor(std::move(executor))
     {
         initialize();
     }
 
     void initialize()
     {
-        connection = sdbus::createSessionBusConnection();
-        loadConfiguration();
-        setupDBusProxy();
+        tickWakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (tickWakeFd < 0)
+        {
+            throw std::runtime_error("Failed to create eventfd: " +
+                                     std::string(strerror(errno)));
+        }
+        if (options.peerSocket.empty())
+        {
+            connection = sdbus::createSessionBusConnection();
+        }
+        else
+        {
+            connection = sdbus::createDirectBusConnection("unix:path=" +
+                                                          options.peerSocket);
+        }
+        createConfigurationClient();
+        // A cached configuration is served right away and reconciled with
+        // the manager in the background; without one the config file is
+        // (re)created as before.
+        if (!loadCachedConfiguration())
+        {
+            loadConfiguration();
+        }
+        output = std::make_unique<TickOutput>(
+            options.outputMode, options.flushBytes, flushIntervalMs);
+        setupConfigurationClient();
         startTimeoutThread();
     }
 
     void stop()
     {
         running = false;
+        wakeTicks();
         if (timeoutThread.joinable())
         {
             timeoutThread.join();
@@ -66,6 +351,7 @@ class ClientApplication
 
     void loadConfiguration()
     {
+        AllocationScope scope(AllocationOperation::Parse);
         try
         {
             spdlog::debug(
@@ -90,7 +376,21 @@ class ClientApplication
             {
                 std::lock_guard<std::mutex> lock(configMutex);
                 timeout = config["Timeout"].get<int64_t>();
+                timeoutNs = config.value("TimeoutNs", timeoutNs);
+                if (timeout <= 0 || timeoutNs < 0)
+                {
+                    throw std::runtime_error(
+                        "Timeout must be positive and TimeoutNs not "
+                        "negative");
+                }
                 timeoutPhrase = config["TimeoutPhrase"].get<std::string>();
+                flushIntervalMs =
+                    config.value("FlushIntervalMs", flushIntervalMs);
+                if (flushIntervalMs <= 0)
+                {
+                    throw std::runtime_error(
+                        "FlushIntervalMs must be positive");
+                }
             }
 
             spdlog::info("Loaded configuration: Timeout={}ms, Phrase='{}'",
@@ -106,72 +406,118 @@ class ClientApplication
     void createConfig()
     {
         std::ofstream configFile(configPath);
-        json config = {{"Timeout", timeout}, {"TimeoutPhrase", timeoutPhrase}};
+        json config = {{"Timeout", timeout},
+                       {"TimeoutNs", timeoutNs},
+                       {"TimeoutPhrase", timeoutPhrase},
+                       {"FlushIntervalMs", flushIntervalMs}};
         configFile << config.dump(4);
     }
 
-    void setupDBusProxy()
+    void createConfigurationClient()
     {
-        proxy = sdbus::createProxy(
-            *connection,
-            static_cast<sdbus::ServiceName>("com.system.configurationManager"),
-            static_cast<sdbus::ObjectPath>(
-                "/com/system/configurationManager/Application/"
-                "confManagerApplication1"));
-
-        proxy->uponSignal("configurationChanged")
-            .onInterface(
-                "com.system.configurationManager.Application.Configuration")
-            .call([this](const std::map<std::string, sdbus::Variant>& newConfig)
-                  { this->handleConfigurationChange(newConfig); });
+        configurationConnection = std::make_unique<ConfigurationConnection>(
+            *connection, ResyncPolicy{},
+            options.peerSocket.empty() ? ConfigurationTransport::Bus
+                                       : ConfigurationTransport::Peer);
+        configurationClient = std::make_unique<ApplicationConfigurationClient>(
+            *configurationConnection, "confManagerApplication1", executor);
     }
 
-    void handleConfigurationChange(
-        const std::map<std::string, sdbus::Variant>& newConfig)
+    bool loadCachedConfiguration()
     {
-        try
+        if (options.cachePath.empty() ||
+            !configurationClient->loadCache(options.cachePath))
         {
-            spdlog::info("Configuration change received");
-            spdlog::debug("New configuration size: {}, first key: {}",
-                          newConfig.size(), newConfig.begin()->first);
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(configMutex);
+        if (auto value = configurationClient->get("Timeout");
+            value && value->get<int64_t>() > 0)
+            timeout = value->get<int64_t>();
+        if (auto value = configurationClient->get("TimeoutNs");
+            value && value->get<int64_t>() >= 0)
+            timeoutNs = value->get<int64_t>();
+        if (auto value = configurationClient->get("TimeoutPhrase"))
+            timeoutPhrase = value->get<std::string>();
+        if (auto value = configurationClient->get("FlushIntervalMs");
+            value && value->get<int64_t>() > 0)
+            flushIntervalMs = value->get<int64_t>();
+        spdlog::info("Using cached configuration: Timeout={}ms, Phrase='{}'",
+                     timeout, timeoutPhrase);
+        return true;
+    }
+
+    void setupConfigurationClient()
+    {
+        configurationClient->onChange(
+            "Timeout",
+            [this](const ConfigurationChange& change)
             {
-                std::lock_guard<std::mutex> lock(configMutex);
-                if (newConfig.count("Timeout"))
+                const auto value = change.newValue.get<int64_t>();
+                if (value <= 0)
                 {
-                    try
-                    {
-                        timeout = newConfig.at("Timeout").get<int64_t>();
-                        spdlog::debug("Updated Timeout to {}", timeout);
-                    }
-                    catch (const std::exception& e)
-                    {
-                        spdlog::error("Failed to get Timeout: {}", e.what());
-                    }
+                    spdlog::warn("Ignoring Timeout={}ms, it must be positive",
+                                 value);
+                    return;
                 }
-                if (newConfig.count("TimeoutPhrase"))
                 {
-                    try
-                    {
-                        timeoutPhrase =
-                            newConfig.at("TimeoutPhrase").get<std::string>();
-                        spdlog::debug("Updated TimeoutPhrase to '{}'",
-                                      timeoutPhrase);
-                    }
-                    catch (const std::exception& e)
-                    {
-                        spdlog::error("Failed to get TimeoutPhrase: {}",
-                                      e.what());
-                    }
+                    std::lock_guard<std::mutex> lock(configMutex);
+                    timeout = value;
                 }
-            }
+                wakeTicks();
+                spdlog::info("New configuration applied: Timeout={}ms",
+                             value);
+            });
+        configurationClient->onChange(
+            "TimeoutNs",
+            [this](const ConfigurationChange& change)
+            {
+                const auto value = change.newValue.get<int64_t>();
+                if (value < 0)
+                {
+                    spdlog::warn("Ignoring TimeoutNs={}, it must not be "
+                                 "negative",
+                                 value);
+                    return;
+                }
+                {
+                    std::lock_guard<std::mutex> lock(configMutex);
+                    timeoutNs = value;
+                }
+                wakeTicks();
+                spdlog::info("New configuration applied: TimeoutNs={}",
+                             value);
+            });
+        configurationClient->onChange(
+            "TimeoutPhrase",
+            [this](const ConfigurationChange& change)
+            {
+                std::lock_guard<std::mutex> lock(configMutex);
+                timeoutPhrase = change.newValue.get<std::string>();
+                spdlog::info("New configuration applied: Phrase='{}'",
+                             timeoutPhrase);
+            });
 
-            spdlog::info("New configuration applied: Timeout={}ms, Phrase='{}'",
-                         timeout, timeoutPhrase);
-        }
-        catch (const std::exception& e)
-        {
-            spdlog::error("Failed to apply new configuration: {}", e.what());
-        }
+        configurationClient->onChange(
+            "FlushIntervalMs",
+            [this](const ConfigurationChange& change)
+            {
+                const auto interval = change.newValue.get<int64_t>();
+                if (interval <= 0)
+                {
+                    spdlog::warn("Ignoring FlushIntervalMs={}, it must be "
+                                 "positive",
+                                 interval);
+                    return;
+                }
+                output->setFlushInterval(interval);
+                spdlog::info("New configuration applied: FlushIntervalMs={}",
+                             interval);
+            });
+
+        // Picks up runtime changes the manager already has, or reconciles
+        // the cached configuration with it.
+        configurationClient->requestResync();
     }
 
     void startTimeoutThread()
@@ -179,42 +525,197 @@ class ClientApplication
         timeoutThread = std::thread(
             [this]()
             {
-                while (running)
+                if (options.timerMode == TimerMode::Timerfd)
+                    runTimerfdTicks();
+                else
+                    runSleepTicks();
+                jitter.report();
+            });
+
+        if (options.cpu >= 0)
+        {
+            cpu_set_t cpus;
+            CPU_ZERO(&cpus);
+            CPU_SET(options.cpu, &cpus);
+            int r = pthread_setaffinity_np(timeoutThread.native_handle(),
+                                           sizeof(cpus), &cpus);
+            if (r != 0)
+            {
+                spdlog::warn("Failed to pin timeout thread to CPU {}: {}",
+                             options.cpu, strerror(r));
+            }
+        }
+    }
+
+    void runSleepTicks()
+    {
+        while (running)
+        {
+            const auto period = getCurrentPeriod();
+            const auto deadline = std::chrono::steady_clock::now() + period;
+            std::this_thread::sleep_for(period);
+            if (!running)
+                break;
+            tick(std::chrono::steady_clock::now() - deadline, 0);
+        }
+    }
+
+    // The timer keeps its own absolute schedule, so time spent writing a
+    // tick does not push later ticks back. A period change or stop() wakes
+    // the thread through tickWakeFd, and a period change re-arms the timer
+    // right away.
+    void runTimerfdTicks()
+    {
+        int fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+        if (fd < 0)
+        {
+            spdlog::error("timerfd_create failed: {}", strerror(errno));
+            return;
+        }
+
+        std::chrono::nanoseconds period{0};
+        std::chrono::nanoseconds deadline{0};
+        while (running)
+        {
+            const auto currentPeriod = getCurrentPeriod();
+            if (currentPeriod != period)
+            {
+                period = currentPeriod;
+                deadline = monotonicNow() + period;
+                itimerspec spec{toTimespec(period), toTimespec(deadline)};
+                if (timerfd_settime(fd, TFD_TIMER_ABSTIME, &spec, nullptr) < 0)
                 {
-                    std::this_thread::sleep_for(
-                        std::chrono::milliseconds(getCurrentTimeout()));
-                    if (!running)
-                        break;
-                    std::cout << getCurrentPhrase() << std::endl;
+                    spdlog::error("timerfd_settime failed: {}",
+                                  strerror(errno));
+                    break;
                 }
-            });
+            }
+
+            pollfd fds[] = {{fd, POLLIN, 0}, {tickWakeFd, POLLIN, 0}};
+            if (poll(fds, 2, -1) < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                spdlog::error("Polling timerfd failed: {}", strerror(errno));
+                break;
+            }
+            if (fds[1].revents & POLLIN)
+            {
+                uint64_t ignored;
+                if (::read(tickWakeFd, &ignored, sizeof(ignored)) < 0 &&
+                    errno != EAGAIN)
+                {
+                    spdlog::error("Reading wake event failed: {}",
+                                  strerror(errno));
+                    break;
+                }
+                continue;
+            }
+
+            uint64_t expirations = 0;
+            if (::read(fd, &expirations, sizeof(expirations)) !=
+                sizeof(expirations))
+            {
+                if (errno == EINTR || errno == EAGAIN)
+                    continue;
+                spdlog::error("Reading timerfd failed: {}", strerror(errno));
+                break;
+            }
+            if (!running)
+                break;
+
+            tick(monotonicNow() - deadline, expirations - 1);
+            deadline += period * expirations;
+        }
+        close(fd);
     }
 
-    int64_t getCurrentTimeout()
+    void tick(std::chrono::nanoseconds lateness, uint64_t missed)
     {
-        std::lock_guard<std::mutex> lock(configMutex);
-        return timeout;
+        {
+            // assign() reuses the capacity, so this does not allocate once
+            // the phrase stops growing.
+            std::lock_guard<std::mutex> lock(configMutex);
+            tickPhrase.assign(timeoutPhrase);
+        }
+        output->writeLine(tickPhrase);
+        jitter.record(lateness, missed);
+
+        if (options.jitterReportInterval > 0)
+        {
+            const auto now = std::chrono::steady_clock::now();
+            if (now - lastJitterReport >=
+                std::chrono::seconds(options.jitterReportInterval))
+            {
+                jitter.report();
+                jitter.reset();
+                lastJitterReport = now;
+            }
+        }
+    }
+
+    // Makes the timerfd thread re-read the period and `running`.
+    void wakeTicks()
+    {
+        const uint64_t one = 1;
+        if (tickWakeFd >= 0 && write(tickWakeFd, &one, sizeof(one)) < 0 &&
+            errno != EAGAIN)
+        {
+            spdlog::error("Failed to wake the timeout thread: {}",
+                          strerror(errno));
+        }
     }
 
-    std::string getCurrentPhrase()
+    std::chrono::nanoseconds getCurrentPeriod()
     {
         std::lock_guard<std::mutex> lock(configMutex);
-        return timeoutPhrase;
+        if (timeoutNs > 0)
+            return std::chrono::nanoseconds(timeoutNs);
+        return std::chrono::milliseconds(timeout);
+    }
+
+    static std::chrono::nanoseconds monotonicNow()
+    {
+        timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return std::chrono::seconds(now.tv_sec) +
+               std::chrono::nanoseconds(now.tv_nsec);
+    }
+
+    static timespec toTimespec(std::chrono::nanoseconds duration)
+    {
+        const auto seconds =
+            std::chrono::duration_cast<std::chrono::seconds>(duration);
+        return {static_cast<time_t>(seconds.count()),
+                static_cast<long>((duration - seconds).count())};
     }
 
     // Configuration
     std::string configPath;
     int64_t timeout;
+    int64_t timeoutNs;
     std::string timeoutPhrase;
+    int64_t flushIntervalMs;
+    ClientOptions options;
     std::mutex configMutex;
     bool forceCreateConf;
 
     // D-Bus
     std::unique_ptr<sdbus::IConnection> connection;
-    std::unique_ptr<sdbus::IProxy> proxy;
+    std::shared_ptr<Executor> executor;
+    std::unique_ptr<ConfigurationConnection> configurationConnection;
+    std::unique_ptr<ApplicationConfigurationClient> configurationClient;
 
     // Threading
+    std::unique_ptr<TickOutput> output;
+    // Only touched by the timeout thread; written without configMutex.
+    std::string tickPhrase;
+    TickJitter jitter;
+    std::chrono::steady_clock::time_point lastJitterReport{
+        std::chrono::steady_clock::now()};
     std::atomic<bool> running{true};
+    // Signalled on period changes and on stop().
+    int tickWakeFd{-1};
     std::thread timeoutThread;
 };
 
@@ -224,18 +725,80 @@ int main(int argc, char* argv[])
 
     try
     {
-        int64_t timeout = 1000;
-        std::string phrase = "Hey";
+        ClientOptions options;
+        std::string outputMode = "line";
+        std::string timerMode = "sleep";
         bool verbose = false;
+        std::string executorKind = "inline";
+        size_t executorThreads = 4;
+        bool noCache = false;
+        if (const char* home = std::getenv("HOME"))
+        {
+            options.cachePath = std::string(home) +
+                                "/.cache/com.system.configurationManager/"
+                                "confManagerApplication1.bundle";
+        }
 
         CLI::App app{"Configuration Client Application"};
-        app.add_option("--timeout", timeout, "Timeout in milliseconds")
+        app.add_option("--timeout", options.timeout, "Timeout in milliseconds")
             ->check(CLI::PositiveNumber)
             ->default_val(1000);
 
-        app.add_option("--phrase", phrase, "Timeout message")
+        app.add_option("--timeout-ns", options.timeoutNs,
+                       "Timeout in nanoseconds, overrides --timeout")
+            ->check(CLI::NonNegativeNumber)
+            ->default_val(0);
+
+        app.add_option("--timer", timerMode, "How the timeout thread waits")
+            ->check(CLI::IsMember({"sleep", "timerfd"}))
+            ->default_val("sleep");
+
+        app.add_option("--cpu", options.cpu, "Pin the timeout thread to a CPU")
+            ->check(CLI::NonNegativeNumber);
+
+        app.add_option("--jitter-report", options.jitterReportInterval,
+                       "Seconds between tick jitter reports (0: on exit only)")
+            ->check(CLI::NonNegativeNumber)
+            ->default_val(0);
+
+        app.add_option("--phrase", options.timeoutPhrase, "Timeout message")
             ->default_val("Hey");
 
+        app.add_option("--output", outputMode, "How timeout messages are written")
+            ->check(CLI::IsMember({"line", "buffered", "thread"}))
+            ->default_val("line");
+
+        app.add_option("--flush-interval", options.flushIntervalMs,
+                       "Flush interval of buffered output in milliseconds")
+            ->check(CLI::PositiveNumber)
+            ->default_val(100);
+
+        app.add_option("--flush-bytes", options.flushBytes,
+                       "Buffered output size that forces a flush")
+            ->check(CLI::PositiveNumber)
+            ->default_val(64 * 1024);
+
+        app.add_option("--executor", executorKind,
+                       "Where change callbacks run")
+            ->check(CLI::IsMember({"inline", "thread", "pool"}))
+            ->default_val("inline");
+
+        app.add_option("--executor-threads", executorThreads,
+                       "Number of threads for the pool executor")
+            ->check(CLI::PositiveNumber)
+            ->default_val(4);
+
+        app.add_option("--cache", options.cachePath,
+                       "Last known good configuration served at startup")
+            ->default_val(options.cachePath);
+
+        app.add_flag("--no-cache", noCache,
+                     "Always start from the config file");
+
+        app.add_option("--peer-socket", options.peerSocket,
+                       "Connect to the manager's --peer-socket directly "
+                       "instead of through the bus");
+
         app.add_flag("-v,--verbose", verbose, "Enable verbose logging");
 
         CLI11_PARSE(app, argc, argv);
@@ -246,11 +809,28 @@ int main(int argc, char* argv[])
             spdlog::debug("Verbose logging enabled");
         }
 
+        if (outputMode == "buffered")
+            options.outputMode = OutputMode::Buffered;
+        else if (outputMode == "thread")
+            options.outputMode = OutputMode::Thread;
+        if (timerMode == "timerfd")
+            options.timerMode = TimerMode::Timerfd;
+        if (noCache)
+            options.cachePath.clear();
+
         spdlog::info(
             "Starting with configuration - timeout: {}ms, phrase: '{}'",
-            timeout, phrase);
+            options.timeout, options.timeoutPhrase);
+
+        std::shared_ptr<Executor> executor;
+        if (executorKind == "thread")
+            executor = std::make_shared<ThreadExecutor>();
+        else if (executorKind == "pool")
+            executor = std::make_shared<ThreadPoolExecutor>(executorThreads);
+        else
+            executor = std::make_shared<InlineExecutor>();
 
-        ClientApplication client_app(timeout, phrase);
+        ClientApplication client_app(options, executor);
         client_app.run();
     }
     catch (const std::exception& e)
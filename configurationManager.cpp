@@ -1,105 +1,283 @@
+#include "CLI/CLI.hpp"
+#include "allocationTracker.hpp"
+#include "configurationAdaptors.hpp"
+#include "configurationBundle.hpp"
+#include "configurationStore.hpp"
+#include "eventLoopMonitor.hpp"
+#include "executor.hpp"
+#include "keyTable.hpp"
+#include "merkleTree.hpp"
+#include "nativeProtocol.hpp"
+#include "sealedBlob.hpp"
+#include "syncProtocol.hpp"
 #include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <csignal>
+#include <cstring>
+#include <functional>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <iterator>
 #include <map>
-#include <nlohmann/json.hpp>
+#include <mutex>
+#include <poll.h>
 #include <sdbus-c++/sdbus-c++.h>
 #include <spdlog/sinks/stdout_color_sinks.h>
 #include <spdlog/spdlog.h>
 #include <string>
+#include <string_view>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <thread>
 #include <systemd/sd-bus.h>
+#include <unordered_map>
 #include <unordered_set>
 #include <vector>
 
-using config_dict = std::map<std::string, sdbus::Variant>;
-namespace nlohmann
+using sd_bus_message_ptr =
+    std::unique_ptr<sd_bus_message, decltype(&sd_bus_message_unref)>;
+namespace fs = std::filesystem;
+
+static void initialize_logging()
 {
-template <> struct adl_serializer<sdbus::Variant>
+    auto logger = spdlog::stdout_color_mt("config_manager");
+    logger->set_level(spdlog::level::info);
+    spdlog::set_default_logger(logger);
+}
+// Marshalling helpers for the raw sd-bus fallback vtable. Only the value
+// types that configuration files can produce are supported there.
+static void appendVariant(sd_bus_message* message, const sdbus::Variant& value)
 {
-    static void to_json(json& j, const sdbus::Variant& v)
+    const std::string type = value.peekValueType();
+    int r = 0;
+    if (type == "s")
+        r = sd_bus_message_append(message, "v", "s",
+                                  value.get<std::string>().c_str());
+    else if (type == "x")
+        r = sd_bus_message_append(message, "v", "x", value.get<int64_t>());
+    else if (type == "t")
+        r = sd_bus_message_append(message, "v", "t", value.get<uint64_t>());
+    else if (type == "d")
+        r = sd_bus_message_append(message, "v", "d", value.get<double>());
+    else if (type == "b")
+        r = sd_bus_message_append(message, "v", "b",
+                                  static_cast<int>(value.get<bool>()));
+    else if (type == blobHandleSignature)
+    {
+        const auto handle = value.get<blob_handle>();
+        r = sd_bus_message_append(message, "v", "(tt)", std::get<0>(handle),
+                                  std::get<1>(handle));
+    }
+    else if (type == "ay")
+    {
+        const auto bytes = value.get<std::vector<uint8_t>>();
+        r = sd_bus_message_open_container(message, 'v', "ay");
+        if (r >= 0)
+            r = sd_bus_message_append_array(message, 'y', bytes.data(),
+                                            bytes.size());
+        if (r >= 0)
+            r = sd_bus_message_close_container(message);
+    }
+    else
+        throw std::invalid_argument("Unsupported value type: " + type);
+    if (r < 0)
     {
-        // Not needed for parsing
-        throw std::runtime_error("Variant to JSON not implemented");
+        throw std::runtime_error("Failed to append variant: " +
+                                 std::string(strerror(-r)));
     }
+}
 
-    static void from_json(const json& j, sdbus::Variant& v)
+static void appendConfiguration(sd_bus_message* message,
+                                const config_dict& configuration)
+{
+    int r = sd_bus_message_open_container(message, 'a', "{sv}");
+    for (const auto& [key, value] : configuration)
     {
-        if (j.is_string())
-            v = sdbus::Variant(j.get<std::string>());
-        else if (j.is_number_integer())
-            v = sdbus::Variant(j.get<int64_t>());
-        else if (j.is_number_float())
-            v = sdbus::Variant(j.get<double>());
-        else if (j.is_boolean())
-            v = sdbus::Variant(j.get<bool>());
-        else
-            throw json::type_error::create(
-                302, "Unsupported type for variant conversion", &j);
+        if (r >= 0)
+            r = sd_bus_message_open_container(message, 'e', "sv");
+        if (r >= 0)
+            r = sd_bus_message_append_basic(message, 's', key.c_str());
+        if (r >= 0)
+            appendVariant(message, value);
+        if (r >= 0)
+            r = sd_bus_message_close_container(message);
     }
-};
-} // namespace nlohmann
-using json = nlohmann::json;
-namespace fs = std::filesystem;
+    if (r >= 0)
+        r = sd_bus_message_close_container(message);
+    if (r < 0)
+    {
+        throw std::runtime_error("Failed to append configuration: " +
+                                 std::string(strerror(-r)));
+    }
+}
 
-static void initialize_logging()
+static sdbus::Variant readVariant(sd_bus_message* message)
 {
-    auto logger = spdlog::stdout_color_mt("config_manager");
-    logger->set_level(spdlog::level::info);
-    spdlog::set_default_logger(logger);
+    const char* contents = nullptr;
+    int r = sd_bus_message_peek_type(message, nullptr, &contents);
+    if (r < 0 || !contents)
+    {
+        throw std::invalid_argument("Expected a variant argument");
+    }
+    const std::string type = contents;
+    r = sd_bus_message_enter_container(message, 'v', contents);
+
+    sdbus::Variant value;
+    if (r >= 0 && type == "s")
+    {
+        const char* s = nullptr;
+        r = sd_bus_message_read_basic(message, 's', &s);
+        if (r >= 0)
+            value = sdbus::Variant(std::string(s));
+    }
+    else if (r >= 0 && type == "x")
+    {
+        int64_t x = 0;
+        r = sd_bus_message_read_basic(message, 'x', &x);
+        value = sdbus::Variant(x);
+    }
+    else if (r >= 0 && type == "t")
+    {
+        uint64_t t = 0;
+        r = sd_bus_message_read_basic(message, 't', &t);
+        value = sdbus::Variant(t);
+    }
+    else if (r >= 0 && type == "d")
+    {
+        double d = 0;
+        r = sd_bus_message_read_basic(message, 'd', &d);
+        value = sdbus::Variant(d);
+    }
+    else if (r >= 0 && type == "b")
+    {
+        int b = 0;
+        r = sd_bus_message_read_basic(message, 'b', &b);
+        value = sdbus::Variant(b != 0);
+    }
+    else if (r >= 0 && type == "h")
+    {
+        int fd = -1;
+        r = sd_bus_message_read_basic(message, 'h', &fd);
+        // The message keeps owning `fd`; UnixFd takes its own duplicate.
+        if (r >= 0)
+            value = sdbus::Variant(sdbus::UnixFd(fd));
+    }
+    else if (r >= 0 && type == "ay")
+    {
+        const void* bytes = nullptr;
+        size_t size = 0;
+        r = sd_bus_message_read_array(message, 'y', &bytes, &size);
+        if (r >= 0)
+        {
+            const auto* first = static_cast<const uint8_t*>(bytes);
+            value = sdbus::Variant(std::vector<uint8_t>(first, first + size));
+        }
+    }
+    else if (r >= 0)
+    {
+        throw std::invalid_argument("Unsupported value type: " + type);
+    }
+    if (r >= 0)
+        r = sd_bus_message_exit_container(message);
+    if (r < 0)
+    {
+        throw std::runtime_error("Failed to read variant: " +
+                                 std::string(strerror(-r)));
+    }
+    return value;
 }
 
+// D-Bus front end of one ApplicationStore: exports it as an object, either
+// with a vtable of its own or through the manager's fallback vtable, and
+// turns the store's updates into signals.
+//
+// Signals are emitted on `signalEmitter`, the event loop of the connection
+// the object is on: sd-bus must not be used from two threads, and a call is
+// answered before the loop gets to them. The emitter runs tasks in the order
+// they were posted, which keeps the signals in version order, and must not
+// run any once the object is destroyed.
 class ApplicationConfiguration
 {
   public:
+    // Registers its own D-Bus object with a single vtable.
     ApplicationConfiguration(sdbus::IConnection& connection,
                              const sdbus::ObjectPath& objectPath,
-                             const std::string& configPath,
-                             const sdbus::InterfaceName& interfaceName)
-        : interfaceName(interfaceName), configPath(configPath)
+                             const sdbus::InterfaceName& interfaceName,
+                             ApplicationStore& store, Executor& signalEmitter)
+        : objectPath(objectPath), interfaceName(interfaceName), store(store),
+          signalEmitter(signalEmitter)
     {
         try
         {
-            spdlog::debug("Creating ApplicationConfiguration for {}",
-                          configPath);
-            parseConfig();
+            spdlog::debug("Exporting {} at {}", store.getName(),
+                          std::string(objectPath));
             object = sdbus::createObject(connection, objectPath);
-            registerMethods();
-            spdlog::info("Successfully created ApplicationConfiguration for {}",
-                         configPath);
+            registerMethods(*object);
+            typedAdaptor = createTypedAdaptor(
+                store.getName(), *object,
+                [&store](uint64_t& currentVersion)
+                { return store.getResolvedValues({}, currentVersion); },
+                [&store](const std::string& key, const sdbus::Variant& value)
+                { store.changeConfiguration(key, value); });
+            subscribe();
         }
         catch (const std::exception& e)
         {
-            spdlog::error("Failed to create ApplicationConfiguration for {}",
-                          configPath);
+            spdlog::error("Failed to export {}", store.getName());
             throw std::runtime_error(
                 "Failed to create ApplicationConfiguration: " +
                 std::string(e.what()));
         }
     }
 
-    void emitConfigurationChanged()
+    // Served by a fallback vtable registered on the bus by the manager, so no
+    // per-object registration happens here.
+    ApplicationConfiguration(sd_bus* fallbackBus,
+                             const sdbus::ObjectPath& objectPath,
+                             const sdbus::InterfaceName& interfaceName,
+                             ApplicationStore& store, Executor& signalEmitter)
+        : objectPath(objectPath), interfaceName(interfaceName), store(store),
+          signalEmitter(signalEmitter), fallbackBus(fallbackBus)
     {
-        if (!object)
-        {
-            throw std::runtime_error("D-Bus object not initialized");
-        }
-        try
-        {
-            object->emitSignal("configurationChanged")
-                .onInterface(interfaceName)
-                .withArguments(configuration);
-        }
-        catch (const std::exception& e)
-        {
-            throw std::runtime_error(
-                "Failed to emit configurationChanged signal: " +
-                std::string(e.what()));
-        }
+        subscribe();
+    }
+
+    ApplicationStore& getStore() { return store; }
+
+    // Exports the application on a peer-to-peer connection as well. The
+    // peer's object serves the same interface and receives every signal,
+    // sent by `peerEmitter` on the peer's own event loop. Nothing is ever
+    // sent on a connection from inside the dispatch of another, whose lock
+    // sdbus-c++ holds meanwhile.
+    void attachPeer(sdbus::IConnection& peer, Executor& peerEmitter)
+    {
+        auto peerObject = sdbus::createObject(peer, objectPath);
+        registerMethods(*peerObject);
+        std::lock_guard<std::mutex> lock(peerMutex);
+        peerObjects.push_back({std::move(peerObject), &peerEmitter});
+    }
+
+    // Called on the peer's loop thread once it stopped running tasks.
+    void detachPeer(sdbus::IConnection& peer)
+    {
+        std::lock_guard<std::mutex> lock(peerMutex);
+        peerObjects.erase(
+            std::remove_if(peerObjects.begin(), peerObjects.end(),
+                           [&peer](const auto& peerObject)
+                           {
+                               return &peerObject.object->getConnection() ==
+                                      &peer;
+                           }),
+            peerObjects.end());
     }
 
     ~ApplicationConfiguration()
     {
+        store.unsubscribe(subscription);
         if (object)
         {
             object->unregister();
@@ -107,243 +285,2827 @@ class ApplicationConfiguration
     }
 
   private:
-    void parseConfig()
+    void subscribe()
+    {
+        subscription = store.subscribe(
+            [this](uint64_t version, uint64_t hash, const config_dict& changed)
+            {
+                ++pendingChanges;
+                signalEmitter.post(
+                    [this, version, hash, changed]()
+                    {
+                        try
+                        {
+                            // configurationChanged carries the whole current
+                            // configuration, so it is only sent for the last
+                            // of several queued changes.
+                            if (--pendingChanges == 0)
+                            {
+                                emitConfigurationChanged();
+                            }
+                            emitConfigurationUpdated(version, hash, changed);
+                        }
+                        catch (const std::exception& e)
+                        {
+                            spdlog::error("{}: {}", store.getName(), e.what());
+                        }
+                    });
+            });
+    }
+
+    void emitConfigurationChanged()
     {
+        AllocationScope scope(AllocationOperation::Emit);
         try
         {
-            spdlog::debug("Parsing config file: {}", configPath);
-            std::ifstream configFile(configPath);
-            if (!configFile)
+            auto current =
+                std::make_shared<const config_dict>(store.getConfiguration());
+            if (object)
+            {
+                object->emitSignal("configurationChanged")
+                    .onInterface(interfaceName)
+                    .withArguments(*current);
+            }
+            else
             {
-                spdlog::error("Could not open config file: {}", configPath);
-                throw std::runtime_error("Could not open config file");
+                emitFallbackSignal("configurationChanged",
+                                   [&current](sd_bus_message* signal)
+                                   { appendConfiguration(signal, *current); });
             }
-            configuration = json::parse(configFile).get<config_dict>();
-            spdlog::info("Successfully parsed config file: {}", configPath);
+            emitToPeers(
+                [this, current](sdbus::IObject& peerObject)
+                {
+                    peerObject.emitSignal("configurationChanged")
+                        .onInterface(interfaceName)
+                        .withArguments(*current);
+                });
         }
         catch (const std::exception& e)
         {
-            spdlog::error("Failed to parse config file: {}", configPath);
-            throw std::runtime_error("Config parsing failed: " +
-                                     std::string(e.what()));
+            throw std::runtime_error(
+                "Failed to emit configurationChanged signal: " +
+                std::string(e.what()));
         }
     }
 
-    void changeConfiguration(const std::string& key, const sdbus::Variant& val)
+    // Carries only the keys changed by `version`, so clients can apply it
+    // directly and notice any version they missed, plus the content hash
+    // after the change to check the result against.
+    void emitConfigurationUpdated(uint64_t version, uint64_t hash,
+                                  const config_dict& changed)
     {
-        spdlog::debug("Changing configuration key: {}", key);
-        if (key.empty())
+        AllocationScope scope(AllocationOperation::Emit);
+        const uint64_t generation = store.getGeneration();
+        try
         {
-            throw std::invalid_argument("Key cannot be empty");
+            if (object)
+            {
+                object->emitSignal("configurationUpdated")
+                    .onInterface(interfaceName)
+                    .withArguments(generation, version, hash, changed);
+                if (typedAdaptor)
+                {
+                    typedAdaptor->emitUpdated();
+                }
+            }
+            else
+            {
+                emitFallbackSignal(
+                    "configurationUpdated",
+                    [generation, version, hash,
+                     &changed](sd_bus_message* signal)
+                    {
+                        int r = sd_bus_message_append(signal, "ttt", generation,
+                                                      version, hash);
+                        if (r < 0)
+                        {
+                            throw std::runtime_error(
+                                "Failed to append version: " +
+                                std::string(strerror(-r)));
+                        }
+                        appendConfiguration(signal, changed);
+                    });
+            }
+            emitToPeers(
+                [this, generation, version, hash,
+                 shared = std::make_shared<const config_dict>(changed)](
+                    sdbus::IObject& peerObject)
+                {
+                    peerObject.emitSignal("configurationUpdated")
+                        .onInterface(interfaceName)
+                        .withArguments(generation, version, hash, *shared);
+                });
         }
-        if (val.isEmpty())
+        catch (const std::exception& e)
         {
-            throw std::invalid_argument("Value cannot be empty");
+            throw std::runtime_error(
+                "Failed to emit configurationUpdated signal: " +
+                std::string(e.what()));
         }
-
-        configuration[key] = val;
-        emitConfigurationChanged();
-        // NOTE: Maybe we should save changes back to json?
-
-        spdlog::info("Configuration changed for key: {}", key);
     }
 
-    config_dict getConfiguration() const { return configuration; }
-
-    void registerMethods()
+    // Queues `emit` for every peer's event loop. A peer that went away must
+    // not fail the change that is being announced, so errors are only
+    // logged.
+    void emitToPeers(const std::function<void(sdbus::IObject&)>& emit)
     {
-        if (!object)
+        std::lock_guard<std::mutex> lock(peerMutex);
+        for (const auto& peerObject : peerObjects)
         {
-            throw std::runtime_error("D-Bus object not initialized");
+            peerObject.emitter->post(
+                [this, target = peerObject.object.get(), emit]()
+                {
+                    try
+                    {
+                        emit(*target);
+                    }
+                    catch (const std::exception& e)
+                    {
+                        spdlog::debug("Failed to signal a peer of {}: {}",
+                                      store.getName(), e.what());
+                    }
+                });
         }
+    }
 
-        object
-            ->addVTable(sdbus::registerMethod("GetConfiguration")
-                            .implementedAs(
-                                [this]() { return this->getConfiguration(); }))
-            .forInterface(interfaceName);
+    void
+    emitFallbackSignal(const char* member,
+                       const std::function<void(sd_bus_message*)>& append)
+    {
+        sd_bus_message* raw = nullptr;
+        int r = sd_bus_message_new_signal(fallbackBus, &raw, objectPath.c_str(),
+                                          interfaceName.c_str(), member);
+        if (r < 0)
+        {
+            throw std::runtime_error("Failed to create signal: " +
+                                     std::string(strerror(-r)));
+        }
+        sd_bus_message_ptr signal(raw, &sd_bus_message_unref);
+        append(signal.get());
+        r = sd_bus_send(fallbackBus, signal.get(), nullptr);
+        if (r < 0)
+        {
+            throw std::runtime_error("Failed to send signal: " +
+                                     std::string(strerror(-r)));
+        }
+    }
 
-        object
-            ->addVTable(
+    void registerMethods(sdbus::IObject& target)
+    {
+        target
+            .addVTable(
+                sdbus::registerMethod("GetConfiguration")
+                    .implementedAs(
+                        [this]()
+                        {
+                            EventLoopMonitor::HandlerScope handler(
+                                "GetConfiguration");
+                            AllocationScope scope(AllocationOperation::Get);
+                            return store.getConfiguration();
+                        }),
+                sdbus::registerMethod("GetConfigurationSince")
+                    .implementedAs(
+                        [this](uint64_t clientGeneration, uint64_t clientVersion)
+                        {
+                            EventLoopMonitor::HandlerScope handler(
+                                "GetConfigurationSince");
+                            AllocationScope scope(AllocationOperation::Get);
+                            return store.getConfigurationSince(clientGeneration,
+                                                               clientVersion);
+                        }),
+                sdbus::registerMethod("GetValue").implementedAs(
+                    [this](const std::string& key)
+                    {
+                        EventLoopMonitor::HandlerScope handler("GetValue");
+                        try
+                        {
+                            return sdbus::UnixFd(store.getValue(key)->fd());
+                        }
+                        catch (const std::invalid_argument& e)
+                        {
+                            throw sdbus::Error(
+                                sdbus::Error::Name{
+                                    "org.freedesktop.DBus.Error.InvalidArgs"},
+                                e.what());
+                        }
+                    }),
                 sdbus::registerMethod("ChangeConfiguration")
-                    .implementedAs([this](const std::string& key,
-                                          const sdbus::Variant& val)
-                                   { this->changeConfiguration(key, val); }),
+                    .implementedAs(
+                        [this](const std::string& key,
+                               const sdbus::Variant& val)
+                        {
+                            EventLoopMonitor::HandlerScope handler(
+                                "ChangeConfiguration");
+                            try
+                            {
+                                store.changeConfiguration(key, val);
+                            }
+                            catch (const std::invalid_argument& e)
+                            {
+                                throw sdbus::Error(
+                                    sdbus::Error::Name{"org.freedesktop.DBus."
+                                                       "Error.InvalidArgs"},
+                                    e.what());
+                            }
+                        }),
                 sdbus::registerSignal("configurationChanged")
-                    .withParameters<config_dict>())
+                    .withParameters<config_dict>(),
+                sdbus::registerSignal("configurationUpdated")
+                    .withParameters<uint64_t, uint64_t, uint64_t,
+                                    config_dict>(),
+                sdbus::registerProperty("ContentHash")
+                    .withGetter([this]() { return store.getContentHash(); }))
             .forInterface(interfaceName);
     }
 
+    const sdbus::ObjectPath objectPath;
+    const sdbus::InterfaceName interfaceName;
+    ApplicationStore& store;
+    Executor& signalEmitter;
+    // Changes whose signals are still queued on signalEmitter.
+    std::atomic<uint64_t> pendingChanges{0};
+    uint64_t subscription{0};
     std::unique_ptr<sdbus::IObject> object;
-    config_dict configuration;
-    sdbus::InterfaceName interfaceName;
-    std::string configPath;
+    sd_bus* fallbackBus{nullptr};
+    // Typed interface from the application's schema, if it has one.
+    std::unique_ptr<TypedAdaptor> typedAdaptor;
+    // Objects on peer-to-peer connections, added and removed by the peers'
+    // own event loop threads.
+    struct PeerObject
+    {
+        std::unique_ptr<sdbus::IObject> object;
+        Executor* emitter;
+    };
+    std::mutex peerMutex;
+    std::vector<PeerObject> peerObjects;
 };
 
-class ConfigurationManager
+// Read-only mirror of one ApplicationStore on the read lane's connection.
+// Reads are answered from an immutable snapshot, which the first read after
+// a change takes again; writers only mark it stale. Must only be called
+// from the read lane's event loop.
+class ApplicationMirror
 {
   public:
-    static ConfigurationManager& getInstance()
+    ApplicationMirror(sdbus::IConnection& connection,
+                      const sdbus::ObjectPath& objectPath,
+                      const sdbus::InterfaceName& interfaceName,
+                      ApplicationStore& store)
+        : store(store), snapshot(store.getSnapshot())
     {
-        static ConfigurationManager instance;
-        return instance;
+        object = sdbus::createObject(connection, objectPath);
+        object
+            ->addVTable(
+                sdbus::registerMethod("GetConfiguration")
+                    .implementedAs(
+                        [this]()
+                        {
+                            EventLoopMonitor::HandlerScope handler(
+                                "Mirror.GetConfiguration");
+                            return current()->values;
+                        }),
+                sdbus::registerMethod("GetSnapshot")
+                    .implementedAs(
+                        [this]()
+                        {
+                            EventLoopMonitor::HandlerScope handler(
+                                "Mirror.GetSnapshot");
+                            auto taken = current();
+                            return std::make_tuple(
+                                taken->generation, taken->version,
+                                taken->contentHash, taken->values);
+                        }),
+                sdbus::registerMethod("GetValue").implementedAs(
+                    [this](const std::string& key)
+                    {
+                        EventLoopMonitor::HandlerScope handler(
+                            "Mirror.GetValue");
+                        try
+                        {
+                            return sdbus::UnixFd(
+                                this->store.getValue(key)->fd());
+                        }
+                        catch (const std::invalid_argument& e)
+                        {
+                            throw sdbus::Error(
+                                sdbus::Error::Name{
+                                    "org.freedesktop.DBus.Error.InvalidArgs"},
+                                e.what());
+                        }
+                    }),
+                sdbus::registerProperty("ContentHash")
+                    .withGetter([this]() { return current()->contentHash; }))
+            .forInterface(interfaceName);
+        // Last, so that a failure above leaves no subscription behind. A
+        // change since the snapshot above is picked up by the first read.
+        subscription = store.subscribe(
+            [this](uint64_t, uint64_t, const config_dict&) { stale = true; });
+        stale = true;
     }
 
-    ConfigurationManager(const ConfigurationManager&) = delete;
-    ConfigurationManager& operator=(const ConfigurationManager&) = delete;
-    ConfigurationManager(ConfigurationManager&&) = delete;
-    ConfigurationManager& operator=(ConfigurationManager&&) = delete;
-
-    std::vector<std::string> getApplicationNames() const
+    ~ApplicationMirror()
     {
-        std::vector<std::string> names;
-        names.reserve(applicationsConfiguration.size());
+        store.unsubscribe(subscription);
+        object->unregister();
+    }
 
-        for (const auto& [name, _] : applicationsConfiguration)
+    ApplicationMirror(const ApplicationMirror&) = delete;
+    ApplicationMirror& operator=(const ApplicationMirror&) = delete;
+
+  private:
+    const std::shared_ptr<const ConfigurationSnapshot>& current()
+    {
+        // A change committed while the snapshot is taken marks it stale
+        // again, so the next read takes it once more.
+        if (stale.exchange(false))
         {
-            names.push_back(name);
+            snapshot = store.getSnapshot();
         }
+        return snapshot;
+    }
 
-        return names;
+    ApplicationStore& store;
+    std::shared_ptr<const ConfigurationSnapshot> snapshot;
+    std::atomic<bool> stale{false};
+    uint64_t subscription{0};
+    std::unique_ptr<sdbus::IObject> object;
+};
+
+// Serves the native protocol (see nativeProtocol.hpp) on a Unix socket from
+// a single epoll thread. Reads are answered on that thread in arrival
+// order; change batches, which write files and copy blobs, are applied on a
+// change thread and hold back the rest of their connection's requests until
+// they are answered. A connection is not read while its replies pile up.
+// Updates for subscribers are encoded once by the thread committing the
+// change and fanned out by the loop.
+class NativeEndpoint
+{
+  public:
+    using application_lookup =
+        std::function<ApplicationStore*(const std::string&)>;
+
+    NativeEndpoint(const std::string& socketPath, uint64_t generation,
+                   application_lookup lookup)
+        : socketPath(socketPath), generation(generation),
+          lookup(std::move(lookup))
+    {
+        epollFd = epoll_create1(EPOLL_CLOEXEC);
+        wakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (epollFd < 0 || wakeFd < 0)
+        {
+            const std::string reason = strerror(errno);
+            closeDescriptors();
+            throw std::runtime_error("Failed to set up native endpoint: " +
+                                     reason);
+        }
+        try
+        {
+            listenFd = listenOnSocket();
+            watch(listenFd, EPOLLIN);
+            watch(wakeFd, EPOLLIN);
+        }
+        catch (...)
+        {
+            closeDescriptors();
+            throw;
+        }
     }
 
-    void run()
+    ~NativeEndpoint()
     {
-        if (!connection)
+        stop();
+        // Drains the queued changes, which still wake the loop.
+        changeThread.reset();
+        for (const auto& [fd, _] : clients)
         {
-            throw std::runtime_error("D-Bus connection not initialized");
+            close(fd);
         }
-        connection->enterEventLoopAsync();
+        closeDescriptors();
+        unlink(socketPath.c_str());
+    }
+
+    NativeEndpoint(const NativeEndpoint&) = delete;
+    NativeEndpoint& operator=(const NativeEndpoint&) = delete;
+
+    void start()
+    {
+        running = true;
+        thread = std::thread([this]() { loop(); });
     }
 
     void stop()
     {
-        if (connection)
+        if (!thread.joinable())
+        {
+            return;
+        }
+        running = false;
+        wake();
+        thread.join();
+    }
+
+    // Queues a change for the subscribers of `application`. Called from
+    // any thread; cheap while nobody is subscribed.
+    void notifyUpdated(const std::string& application, uint64_t version,
+                       uint64_t hash, const config_dict& changed)
+    {
+        if (subscriptionCount == 0)
+        {
+            return;
+        }
+        nlohmann::json update{{"type", "updated"},
+                              {"application", application},
+                              {"generation", generation},
+                              {"version", version},
+                              {"hash", hash},
+                              {"values", encodeValues(changed)}};
+        std::vector<uint8_t> frame;
+        native_protocol::appendFrame(frame, update);
+        if (frame.size() - 4 > sync_protocol::maxFrameSize)
         {
-            connection->leaveEventLoop();
+            update["values"] = nlohmann::json::object();
+            update["incomplete"] = true;
+            frame.clear();
+            frame.shrink_to_fit();
+            native_protocol::appendFrame(frame, update);
         }
+        {
+            std::lock_guard<std::mutex> lock(updatesMutex);
+            pendingUpdates.emplace_back(application, std::move(frame));
+        }
+        wake();
     }
 
   private:
-    ConfigurationManager()
+    struct Client
     {
-        try
+        int fd;
+        // Tells a reconnect on the same descriptor from the client a change
+        // was applied for.
+        uint64_t id;
+        std::vector<uint8_t> input;
+        std::vector<uint8_t> output;
+        size_t outputOffset{0};
+        // End of the frame being sent; output holds whole frames only.
+        size_t frameEnd{0};
+        uint32_t events{EPOLLIN};
+        // A change batch is being applied on the change thread.
+        bool changing{false};
+        std::unordered_set<std::string> subscriptions;
+    };
+
+    struct CompletedChange
+    {
+        int fd;
+        uint64_t client;
+        std::vector<uint8_t> reply;
+    };
+
+    // A subscriber this far behind is disconnected rather than buffered;
+    // the frame being sent does not count.
+    static constexpr size_t maxPendingOutput = 64 * 1024 * 1024;
+    // Requests of a client are neither read nor handled while this much of
+    // its output is waiting to be sent.
+    static constexpr size_t maxReplyBacklog = 1024 * 1024;
+    // One frame of the largest size, so that a full buffer always holds a
+    // complete request.
+    static constexpr size_t maxPendingInput = sync_protocol::maxFrameSize + 4;
+
+    int listenOnSocket() const
+    {
+        int fd =
+            socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+        if (fd < 0)
         {
-            spdlog::debug("Initializing ConfigurationManager");
-            initialize();
-            spdlog::info("ConfigurationManager initialized successfully");
+            throw std::runtime_error("Failed to create socket: " +
+                                     std::string(strerror(errno)));
         }
-        catch (const std::exception& e)
+        const auto address = sync_protocol::socketAddress(socketPath);
+        unlink(socketPath.c_str());
+        if (bind(fd, reinterpret_cast<const sockaddr*>(&address),
+                 sizeof(address)) < 0 ||
+            chmod(socketPath.c_str(), 0600) < 0 || listen(fd, 64) < 0)
         {
-            spdlog::critical("ConfigurationManager initialization failed");
-            throw std::runtime_error(
-                "ConfigurationManager initialization failed: " +
-                std::string(e.what()));
+            const std::string reason = strerror(errno);
+            close(fd);
+            throw std::runtime_error("Failed to listen on " + socketPath +
+                                     ": " + reason);
         }
+        return fd;
     }
 
-    ~ConfigurationManager()
+    void closeDescriptors()
     {
-        if (connection)
+        for (int* fd : {&listenFd, &wakeFd, &epollFd})
         {
-            connection->releaseName(serviceName);
+            if (*fd >= 0)
+            {
+                close(*fd);
+                *fd = -1;
+            }
         }
     }
 
-    void initialize()
+    void watch(int fd, uint32_t events, int operation = EPOLL_CTL_ADD)
+    {
+        epoll_event event{};
+        event.events = events;
+        event.data.fd = fd;
+        if (epoll_ctl(epollFd, operation, fd, &event) < 0)
+        {
+            throw std::runtime_error("epoll_ctl failed: " +
+                                     std::string(strerror(errno)));
+        }
+    }
+
+    void wake()
     {
-        spdlog::debug("Creating D-Bus connection");
-        connection = sdbus::createSessionBusConnection(serviceName);
+        const uint64_t one = 1;
+        if (write(wakeFd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+        {
+            spdlog::error("Failed to wake native endpoint: {}",
+                          strerror(errno));
+        }
+    }
 
-        auto applicationsData = getApplicationsConfigs();
-        spdlog::info("Found {} application configs", applicationsData.size());
-        std::string applicationObjectPath = buildApplicationsObjectPath();
-        for (const auto& [path, name] : applicationsData)
+    void loop()
+    {
+        epoll_event events[64];
+        while (running)
         {
-            applicationObjectPath += name;
-            applicationsConfiguration[name] =
-                std::make_unique<ApplicationConfiguration>(
-                    *connection,
-                    static_cast<sdbus::ObjectPath>(applicationObjectPath), path,
-                    interfaceName);
+            int count = epoll_wait(epollFd, events, 64, -1);
+            if (count < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                spdlog::error("Native endpoint epoll_wait failed: {}",
+                              strerror(errno));
+                return;
+            }
+            for (int i = 0; i < count; ++i)
+            {
+                const int fd = events[i].data.fd;
+                if (fd == listenFd)
+                {
+                    acceptClients();
+                }
+                else if (fd == wakeFd)
+                {
+                    uint64_t ignored;
+                    if (read(wakeFd, &ignored, sizeof(ignored)) < 0 &&
+                        errno != EAGAIN)
+                    {
+                        spdlog::error("Failed to read wake event: {}",
+                                      strerror(errno));
+                    }
+                    deliverChanges();
+                    deliverUpdates();
+                }
+                else
+                {
+                    serveClient(fd, events[i].events);
+                }
+            }
         }
     }
 
-    std::vector<std::pair<std::string, std::string>>
-    getApplicationsConfigs() const
+    void acceptClients()
     {
-        spdlog::debug("Scanning config directory: {}", configDir);
-        std::vector<std::pair<std::string, std::string>> applicationsData;
-        std::string actualConfigDir = configDir;
-        if (actualConfigDir.find("~/") == 0)
-        { // Maybe too much but why not ^_^
-            const char* home = std::getenv("HOME");
-            if (!home)
+        for (;;)
+        {
+            int fd = accept4(listenFd, nullptr, nullptr,
+                             SOCK_CLOEXEC | SOCK_NONBLOCK);
+            if (fd < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                if (errno != EAGAIN && errno != EWOULDBLOCK)
+                {
+                    spdlog::error("Native endpoint accept failed: {}",
+                                  strerror(errno));
+                }
+                return;
+            }
+            try
+            {
+                watch(fd, EPOLLIN);
+            }
+            catch (const std::exception& e)
             {
-                throw std::runtime_error("HOME environment variable not set");
+                spdlog::error("Cannot serve native client: {}", e.what());
+                close(fd);
+                continue;
             }
-            actualConfigDir.replace(0, 1, home);
+            auto client = std::make_unique<Client>();
+            client->fd = fd;
+            client->id = nextClientId++;
+            clients.emplace(fd, std::move(client));
+            spdlog::debug("Native client {} connected", fd);
         }
+    }
+
+    void serveClient(int fd, uint32_t events)
+    {
+        auto it = clients.find(fd);
+        if (it == clients.end())
+        {
+            return;
+        }
+        Client& client = *it->second;
         try
         {
-            for (const auto& entry : fs::directory_iterator(actualConfigDir))
+            bool open = true;
+            if (client.events & EPOLLIN)
             {
-                if (entry.is_regular_file() &&
-                    entry.path().extension() == ".json")
+                if (events & (EPOLLIN | EPOLLHUP | EPOLLERR))
                 {
-                    applicationsData.emplace_back(entry.path().string(),
-                                                  entry.path().stem().string());
+                    open = receive(client);
                 }
             }
+            else if (events & (EPOLLHUP | EPOLLERR))
+            {
+                // Not being read, so nothing else would notice the hangup.
+                open = false;
+            }
+            if (!serve(client) || !open)
+            {
+                disconnect(client);
+            }
         }
-        catch (const fs::filesystem_error& e)
+        catch (const std::exception& e)
         {
-            throw std::runtime_error("Error accessing config directory: " +
-                                     std::string(e.what()));
+            spdlog::warn("Dropping native client {}: {}", fd, e.what());
+            disconnect(client);
         }
+    }
 
-        if (applicationsData.empty())
+    // Reads what is available up to maxPendingInput; returns false once the
+    // peer closed.
+    bool receive(Client& client)
+    {
+        uint8_t buffer[64 * 1024];
+        while (client.input.size() < maxPendingInput)
         {
-            throw std::runtime_error("No valid configuration files found in " +
-                                     actualConfigDir);
+            ssize_t r =
+                recv(client.fd, buffer,
+                     std::min(sizeof(buffer),
+                              maxPendingInput - client.input.size()),
+                     0);
+            if (r > 0)
+            {
+                client.input.insert(client.input.end(), buffer, buffer + r);
+                continue;
+            }
+            if (r < 0 && errno == EINTR)
+                continue;
+            if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                return true;
+            return false;
         }
-        spdlog::debug("Found {} valid config files", applicationsData.size());
-        return applicationsData;
+        return true;
     }
 
-    std::string buildApplicationsObjectPath() const
+    // Handles buffered requests and sends their replies for as long as the
+    // socket takes them. Returns false if the client has to be dropped.
+    bool serve(Client& client)
     {
-        std::string path = "/" + serviceName;
-        std::replace(path.begin(), path.end(), '.', '/');
-        return path + "/Application/";
+        for (;;)
+        {
+            const bool backlogged = !handleRequests(client);
+            if (!flush(client))
+            {
+                return false;
+            }
+            if (!backlogged || !client.output.empty())
+            {
+                return true;
+            }
+        }
     }
 
-    const std::string configDir{"~/com.system.configurationManager/"};
-    const sdbus::ServiceName serviceName{"com.system.configurationManager"};
-    const sdbus::InterfaceName interfaceName{
-        "com.system.configurationManager.Application.Configuration"};
-    std::unique_ptr<sdbus::IConnection> connection;
-    std::unordered_map<std::string, std::unique_ptr<ApplicationConfiguration>>
-        applicationsConfiguration;
-};
+    // Returns false if it stopped because too many replies are waiting.
+    bool handleRequests(Client& client)
+    {
+        size_t offset = 0;
+        nlohmann::json request;
+        bool backlogged = false;
+        while (!client.changing)
+        {
+            if (pendingOutput(client) >= maxReplyBacklog)
+            {
+                backlogged = true;
+                break;
+            }
+            if (!native_protocol::takeFrame(client.input, offset, request))
+            {
+                break;
+            }
+            if (request.is_object() && request.contains("type") &&
+                request["type"] == "change-batch")
+            {
+                submitChange(client, std::move(request));
+                continue;
+            }
+            if (!native_protocol::appendReply(client.output,
+                                              execute(client, request)) &&
+                request.value("type", "") == "subscribe" &&
+                client.subscriptions.erase(request.value("application", "")))
+            {
+                --subscriptionCount;
+            }
+        }
+        client.input.erase(client.input.begin(),
+                           client.input.begin() + offset);
+        return !backlogged;
+    }
 
-int main()
-{
-    initialize_logging();
-    try
+    static size_t pendingOutput(const Client& client)
+    {
+        return client.output.size() - client.outputOffset;
+    }
+
+    // Output queued behind the frame being sent.
+    static size_t queuedOutput(Client& client)
     {
-        spdlog::info("Starting ConfigurationManager");
-        auto& manager = ConfigurationManager::getInstance();
-        manager.run();
-        spdlog::info("ConfigurationManager running");
-        while (1)
+        while (client.frameEnd <= client.outputOffset &&
+               client.frameEnd < client.output.size())
         {
+            const uint8_t* header = client.output.data() + client.frameEnd;
+            client.frameEnd += 4 + ((size_t{header[0]} << 24) |
+                                    (size_t{header[1]} << 16) |
+                                    (size_t{header[2]} << 8) | header[3]);
         }
+        return client.output.size() -
+               std::min(client.frameEnd, client.output.size());
     }
-    catch (const std::exception& e)
+
+    void submitChange(Client& client, nlohmann::json request)
     {
-        spdlog::critical("Fatal error: {}", e.what());
-        return 1;
+        client.changing = true;
+        changeThread->post(
+            [this, fd = client.fd, id = client.id,
+             request = std::move(request)]()
+            {
+                CompletedChange completed{fd, id, {}};
+                native_protocol::appendReply(completed.reply,
+                                             executeChange(request));
+                {
+                    std::lock_guard<std::mutex> lock(updatesMutex);
+                    completedChanges.push_back(std::move(completed));
+                }
+                wake();
+            });
     }
-    return 0;
-}
\ No newline at end of file
+
+    // Runs on the change thread.
+    nlohmann::json executeChange(const nlohmann::json& request)
+    {
+        nlohmann::json reply = nlohmann::json::object();
+        if (request.contains("id"))
+        {
+            reply["id"] = request["id"];
+        }
+        try
+        {
+            const auto name = request.at("application").get<std::string>();
+            auto* application = lookup(name);
+            if (!application)
+            {
+                throw std::invalid_argument("Unknown application " + name);
+            }
+            config_dict changes;
+            for (const auto& [key, encoded] : request.at("changes").items())
+            {
+                changes.emplace(key, sync_protocol::decodeValue(encoded));
+            }
+            reply["version"] = application->changeConfiguration(changes);
+        }
+        catch (const std::exception& e)
+        {
+            reply["error"] = e.what();
+        }
+        return reply;
+    }
+
+    // Queues the replies of applied changes and resumes their clients.
+    void deliverChanges()
+    {
+        std::vector<CompletedChange> completed;
+        {
+            std::lock_guard<std::mutex> lock(updatesMutex);
+            completed.swap(completedChanges);
+        }
+        for (auto& change : completed)
+        {
+            auto it = clients.find(change.fd);
+            if (it == clients.end() || it->second->id != change.client)
+            {
+                continue;
+            }
+            Client& client = *it->second;
+            client.output.insert(client.output.end(), change.reply.begin(),
+                                 change.reply.end());
+            client.changing = false;
+            try
+            {
+                if (!serve(client))
+                {
+                    disconnect(client);
+                }
+            }
+            catch (const std::exception& e)
+            {
+                spdlog::warn("Dropping native client {}: {}", change.fd,
+                             e.what());
+                disconnect(client);
+            }
+        }
+    }
+
+    nlohmann::json execute(Client& client, const nlohmann::json& request)
+    {
+        nlohmann::json reply = nlohmann::json::object();
+        if (request.contains("id"))
+        {
+            reply["id"] = request["id"];
+        }
+        try
+        {
+            const auto type = request.at("type").get<std::string>();
+            const auto name = request.at("application").get<std::string>();
+            if (type == "unsubscribe")
+            {
+                if (client.subscriptions.erase(name))
+                {
+                    --subscriptionCount;
+                }
+                return reply;
+            }
+            auto* application = lookup(name);
+            if (!application)
+            {
+                throw std::invalid_argument("Unknown application " + name);
+            }
+            uint64_t version = 0;
+            if (type == "get")
+            {
+                const auto key = request.at("key").get<std::string>();
+                auto values = application->getResolvedValues({key}, version);
+                if (values.empty())
+                {
+                    throw std::invalid_argument("Unknown key " + key);
+                }
+                auto encoded =
+                    sync_protocol::encodeValue(values.begin()->second);
+                if (!encoded)
+                {
+                    throw std::invalid_argument("Cannot encode " + key);
+                }
+                reply["value"] = std::move(*encoded);
+            }
+            else if (type == "get-many")
+            {
+                std::vector<std::string> keys;
+                if (request.contains("keys"))
+                {
+                    keys = request["keys"].get<std::vector<std::string>>();
+                    if (keys.empty())
+                    {
+                        reply["version"] = application->getVersion();
+                        reply["values"] = nlohmann::json::object();
+                        return reply;
+                    }
+                }
+                auto values = application->getResolvedValues(keys, version);
+                reply["version"] = version;
+                reply["values"] = encodeValues(values);
+            }
+            else if (type == "subscribe")
+            {
+                // Counted before the snapshot, so no later change is lost.
+                if (client.subscriptions.insert(name).second)
+                {
+                    ++subscriptionCount;
+                }
+                auto values = application->getResolvedValues({}, version);
+                reply["generation"] = generation;
+                reply["version"] = version;
+                reply["values"] = encodeValues(values);
+            }
+            else
+            {
+                throw std::invalid_argument("Unknown request type " + type);
+            }
+        }
+        catch (const std::exception& e)
+        {
+            reply["error"] = e.what();
+        }
+        return reply;
+    }
+
+    static nlohmann::json encodeValues(const config_dict& values)
+    {
+        nlohmann::json encoded = nlohmann::json::object();
+        for (const auto& [key, value] : values)
+        {
+            if (auto encodedValue = sync_protocol::encodeValue(value))
+            {
+                encoded[key] = std::move(*encodedValue);
+            }
+        }
+        return encoded;
+    }
+
+    void deliverUpdates()
+    {
+        std::vector<std::pair<std::string, std::vector<uint8_t>>> updates;
+        {
+            std::lock_guard<std::mutex> lock(updatesMutex);
+            updates.swap(pendingUpdates);
+        }
+        if (updates.empty())
+        {
+            return;
+        }
+        std::vector<Client*> dropped;
+        for (const auto& [fd, client] : clients)
+        {
+            bool queued = false;
+            for (const auto& [application, frame] : updates)
+            {
+                if (client->subscriptions.count(application))
+                {
+                    client->output.insert(client->output.end(), frame.begin(),
+                                          frame.end());
+                    queued = true;
+                }
+            }
+            if (!queued)
+            {
+                continue;
+            }
+            try
+            {
+                if (!flush(*client))
+                {
+                    dropped.push_back(client.get());
+                }
+            }
+            catch (const std::exception& e)
+            {
+                spdlog::warn("Dropping native client {}: {}", fd, e.what());
+                dropped.push_back(client.get());
+            }
+        }
+        for (auto* client : dropped)
+        {
+            disconnect(*client);
+        }
+    }
+
+    // Writes as much output as the socket takes and waits for EPOLLOUT for
+    // the rest. Returns false if the client has to be dropped.
+    bool flush(Client& client)
+    {
+        while (client.outputOffset < client.output.size())
+        {
+            ssize_t r =
+                send(client.fd, client.output.data() + client.outputOffset,
+                     client.output.size() - client.outputOffset, MSG_NOSIGNAL);
+            if (r < 0 && errno == EINTR)
+                continue;
+            if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                break;
+            if (r <= 0)
+                return false;
+            client.outputOffset += static_cast<size_t>(r);
+        }
+        if (client.outputOffset == client.output.size())
+        {
+            client.output.clear();
+            client.outputOffset = 0;
+            client.frameEnd = 0;
+        }
+        else if (queuedOutput(client) > maxPendingOutput)
+        {
+            spdlog::warn("Native client {} is not reading, dropping it",
+                         client.fd);
+            return false;
+        }
+        // Reading stops while a change is applied, while replies pile up
+        // and while the input buffer is full.
+        uint32_t events = 0;
+        if (!client.changing && pendingOutput(client) < maxReplyBacklog &&
+            client.input.size() < maxPendingInput)
+        {
+            events |= EPOLLIN;
+        }
+        if (!client.output.empty())
+        {
+            events |= EPOLLOUT;
+        }
+        if (events != client.events)
+        {
+            watch(client.fd, events, EPOLL_CTL_MOD);
+            client.events = events;
+        }
+        return true;
+    }
+
+    void disconnect(Client& client)
+    {
+        const int fd = client.fd;
+        subscriptionCount -= client.subscriptions.size();
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+        close(fd);
+        clients.erase(fd);
+        spdlog::debug("Native client {} disconnected", fd);
+    }
+
+    const std::string socketPath;
+    const uint64_t generation;
+    const application_lookup lookup;
+    int listenFd{-1};
+    int epollFd{-1};
+    // Wakes the loop for queued updates and for stop().
+    int wakeFd{-1};
+    std::atomic<bool> running{false};
+    std::thread thread;
+
+    // Only touched by the loop thread.
+    std::unordered_map<int, std::unique_ptr<Client>> clients;
+    uint64_t nextClientId{0};
+    std::unique_ptr<ThreadExecutor> changeThread =
+        std::make_unique<ThreadExecutor>();
+
+    std::atomic<size_t> subscriptionCount{0};
+    std::mutex updatesMutex;
+    std::vector<std::pair<std::string, std::vector<uint8_t>>> pendingUpdates;
+    std::vector<CompletedChange> completedChanges;
+};
+
+enum class RegistrationMode
+{
+    // One D-Bus object with its own vtable per application.
+    PerObject,
+    // A single fallback vtable under the applications path, with applications
+    // resolved through a hash index on lookup.
+    Fallback
+};
+
+struct ManagerOptions
+{
+    // Where configurations are loaded from.
+    StoreOptions store;
+    RegistrationMode registrationMode{RegistrationMode::PerObject};
+    std::string serviceName{"com.system.configurationManager"};
+    // Anti-entropy: socket this manager serves its Merkle tree on, and the
+    // socket of a peer manager to pull differences from every interval.
+    std::string syncSocket;
+    std::string syncPeer;
+    std::chrono::seconds syncInterval{30};
+    // Restart handoff: socket a successor can take the state over from, and
+    // the socket of a running manager to take over from instead of parsing.
+    std::string handoffSocket;
+    std::string takeOver;
+    // Directory every application's configuration is published to as a
+    // single-application bundle, for clients without a bus connection.
+    std::string publishDir;
+    // Unix socket that clients can connect to directly, speaking D-Bus
+    // without going through the bus daemon.
+    std::string peerSocket;
+    // Unix socket serving the native binary protocol (nativeProtocol.hpp).
+    std::string nativeSocket;
+    // Event-loop lag: how often it is sampled and from when it is logged.
+    std::chrono::milliseconds loopLagInterval{250};
+    std::chrono::milliseconds loopLagThreshold{100};
+    // Well-known name of the read lane: a connection and event loop of its
+    // own, serving read-only mirrors of the applications.
+    std::string readServiceName;
+    // Emit the signals of a change made on the bus before answering it, as
+    // callers of ChangeConfiguration could rely on before.
+    bool signalsBeforeReply{false};
+};
+
+// One configuration set served under its own bus name on its own
+// connection. A process may run any number of them; they share `executor`
+// for parsing and reloading, `keys` for their change logs and `watchdog`,
+// which every manager's event loop has to keep alive.
+class ConfigurationManager
+{
+  public:
+    ConfigurationManager(const ManagerOptions& options,
+                         std::shared_ptr<Executor> executor,
+                         std::shared_ptr<KeyTable> keys,
+                         std::shared_ptr<SystemdWatchdog> watchdog)
+        : store(options.store, std::move(executor), std::move(keys)),
+          registrationMode(options.registrationMode),
+          serviceName(options.serviceName),
+          signalEmitter(
+              std::make_unique<LoopExecutor>(options.signalsBeforeReply)),
+          syncSocket(options.syncSocket), syncPeer(options.syncPeer),
+          syncInterval(options.syncInterval),
+          handoffSocket(options.handoffSocket), takeOver(options.takeOver),
+          publishDir(options.publishDir), peerSocket(options.peerSocket),
+          nativeSocket(options.nativeSocket),
+          loopMonitor(std::make_unique<EventLoopMonitor>(
+              options.serviceName, options.loopLagInterval,
+              options.loopLagThreshold, watchdog)),
+          readServiceName(options.readServiceName)
+    {
+        try
+        {
+            spdlog::debug("Initializing ConfigurationManager {}",
+                          std::string(serviceName));
+            if (!readServiceName.empty())
+            {
+                readMonitor = std::make_unique<EventLoopMonitor>(
+                    readServiceName, options.loopLagInterval,
+                    options.loopLagThreshold, watchdog);
+            }
+            initialize();
+            spdlog::info("ConfigurationManager {} initialized successfully",
+                         std::string(serviceName));
+        }
+        catch (const std::exception& e)
+        {
+            spdlog::critical("ConfigurationManager {} initialization failed",
+                             std::string(serviceName));
+            throw std::runtime_error(
+                "ConfigurationManager initialization failed: " +
+                std::string(e.what()));
+        }
+    }
+
+    ~ConfigurationManager()
+    {
+        stopNative();
+        stopPeers();
+        stopSync();
+        stopEventLoop();
+        if (connection && ownsName)
+        {
+            connection->releaseName(serviceName);
+        }
+    }
+
+    ConfigurationManager(const ConfigurationManager&) = delete;
+    ConfigurationManager& operator=(const ConfigurationManager&) = delete;
+    ConfigurationManager(ConfigurationManager&&) = delete;
+    ConfigurationManager& operator=(ConfigurationManager&&) = delete;
+
+    std::vector<std::string> getApplicationNames() const
+    {
+        return store.getApplicationNames();
+    }
+
+    void run()
+    {
+        if (!connection)
+        {
+            throw std::runtime_error("D-Bus connection not initialized");
+        }
+        startEventLoop();
+        startReadLane();
+        startSync();
+        startPeers();
+        startNative();
+    }
+
+    void stop()
+    {
+        stopNative();
+        stopPeers();
+        stopSync();
+        stopEventLoop();
+    }
+
+    void reload() { store.reload(); }
+
+  private:
+    // One client connected to --peer-socket.
+    struct PeerSession
+    {
+        std::unique_ptr<sdbus::IConnection> bus;
+        // Signals for this peer, sent by its own loop.
+        LoopExecutor emitter;
+        std::thread thread;
+        std::atomic<bool> finished{false};
+    };
+
+    void initialize()
+    {
+        const auto start = std::chrono::steady_clock::now();
+        std::unique_ptr<sync_protocol::Connection> predecessor;
+        if (!takeOver.empty())
+        {
+            predecessor = std::make_unique<sync_protocol::Connection>(takeOver);
+            uint64_t generation = 0;
+            auto handedOver = receiveHandoff(*predecessor, generation);
+            store.load(handedOver, generation);
+            spdlog::info("Took over {} applications from {}",
+                         handedOver.size(), takeOver);
+        }
+        else
+        {
+            store.load();
+        }
+        applicationsConfiguration.reserve(store.applications().size());
+
+        const std::string applicationsObjectPath =
+            buildApplicationsObjectPath();
+        if (registrationMode == RegistrationMode::Fallback)
+        {
+            initializeFallbackRegistration(applicationsObjectPath);
+        }
+        else
+        {
+            spdlog::debug("Creating D-Bus connection");
+            connection = sdbus::createSessionBusConnection();
+        }
+
+        for (const auto& [name, application] : store.applications())
+        {
+            // Schemas hold in both registration modes, for changes from any
+            // transport and for reloads.
+            application->setValidator(createSchemaValidator(name));
+            sdbus::ObjectPath objectPath{applicationsObjectPath + name};
+            if (registrationMode == RegistrationMode::Fallback)
+            {
+                applicationsConfiguration[name] =
+                    std::make_unique<ApplicationConfiguration>(
+                        fallbackBus, objectPath, interfaceName, *application,
+                        *signalEmitter);
+            }
+            else
+            {
+                applicationsConfiguration[name] =
+                    std::make_unique<ApplicationConfiguration>(
+                        *connection, objectPath, interfaceName, *application,
+                        *signalEmitter);
+            }
+            application->setContentHashListener(
+                [this, name = name](uint64_t hash)
+                { merkleTree.update(name, hash); });
+        }
+
+        registerStats();
+        setUpReadLane();
+        startPublishing();
+
+        // Only claim the names once every object is reachable.
+        if (predecessor)
+        {
+            completeHandoff(*predecessor, start);
+        }
+        else
+        {
+            connection->requestName(serviceName);
+            if (readConnection)
+            {
+                readConnection->requestName(
+                    sdbus::ServiceName{readServiceName});
+            }
+        }
+        ownsName = true;
+    }
+
+    // Successor side: the predecessor stops accepting changes, then sends
+    // its generation and every application's state.
+    std::unordered_map<std::string, ApplicationState>
+    receiveHandoff(sync_protocol::Connection& predecessor, uint64_t& generation)
+    {
+        auto header = predecessor.request({{"type", "handoff"}});
+        // Keeping the generation lets clients continue from their versions.
+        generation = header.at("generation").get<uint64_t>();
+        const auto count = header.at("applications").get<size_t>();
+
+        std::unordered_map<std::string, ApplicationState> states;
+        states.reserve(count);
+        for (size_t i = 0; i < count; ++i)
+        {
+            auto frame = predecessor.receive();
+            ApplicationState state;
+            state.configPath = frame.at("configPath").get<std::string>();
+            state.version = frame.at("version").get<uint64_t>();
+            for (const auto& entry : frame.at("changeLog"))
+            {
+                state.changeLog.emplace_back(entry.at(0).get<uint64_t>(),
+                                             entry.at(1).get<std::string>());
+            }
+            for (const auto& [key, encoded] : frame.at("values").items())
+            {
+                state.values.emplace(key, decodeHandoffValue(encoded));
+            }
+            // Values too large for the frame follow in pieces.
+            const auto pieces = frame.value("pieces", size_t{0});
+            std::vector<uint8_t> buffered;
+            for (size_t piece = 0; piece < pieces; ++piece)
+            {
+                auto next = predecessor.receive();
+                const auto& bytes = next.at("piece").get_binary();
+                buffered.insert(buffered.end(), bytes.begin(), bytes.end());
+                if (!next.at("more").get<bool>())
+                {
+                    auto value = nlohmann::json::from_cbor(buffered);
+                    state.values.emplace(next.at("key").get<std::string>(),
+                                         decodeHandoffValue(value));
+                    buffered.clear();
+                }
+            }
+            // Predecessors that predate write times send none.
+            state.writeTimes =
+                frame.value("writeTimes", std::map<std::string, uint64_t>{});
+            states.emplace(frame.at("name").get<std::string>(),
+                           std::move(state));
+        }
+        return states;
+    }
+
+    // Predecessors that predate pieces send values without the CBOR wrap.
+    static sdbus::Variant decodeHandoffValue(const nlohmann::json& encoded)
+    {
+        if (!encoded.is_binary())
+        {
+            return sync_protocol::decodeValue(encoded);
+        }
+        return sync_protocol::decodeValue(nlohmann::json::from_cbor(
+            static_cast<const std::vector<uint8_t>&>(encoded.get_binary())));
+    }
+
+    // Queues for the names behind the predecessor, which releases them once
+    // we are queued; the bus then passes ownership straight to us.
+    void completeHandoff(sync_protocol::Connection& predecessor,
+                         std::chrono::steady_clock::time_point start)
+    {
+        queueForName(*connection, serviceName);
+        if (readConnection)
+        {
+            queueForName(*readConnection, readServiceName);
+        }
+        predecessor.request({{"type", "queued"}});
+        spdlog::info("Handoff from {} complete in {} ms ({} bytes)", takeOver,
+                     std::chrono::duration_cast<std::chrono::milliseconds>(
+                         std::chrono::steady_clock::now() - start)
+                         .count(),
+                     predecessor.transferred());
+    }
+
+    static void queueForName(sdbus::IConnection& bus, const std::string& name)
+    {
+        auto daemon = sdbus::createProxy(
+            bus, sdbus::ServiceName{"org.freedesktop.DBus"},
+            sdbus::ObjectPath{"/org/freedesktop/DBus"});
+        uint32_t reply = 0;
+        daemon->callMethod("RequestName")
+            .onInterface("org.freedesktop.DBus")
+            .withArguments(name, uint32_t{0})
+            .storeResultsTo(reply);
+        // 1: primary owner already, 2: queued behind the predecessor.
+        if (reply != 1 && reply != 2)
+        {
+            throw std::runtime_error("Could not queue for " + name);
+        }
+    }
+
+    void registerStats()
+    {
+        using counters_struct = sdbus::Struct<uint64_t, uint64_t, uint64_t>;
+        std::string path = "/" + serviceName;
+        std::replace(path.begin(), path.end(), '.', '/');
+        statsObject =
+            sdbus::createObject(*connection, sdbus::ObjectPath{path});
+        statsObject
+            ->addVTable(
+                sdbus::registerMethod("GetAllocationStats")
+                    .implementedAs(
+                        []()
+                        {
+                            std::map<std::string, counters_struct> result;
+                            for (const auto& [operation, counters] :
+                                 allocationReport())
+                            {
+                                result[operation] = counters_struct{
+                                    counters.allocations, counters.bytes,
+                                    counters.deallocations};
+                            }
+                            return result;
+                        }),
+                sdbus::registerMethod("GetEventLoopLag")
+                    .implementedAs([this]()
+                                   { return loopMonitor->getHistogram(); }),
+                sdbus::registerMethod("GetReadEventLoopLag")
+                    .implementedAs(
+                        [this]()
+                        {
+                            return readMonitor ? readMonitor->getHistogram()
+                                               : std::map<uint64_t, uint64_t>{};
+                        }),
+                sdbus::registerProperty("AllocationTracking")
+                    .withGetter([]() { return allocationTrackingEnabled; }))
+            .forInterface(statsInterfaceName);
+    }
+
+    // The connection's event loop runs on its own thread, driven by poll()
+    // so that the lag monitor's timer is dispatched along with the bus.
+    void startEventLoop()
+    {
+        loopStopFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (loopStopFd < 0)
+        {
+            throw std::runtime_error("Failed to create eventfd: " +
+                                     std::string(strerror(errno)));
+        }
+        loopThread = std::thread(
+            [this]()
+            {
+                runEventLoop(serviceName, *connection, *loopMonitor,
+                             signalEmitter.get());
+            });
+    }
+
+    // Reads get a connection, name and event loop of their own, so they do
+    // not queue behind writes and signals on the primary connection, nor
+    // the other way round. The name is claimed along with the primary one.
+    void setUpReadLane()
+    {
+        if (readServiceName.empty())
+        {
+            return;
+        }
+        readConnection = sdbus::createSessionBusConnection();
+        const std::string applicationsObjectPath =
+            buildApplicationsObjectPath();
+        for (const auto& [name, application] : store.applications())
+        {
+            applicationMirrors.push_back(std::make_unique<ApplicationMirror>(
+                *readConnection,
+                sdbus::ObjectPath{applicationsObjectPath + name},
+                mirrorInterfaceName, *application));
+        }
+    }
+
+    void startReadLane()
+    {
+        if (!readConnection)
+        {
+            return;
+        }
+        readLoopThread = std::thread(
+            [this]()
+            {
+                runEventLoop(readServiceName, *readConnection, *readMonitor,
+                             nullptr);
+            });
+        spdlog::info("Serving {} read-only mirrors as {}",
+                     applicationMirrors.size(), readServiceName);
+    }
+
+    void stopEventLoop()
+    {
+        if (!loopThread.joinable())
+        {
+            return;
+        }
+        // Never read, so it stays readable for every loop.
+        const uint64_t one = 1;
+        if (write(loopStopFd, &one, sizeof(one)) < 0)
+        {
+            spdlog::error("Failed to stop the event loop: {}",
+                          strerror(errno));
+        }
+        loopThread.join();
+        if (readLoopThread.joinable())
+        {
+            readLoopThread.join();
+        }
+        close(loopStopFd);
+        loopStopFd = -1;
+        // Signals of the last changes still go out; nothing else uses the
+        // connection any more.
+        signalEmitter->runPending();
+    }
+
+    // Returns on stopEventLoop(). A broken connection ends the loop as well,
+    // which stops feeding the watchdog. `tasks` (optional) run after the
+    // pending messages are dispatched, so replies go out first.
+    void runEventLoop(const std::string& loopName, sdbus::IConnection& bus,
+                      EventLoopMonitor& monitor, LoopExecutor* tasks)
+    {
+        monitor.attachToCurrentThread();
+        if (tasks)
+        {
+            tasks->attachToCurrentThread();
+        }
+        try
+        {
+            for (;;)
+            {
+                while (bus.processPendingEvent())
+                {
+                }
+                if (tasks && tasks->runPending())
+                {
+                    // Flush what they sent before waiting.
+                    continue;
+                }
+                const auto pollData = bus.getEventLoopPollData();
+                pollfd fds[] = {{pollData.fd, pollData.events, 0},
+                                {pollData.eventFd, POLLIN, 0},
+                                {monitor.getFd(), POLLIN, 0},
+                                {loopStopFd, POLLIN, 0},
+                                {tasks ? tasks->getFd() : -1, POLLIN, 0}};
+                if (poll(fds, 5, pollData.getPollTimeout()) < 0 &&
+                    errno != EINTR)
+                {
+                    throw std::runtime_error("poll failed: " +
+                                             std::string(strerror(errno)));
+                }
+                if (fds[3].revents & POLLIN)
+                {
+                    break;
+                }
+                if (fds[2].revents & POLLIN)
+                {
+                    monitor.onTimer();
+                }
+            }
+        }
+        catch (const std::exception& e)
+        {
+            spdlog::critical("Event loop of {} stopped: {}", loopName,
+                             e.what());
+        }
+    }
+
+    void startSync()
+    {
+        {
+            std::lock_guard<std::mutex> lock(syncMutex);
+            syncRunning = true;
+        }
+        if (!handoffSocket.empty())
+        {
+            handoffListenFd = listenOnUnixSocket(handoffSocket);
+            handoffThread = std::thread([this]() { serveHandoff(); });
+            spdlog::info("Accepting a successor on {}", handoffSocket);
+        }
+        if (!syncSocket.empty())
+        {
+            syncListenFd = listenOnUnixSocket(syncSocket);
+            syncServerThread = std::thread([this]() { serveSync(); });
+            spdlog::info("Serving anti-entropy on {}", syncSocket);
+        }
+        if (!syncPeer.empty())
+        {
+            syncPeerThread = std::thread(
+                [this]()
+                {
+                    std::unique_lock<std::mutex> lock(syncMutex);
+                    while (syncRunning)
+                    {
+                        lock.unlock();
+                        try
+                        {
+                            pullFrom(syncPeer);
+                        }
+                        catch (const std::exception& e)
+                        {
+                            spdlog::warn("Anti-entropy with {} failed: {}",
+                                         syncPeer, e.what());
+                        }
+                        lock.lock();
+                        syncCondition.wait_for(lock, syncInterval,
+                                               [this]() { return !syncRunning; });
+                    }
+                });
+        }
+    }
+
+    void stopSync()
+    {
+        {
+            std::lock_guard<std::mutex> lock(syncMutex);
+            syncRunning = false;
+        }
+        syncCondition.notify_all();
+        // Wakes the accept() in serveSync() and serveHandoff().
+        if (syncListenFd >= 0)
+        {
+            shutdown(syncListenFd, SHUT_RDWR);
+        }
+        if (handoffListenFd >= 0)
+        {
+            shutdown(handoffListenFd, SHUT_RDWR);
+        }
+        if (handoffThread.joinable() &&
+            handoffThread.get_id() != std::this_thread::get_id())
+        {
+            handoffThread.join();
+        }
+        if (syncServerThread.joinable())
+        {
+            syncServerThread.join();
+        }
+        if (syncPeerThread.joinable())
+        {
+            syncPeerThread.join();
+        }
+        if (syncListenFd >= 0)
+        {
+            close(syncListenFd);
+            syncListenFd = -1;
+            unlink(syncSocket.c_str());
+        }
+        if (handoffListenFd >= 0)
+        {
+            close(handoffListenFd);
+            handoffListenFd = -1;
+            if (!handedOff)
+            {
+                unlink(handoffSocket.c_str());
+            }
+        }
+    }
+
+    static int listenOnUnixSocket(const std::string& path)
+    {
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0)
+        {
+            throw std::runtime_error("Failed to create socket: " +
+                                     std::string(strerror(errno)));
+        }
+        const auto address = sync_protocol::socketAddress(path);
+        unlink(path.c_str());
+        if (bind(fd, reinterpret_cast<const sockaddr*>(&address),
+                 sizeof(address)) < 0 ||
+            chmod(path.c_str(), 0600) < 0 || listen(fd, 8) < 0)
+        {
+            const std::string reason = strerror(errno);
+            close(fd);
+            throw std::runtime_error("Failed to listen on " + path + ": " +
+                                     reason);
+        }
+        return fd;
+    }
+
+    // Covers the successor registering every application and queueing for
+    // the names, while changes are frozen.
+    static constexpr time_t handoffTimeoutSeconds = 30;
+
+    // Waits for a successor; after a successful handoff the process stops
+    // as if it had received SIGTERM.
+    void serveHandoff()
+    {
+        for (;;)
+        {
+            int peer = accept4(handoffListenFd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (peer < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                std::lock_guard<std::mutex> lock(syncMutex);
+                if (syncRunning)
+                {
+                    spdlog::error("Handoff accept failed: {}", strerror(errno));
+                }
+                return;
+            }
+            // A successor that stalls must not keep changes frozen: the
+            // handoff is abandoned and the applications thawed below.
+            timeval timeout{handoffTimeoutSeconds, 0};
+            setsockopt(peer, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+                       sizeof(timeout));
+            setsockopt(peer, SOL_SOCKET, SO_SNDTIMEO, &timeout,
+                       sizeof(timeout));
+            bool done = false;
+            try
+            {
+                done = handOver(peer);
+            }
+            catch (const std::exception& e)
+            {
+                spdlog::warn("Handoff aborted: {}", e.what());
+            }
+            close(peer);
+            if (done)
+            {
+                kill(getpid(), SIGTERM);
+                return;
+            }
+            for (const auto& [_, application] : store.applications())
+            {
+                application->setFrozen(false);
+            }
+        }
+    }
+
+    static constexpr size_t handoffPieceSize = sync_protocol::maxFrameSize / 4;
+
+    // Appends one application's frame, followed by the pieces of the values
+    // that did not fit into it. Each value travels as its own CBOR encoding.
+    static void encodeHandoff(const std::string& name,
+                              const ApplicationState& state,
+                              std::vector<std::vector<uint8_t>>& frames)
+    {
+        nlohmann::json changeLog = nlohmann::json::array();
+        for (const auto& [changedVersion, key] : state.changeLog)
+        {
+            changeLog.push_back({changedVersion, key});
+        }
+        nlohmann::json values = nlohmann::json::object();
+        std::vector<std::vector<uint8_t>> pieces;
+        size_t inlineBytes = 0;
+        for (const auto& [key, value] : state.values)
+        {
+            auto encoded = sync_protocol::encodeValue(value);
+            if (!encoded)
+            {
+                const char* type = value.peekValueType();
+                throw std::runtime_error("cannot encode " + name + "." + key +
+                                         " of type " + (type ? type : "none"));
+            }
+            auto bytes = nlohmann::json::to_cbor(*encoded);
+            if (inlineBytes + bytes.size() <= handoffPieceSize)
+            {
+                inlineBytes += bytes.size();
+                values[key] = nlohmann::json::binary(std::move(bytes));
+                continue;
+            }
+            for (size_t offset = 0; offset < bytes.size();
+                 offset += handoffPieceSize)
+            {
+                const size_t end =
+                    std::min(bytes.size(), offset + handoffPieceSize);
+                pieces.push_back(sync_protocol::encodeFrame(
+                    {{"key", key},
+                     {"piece", nlohmann::json::binary(std::vector<uint8_t>(
+                                   bytes.begin() + offset,
+                                   bytes.begin() + end))},
+                     {"more", end < bytes.size()}}));
+            }
+        }
+        frames.push_back(
+            sync_protocol::encodeFrame({{"name", name},
+                                        {"configPath", state.configPath},
+                                        {"version", state.version},
+                                        {"changeLog", std::move(changeLog)},
+                                        {"values", std::move(values)},
+                                        {"writeTimes", state.writeTimes},
+                                        {"pieces", pieces.size()}}));
+        std::move(pieces.begin(), pieces.end(), std::back_inserter(frames));
+    }
+
+    // Predecessor side. Reads keep being served throughout; changes are
+    // rejected from the snapshot until the name has moved on.
+    bool handOver(int peer)
+    {
+        nlohmann::json request;
+        if (!sync_protocol::readFrame(peer, request) ||
+            request.value("type", "") != "handoff")
+        {
+            return false;
+        }
+        const auto start = std::chrono::steady_clock::now();
+        const auto& applications = store.applications();
+        for (const auto& [_, application] : applications)
+        {
+            application->setFrozen(true);
+        }
+        // Announce every change before the successor takes the name over.
+        runAll(*signalEmitter, 1, [](size_t) {});
+
+        // Everything is encoded before the first frame goes out: a value
+        // that cannot travel aborts the handoff instead of being lost.
+        // Values that do not fit beside the rest of their application
+        // follow it one at a time, split into pieces that fit a frame.
+        std::vector<std::vector<uint8_t>> frames;
+        try
+        {
+            for (const auto& [name, application] : applications)
+            {
+                encodeHandoff(name, application->exportState(), frames);
+            }
+        }
+        catch (const std::exception& e)
+        {
+            sync_protocol::writeFrame(peer, {{"error", e.what()}});
+            throw;
+        }
+        size_t bytes = sync_protocol::writeFrame(
+            peer, {{"type", "state"},
+                   {"generation", store.getGeneration()},
+                   {"applications", applications.size()}});
+        for (const auto& frame : frames)
+        {
+            bytes += sync_protocol::writeEncodedFrame(peer, frame);
+        }
+
+        nlohmann::json queued;
+        if (!sync_protocol::readFrame(peer, queued) ||
+            queued.value("type", "") != "queued")
+        {
+            throw std::runtime_error("Successor did not queue for the name");
+        }
+        connection->releaseName(serviceName);
+        if (readConnection)
+        {
+            readConnection->releaseName(sdbus::ServiceName{readServiceName});
+        }
+        ownsName = false;
+        // The successor binds the handoff socket itself once it is done.
+        handedOff = true;
+        unlink(handoffSocket.c_str());
+        sync_protocol::writeFrame(peer, {{"type", "released"}});
+        spdlog::info("Handed over {} applications ({} bytes), changes were "
+                     "paused for {} ms",
+                     applications.size(), bytes,
+                     std::chrono::duration_cast<std::chrono::milliseconds>(
+                         std::chrono::steady_clock::now() - start)
+                         .count());
+        return true;
+    }
+
+    // Peers are served one at a time; a session is a handful of requests.
+    void serveSync()
+    {
+        for (;;)
+        {
+            int peer = accept4(syncListenFd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (peer < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                std::lock_guard<std::mutex> lock(syncMutex);
+                if (syncRunning)
+                {
+                    spdlog::error("Anti-entropy accept failed: {}",
+                                  strerror(errno));
+                }
+                return;
+            }
+            timeval timeout{10, 0};
+            setsockopt(peer, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+                       sizeof(timeout));
+            try
+            {
+                nlohmann::json request;
+                while (sync_protocol::readFrame(peer, request))
+                {
+                    nlohmann::json reply;
+                    try
+                    {
+                        reply = handleSyncRequest(request);
+                    }
+                    catch (const std::exception& e)
+                    {
+                        reply = {{"error", e.what()}};
+                    }
+                    sync_protocol::writeFrame(peer, reply);
+                }
+            }
+            catch (const std::exception& e)
+            {
+                spdlog::warn("Anti-entropy session ended: {}", e.what());
+            }
+            close(peer);
+        }
+    }
+
+    nlohmann::json handleSyncRequest(const nlohmann::json& request) const
+    {
+        const auto type = request.at("type").get<std::string>();
+        if (type == "root")
+        {
+            return {{"root", merkleTree.root()}};
+        }
+        if (type == "buckets")
+        {
+            return {{"buckets", merkleTree.buckets()}};
+        }
+        if (type == "applications")
+        {
+            return {{"applications",
+                     merkleTree.applicationsIn(
+                         request.at("buckets").get<std::vector<size_t>>())}};
+        }
+
+        const auto name = request.at("application").get<std::string>();
+        auto* application = store.find(name);
+        if (!application)
+        {
+            throw std::runtime_error("Unknown application " + name);
+        }
+        if (type == "keys")
+        {
+            return {{"keys", application->getEntryHashes()}};
+        }
+        if (type == "values")
+        {
+            std::map<std::string, uint64_t> writeTimes;
+            nlohmann::json values = nlohmann::json::object();
+            std::vector<std::string> unencodable;
+            for (const auto& [key, value] : application->getValuesForSync(
+                     request.at("keys").get<std::vector<std::string>>(),
+                     &writeTimes))
+            {
+                if (auto encoded = sync_protocol::encodeValue(value))
+                {
+                    values[key] = std::move(*encoded);
+                    continue;
+                }
+                // The key keeps differing on every round until its type
+                // can be transferred.
+                const char* valueType = value.peekValueType();
+                spdlog::error("Anti-entropy: cannot send {}.{} of type {}",
+                              name, key, valueType ? valueType : "none");
+                unencodable.push_back(key);
+                writeTimes.erase(key);
+            }
+            return {{"values", std::move(values)},
+                    {"writeTimes", std::move(writeTimes)},
+                    {"unencodable", std::move(unencodable)}};
+        }
+        throw std::runtime_error("Unknown request " + type);
+    }
+
+    // One anti-entropy round: walks down the peer's Merkle tree only where
+    // it differs from ours and, for differing keys, adopts the peer's value
+    // where it was written later than ours (last writer wins). Applications
+    // or keys only we know are reported, not removed.
+    void pullFrom(const std::string& peerSocket)
+    {
+        sync_protocol::Connection peer(peerSocket);
+        if (peer.request({{"type", "root"}})["root"].get<uint64_t>() ==
+            merkleTree.root())
+        {
+            spdlog::debug("Anti-entropy with {}: in sync ({} bytes)",
+                          peerSocket, peer.transferred());
+            return;
+        }
+
+        const auto remoteBuckets =
+            peer.request({{"type", "buckets"}})["buckets"]
+                .get<std::vector<uint64_t>>();
+        const auto localBuckets = merkleTree.buckets();
+        std::vector<size_t> differingBuckets;
+        for (size_t i = 0;
+             i < localBuckets.size() && i < remoteBuckets.size(); ++i)
+        {
+            if (localBuckets[i] != remoteBuckets[i])
+            {
+                differingBuckets.push_back(i);
+            }
+        }
+
+        const auto remoteApplications =
+            peer.request({{"type", "applications"},
+                          {"buckets", differingBuckets}})["applications"]
+                .get<std::map<std::string, uint64_t>>();
+        const auto localApplications =
+            merkleTree.applicationsIn(differingBuckets);
+
+        size_t repairedApplications = 0;
+        size_t repairedKeys = 0;
+        for (const auto& [name, remoteHash] : remoteApplications)
+        {
+            auto local = localApplications.find(name);
+            if (local == localApplications.end())
+            {
+                spdlog::warn("Anti-entropy: {} only exists on {}", name,
+                             peerSocket);
+                continue;
+            }
+            if (local->second == remoteHash)
+            {
+                continue;
+            }
+
+            auto* application = store.find(name);
+            if (!application)
+            {
+                continue;
+            }
+            const auto remoteKeys =
+                peer.request({{"type", "keys"}, {"application", name}})["keys"]
+                    .get<std::map<std::string, uint64_t>>();
+            const auto localKeys = application->getEntryHashes();
+            std::vector<std::string> differingKeys;
+            for (const auto& [key, hash] : remoteKeys)
+            {
+                auto it = localKeys.find(key);
+                if (it == localKeys.end() || it->second != hash)
+                {
+                    differingKeys.push_back(key);
+                }
+            }
+            for (const auto& [key, _] : localKeys)
+            {
+                if (!remoteKeys.count(key))
+                {
+                    spdlog::warn("Anti-entropy: {}.{} only exists locally",
+                                 name, key);
+                }
+            }
+            if (differingKeys.empty())
+            {
+                continue;
+            }
+
+            const auto reply = peer.request({{"type", "values"},
+                                             {"application", name},
+                                             {"keys", differingKeys}});
+            for (const auto& key : reply.value("unencodable",
+                                               std::vector<std::string>{}))
+            {
+                spdlog::error("Anti-entropy: {} cannot send {}.{}", peerSocket,
+                              name, key);
+            }
+            const auto writeTimes = reply.value(
+                "writeTimes", std::map<std::string, uint64_t>{});
+            size_t adopted = 0;
+            for (const auto& [key, encoded] : reply.at("values").items())
+            {
+                auto written = writeTimes.find(key);
+                try
+                {
+                    if (application->mergeValue(
+                            key, sync_protocol::decodeValue(encoded),
+                            written == writeTimes.end() ? 0 : written->second))
+                    {
+                        ++adopted;
+                    }
+                }
+                catch (const std::exception& e)
+                {
+                    spdlog::error("Anti-entropy: cannot apply {}.{}: {}", name,
+                                  key, e.what());
+                }
+            }
+            repairedKeys += adopted;
+            if (adopted)
+            {
+                ++repairedApplications;
+            }
+        }
+        for (const auto& [name, _] : localApplications)
+        {
+            if (!remoteApplications.count(name))
+            {
+                spdlog::warn("Anti-entropy: {} does not exist on {}", name,
+                             peerSocket);
+            }
+        }
+
+        spdlog::info("Anti-entropy with {}: repaired {} keys in {} "
+                     "applications, {} buckets differed, {} bytes exchanged",
+                     peerSocket, repairedKeys, repairedApplications,
+                     differingBuckets.size(), peer.transferred());
+    }
+
+    void initializeFallbackRegistration(const std::string& applicationsObjectPath)
+    {
+        static const sd_bus_vtable fallbackVTable[] = {
+            SD_BUS_VTABLE_START(0),
+            SD_BUS_METHOD("GetConfiguration", "", "a{sv}",
+                          &ConfigurationManager::fallbackGetConfiguration,
+                          SD_BUS_VTABLE_UNPRIVILEGED),
+            SD_BUS_METHOD("GetConfigurationSince", "tt", "tttba{sv}",
+                          &ConfigurationManager::fallbackGetConfigurationSince,
+                          SD_BUS_VTABLE_UNPRIVILEGED),
+            SD_BUS_METHOD("GetValue", "s", "h",
+                          &ConfigurationManager::fallbackGetValue,
+                          SD_BUS_VTABLE_UNPRIVILEGED),
+            SD_BUS_METHOD("ChangeConfiguration", "sv", "",
+                          &ConfigurationManager::fallbackChangeConfiguration,
+                          SD_BUS_VTABLE_UNPRIVILEGED),
+            SD_BUS_SIGNAL("configurationChanged", "a{sv}", 0),
+            SD_BUS_SIGNAL("configurationUpdated", "ttta{sv}", 0),
+            SD_BUS_PROPERTY("ContentHash", "t",
+                            &ConfigurationManager::fallbackGetContentHash, 0,
+                            0),
+            SD_BUS_VTABLE_END};
+
+        spdlog::debug("Creating D-Bus connection with fallback vtable");
+        int r = sd_bus_open_user(&fallbackBus);
+        if (r < 0)
+        {
+            throw std::runtime_error("Failed to open session bus: " +
+                                     std::string(strerror(-r)));
+        }
+        // sd-bus wants the prefix without the trailing slash.
+        fallbackPrefix = applicationsObjectPath.substr(
+            0, applicationsObjectPath.size() - 1);
+        r = sd_bus_add_fallback_vtable(
+            fallbackBus, nullptr, fallbackPrefix.c_str(), interfaceName.c_str(),
+            fallbackVTable, &ConfigurationManager::findApplication, this);
+        if (r >= 0)
+        {
+            r = sd_bus_add_node_enumerator(
+                fallbackBus, nullptr, fallbackPrefix.c_str(),
+                &ConfigurationManager::enumerateApplications, this);
+        }
+        if (r < 0)
+        {
+            sd_bus_unref(fallbackBus);
+            fallbackBus = nullptr;
+            throw std::runtime_error("Failed to register fallback vtable: " +
+                                     std::string(strerror(-r)));
+        }
+        // The connection takes ownership of the bus and drives its event loop.
+        connection = sdbus::createBusConnection(fallbackBus);
+    }
+
+    static int findApplication(sd_bus*, const char* path, const char*,
+                               void* userdata, void** found, sd_bus_error*)
+    {
+        auto* self = static_cast<ConfigurationManager*>(userdata);
+        std::string_view objectPath(path);
+        if (objectPath.size() <= self->fallbackPrefix.size() + 1 ||
+            objectPath.compare(0, self->fallbackPrefix.size(),
+                               self->fallbackPrefix) != 0)
+        {
+            return 0;
+        }
+        objectPath.remove_prefix(self->fallbackPrefix.size() + 1);
+        auto it =
+            self->applicationsConfiguration.find(std::string(objectPath));
+        if (it == self->applicationsConfiguration.end())
+        {
+            return 0;
+        }
+        *found = it->second.get();
+        return 1;
+    }
+
+    static int enumerateApplications(sd_bus*, const char*, void* userdata,
+                                     char*** nodes, sd_bus_error*)
+    {
+        auto* self = static_cast<ConfigurationManager*>(userdata);
+        const auto& applications = self->applicationsConfiguration;
+        auto** result = static_cast<char**>(
+            calloc(applications.size() + 1, sizeof(char*)));
+        if (!result)
+        {
+            return -ENOMEM;
+        }
+        size_t i = 0;
+        try
+        {
+            for (const auto& [name, _] : applications)
+            {
+                result[i] =
+                    strdup((self->fallbackPrefix + "/" + name).c_str());
+                if (!result[i])
+                {
+                    break;
+                }
+                ++i;
+            }
+        }
+        catch (const std::bad_alloc&)
+        {
+        }
+        if (i < applications.size())
+        {
+            // A list cut short at a null entry would hide applications.
+            for (size_t j = 0; j < i; ++j)
+            {
+                free(result[j]);
+            }
+            free(result);
+            return -ENOMEM;
+        }
+        *nodes = result;
+        return 0;
+    }
+
+    static int fallbackGetConfiguration(sd_bus_message* call, void* userdata,
+                                        sd_bus_error* error)
+    {
+        auto& application =
+            static_cast<ApplicationConfiguration*>(userdata)->getStore();
+        EventLoopMonitor::HandlerScope handler("GetConfiguration");
+        try
+        {
+            sd_bus_message* raw = nullptr;
+            int r = sd_bus_message_new_method_return(call, &raw);
+            if (r < 0)
+            {
+                return r;
+            }
+            sd_bus_message_ptr reply(raw, &sd_bus_message_unref);
+            AllocationScope scope(AllocationOperation::Get);
+            appendConfiguration(reply.get(), application.getConfiguration());
+            return sd_bus_send(nullptr, reply.get(), nullptr);
+        }
+        catch (const std::exception& e)
+        {
+            return sd_bus_error_set(error, SD_BUS_ERROR_FAILED, e.what());
+        }
+    }
+
+    static int fallbackGetConfigurationSince(sd_bus_message* call,
+                                             void* userdata,
+                                             sd_bus_error* error)
+    {
+        auto& application =
+            static_cast<ApplicationConfiguration*>(userdata)->getStore();
+        EventLoopMonitor::HandlerScope handler("GetConfigurationSince");
+        try
+        {
+            uint64_t clientGeneration = 0;
+            uint64_t clientVersion = 0;
+            int r = sd_bus_message_read(call, "tt", &clientGeneration,
+                                        &clientVersion);
+            if (r < 0)
+            {
+                return r;
+            }
+            sd_bus_message* raw = nullptr;
+            r = sd_bus_message_new_method_return(call, &raw);
+            if (r < 0)
+            {
+                return r;
+            }
+            sd_bus_message_ptr reply(raw, &sd_bus_message_unref);
+            AllocationScope scope(AllocationOperation::Get);
+            auto [generation, version, hash, complete, values] =
+                application.getConfigurationSince(clientGeneration,
+                                                   clientVersion);
+            r = sd_bus_message_append(reply.get(), "tttb", generation, version,
+                                      hash, static_cast<int>(complete));
+            if (r < 0)
+            {
+                return r;
+            }
+            appendConfiguration(reply.get(), values);
+            return sd_bus_send(nullptr, reply.get(), nullptr);
+        }
+        catch (const std::exception& e)
+        {
+            return sd_bus_error_set(error, SD_BUS_ERROR_FAILED, e.what());
+        }
+    }
+
+    static int fallbackGetContentHash(sd_bus*, const char*, const char*,
+                                      const char*, sd_bus_message* reply,
+                                      void* userdata, sd_bus_error*)
+    {
+        auto& application =
+            static_cast<ApplicationConfiguration*>(userdata)->getStore();
+        return sd_bus_message_append(reply, "t",
+                                     application.getContentHash());
+    }
+
+    static int fallbackGetValue(sd_bus_message* call, void* userdata,
+                                sd_bus_error* error)
+    {
+        auto& application =
+            static_cast<ApplicationConfiguration*>(userdata)->getStore();
+        EventLoopMonitor::HandlerScope handler("GetValue");
+        try
+        {
+            const char* key = nullptr;
+            int r = sd_bus_message_read_basic(call, 's', &key);
+            if (r < 0)
+            {
+                return r;
+            }
+            auto blob = application.getValue(key);
+            return sd_bus_reply_method_return(call, "h", blob->fd());
+        }
+        catch (const std::invalid_argument& e)
+        {
+            return sd_bus_error_set(error, SD_BUS_ERROR_INVALID_ARGS,
+                                    e.what());
+        }
+        catch (const std::exception& e)
+        {
+            return sd_bus_error_set(error, SD_BUS_ERROR_FAILED, e.what());
+        }
+    }
+
+    static int fallbackChangeConfiguration(sd_bus_message* call,
+                                           void* userdata, sd_bus_error* error)
+    {
+        auto& application =
+            static_cast<ApplicationConfiguration*>(userdata)->getStore();
+        EventLoopMonitor::HandlerScope handler("ChangeConfiguration");
+        try
+        {
+            const char* key = nullptr;
+            int r = sd_bus_message_read_basic(call, 's', &key);
+            if (r < 0)
+            {
+                return r;
+            }
+            application.changeConfiguration(key, readVariant(call));
+            return sd_bus_reply_method_return(call, "");
+        }
+        catch (const std::invalid_argument& e)
+        {
+            return sd_bus_error_set(error, SD_BUS_ERROR_INVALID_ARGS,
+                                    e.what());
+        }
+        catch (const std::exception& e)
+        {
+            return sd_bus_error_set(error, SD_BUS_ERROR_FAILED, e.what());
+        }
+    }
+
+    void startPeers()
+    {
+        if (peerSocket.empty())
+        {
+            return;
+        }
+        peerStopFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (peerStopFd < 0)
+        {
+            throw std::runtime_error("Failed to create eventfd: " +
+                                     std::string(strerror(errno)));
+        }
+        peerListenFd = listenOnUnixSocket(peerSocket);
+        peersRunning = true;
+        peerAcceptThread = std::thread([this]() { servePeers(); });
+        spdlog::info("Accepting direct D-Bus connections on {}", peerSocket);
+    }
+
+    void stopPeers()
+    {
+        if (peerListenFd < 0)
+        {
+            return;
+        }
+        peersRunning = false;
+        // Wakes the accept() in servePeers() and every peer's poll().
+        shutdown(peerListenFd, SHUT_RDWR);
+        const uint64_t stop = 1;
+        if (write(peerStopFd, &stop, sizeof(stop)) < 0)
+        {
+            spdlog::error("Failed to stop peers: {}", strerror(errno));
+        }
+        if (peerAcceptThread.joinable())
+        {
+            peerAcceptThread.join();
+        }
+        {
+            std::lock_guard<std::mutex> lock(peersMutex);
+            for (auto& session : peers)
+            {
+                session->thread.join();
+            }
+            peers.clear();
+        }
+        close(peerListenFd);
+        peerListenFd = -1;
+        close(peerStopFd);
+        peerStopFd = -1;
+        unlink(peerSocket.c_str());
+    }
+
+    // Each peer gets its own server-mode connection with every application
+    // exported on it, run by a thread of its own.
+    void servePeers()
+    {
+        for (;;)
+        {
+            int peer = accept4(peerListenFd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (peer < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                if (peersRunning)
+                {
+                    spdlog::error("Peer accept failed: {}", strerror(errno));
+                }
+                return;
+            }
+            std::lock_guard<std::mutex> lock(peersMutex);
+            reapPeers();
+            try
+            {
+                auto session = std::make_unique<PeerSession>();
+                // Takes over the socket; the connection closes it.
+                session->bus = sdbus::createServerBus(peer);
+                auto* served = session.get();
+                session->thread =
+                    std::thread([this, served]() { servePeer(*served); });
+                peers.push_back(std::move(session));
+            }
+            catch (const std::exception& e)
+            {
+                spdlog::warn("Failed to set up peer connection: {}", e.what());
+            }
+        }
+    }
+
+    // Expects peersMutex to be held.
+    void reapPeers()
+    {
+        auto done = std::partition(peers.begin(), peers.end(),
+                                   [](const auto& session)
+                                   { return !session->finished; });
+        for (auto it = done; it != peers.end(); ++it)
+        {
+            (*it)->thread.join();
+        }
+        peers.erase(done, peers.end());
+    }
+
+    // The connection's event loop, driven by poll() so that a peer hanging
+    // up ends this thread instead of the process.
+    void servePeer(PeerSession& session)
+    {
+        try
+        {
+            for (const auto& [_, application] : applicationsConfiguration)
+            {
+                application->attachPeer(*session.bus, session.emitter);
+            }
+            spdlog::info("Peer connected, {} applications exported",
+                         applicationsConfiguration.size());
+            session.emitter.attachToCurrentThread();
+            for (;;)
+            {
+                while (session.bus->processPendingEvent())
+                {
+                }
+                if (session.emitter.runPending())
+                {
+                    continue;
+                }
+                const auto pollData = session.bus->getEventLoopPollData();
+                pollfd fds[] = {{pollData.fd, pollData.events, 0},
+                                {pollData.eventFd, POLLIN, 0},
+                                {peerStopFd, POLLIN, 0},
+                                {session.emitter.getFd(), POLLIN, 0}};
+                if (poll(fds, 4, pollData.getPollTimeout()) < 0 &&
+                    errno != EINTR)
+                {
+                    throw std::runtime_error("poll failed: " +
+                                             std::string(strerror(errno)));
+                }
+                if (fds[2].revents & POLLIN)
+                {
+                    break;
+                }
+            }
+        }
+        catch (const std::exception& e)
+        {
+            spdlog::info("Peer disconnected: {}", e.what());
+        }
+        for (const auto& [_, application] : applicationsConfiguration)
+        {
+            application->detachPeer(*session.bus);
+        }
+        session.finished = true;
+    }
+
+    void startNative()
+    {
+        if (nativeSocket.empty())
+        {
+            return;
+        }
+        nativeEndpoint = std::make_unique<NativeEndpoint>(
+            nativeSocket, store.getGeneration(),
+            [this](const std::string& name) { return store.find(name); });
+        for (const auto& [name, application] : store.applications())
+        {
+            nativeSubscriptions.emplace_back(
+                application.get(),
+                application->subscribe(
+                    [this, name = name, &applicationStore = *application](
+                        uint64_t version, uint64_t hash,
+                        const config_dict& changed)
+                    {
+                        nativeEndpoint->notifyUpdated(
+                            name, version, hash,
+                            applicationStore.resolve(changed));
+                    }));
+        }
+        nativeEndpoint->start();
+        spdlog::info("Serving the native protocol on {}", nativeSocket);
+    }
+
+    void stopNative()
+    {
+        if (!nativeEndpoint)
+        {
+            return;
+        }
+        for (const auto& [application, subscription] : nativeSubscriptions)
+        {
+            application->unsubscribe(subscription);
+        }
+        nativeSubscriptions.clear();
+        nativeEndpoint.reset();
+    }
+
+    void startPublishing()
+    {
+        if (publishDir.empty())
+        {
+            return;
+        }
+        fs::create_directories(publishDir);
+        for (const auto& [name, application] : store.applications())
+        {
+            application->setPublisher(
+                [this, name = name](uint64_t version, const config_dict& values)
+                { publishApplication(name, version, values); });
+        }
+        spdlog::info("Published {} applications to {}",
+                     store.applications().size(), publishDir);
+    }
+
+    // The directory is expected on tmpfs (a runtime directory), so files
+    // are renamed into place without syncing them to disk.
+    void publishApplication(const std::string& name, uint64_t version,
+                            const config_dict& values) const
+    {
+        const auto image = encodeConfigurationBundle(
+            std::vector<BundleApplication<config_dict>>{
+                {name, &values, version, store.getGeneration()}});
+        writeFileAtomically(
+            (fs::path(publishDir) / (name + configurationBundleExtension))
+                .string(),
+            image, false);
+    }
+
+    std::string buildApplicationsObjectPath() const
+    {
+        std::string path = "/" + serviceName;
+        std::replace(path.begin(), path.end(), '.', '/');
+        return path + "/Application/";
+    }
+
+    // Declared first, so that it outlives every front end and endpoint.
+    ConfigurationStore store;
+    const RegistrationMode registrationMode;
+    const sdbus::ServiceName serviceName;
+    const sdbus::InterfaceName interfaceName{
+        "com.system.configurationManager.Application.Configuration"};
+    const sdbus::InterfaceName mirrorInterfaceName{
+        "com.system.configurationManager.Application.Mirror"};
+    const sdbus::InterfaceName statsInterfaceName{
+        "com.system.configurationManager.Stats"};
+    // Owned by `connection` once the fallback registration is set up.
+    sd_bus* fallbackBus{nullptr};
+    std::string fallbackPrefix;
+    std::unique_ptr<sdbus::IConnection> connection;
+    std::unique_ptr<sdbus::IObject> statsObject;
+    std::unordered_map<std::string, std::unique_ptr<ApplicationConfiguration>>
+        applicationsConfiguration;
+    // Emits the applications' signals on the loop thread of `connection`,
+    // after the change was answered. Declared after them, so that it goes
+    // first with whatever is still queued.
+    std::unique_ptr<LoopExecutor> signalEmitter;
+
+    // Anti-entropy
+    MerkleTree merkleTree;
+    const std::string syncSocket;
+    const std::string syncPeer;
+    const std::chrono::seconds syncInterval;
+    std::mutex syncMutex;
+    std::condition_variable syncCondition;
+    bool syncRunning{false};
+    int syncListenFd{-1};
+    std::thread syncServerThread;
+    std::thread syncPeerThread;
+
+    // Restart handoff
+    const std::string handoffSocket;
+    const std::string takeOver;
+    int handoffListenFd{-1};
+    std::thread handoffThread;
+    std::atomic<bool> ownsName{false};
+    std::atomic<bool> handedOff{false};
+
+    const std::string publishDir;
+
+    // Peer-to-peer D-Bus
+    const std::string peerSocket;
+    int peerListenFd{-1};
+    // Readable once every peer should disconnect.
+    int peerStopFd{-1};
+    std::atomic<bool> peersRunning{false};
+    std::thread peerAcceptThread;
+    std::mutex peersMutex;
+    std::vector<std::unique_ptr<PeerSession>> peers;
+
+    const std::string nativeSocket;
+    std::unique_ptr<NativeEndpoint> nativeEndpoint;
+    std::vector<std::pair<ApplicationStore*, uint64_t>> nativeSubscriptions;
+
+    // Dispatch thread of `connection` and its lag monitor
+    std::unique_ptr<EventLoopMonitor> loopMonitor;
+    // Readable once every event loop should stop.
+    int loopStopFd{-1};
+    std::thread loopThread;
+
+    // Read lane
+    const std::string readServiceName;
+    std::unique_ptr<sdbus::IConnection> readConnection;
+    std::vector<std::unique_ptr<ApplicationMirror>> applicationMirrors;
+    std::unique_ptr<EventLoopMonitor> readMonitor;
+    std::thread readLoopThread;
+};
+
+int main(int argc, char* argv[])
+{
+    initialize_logging();
+    try
+    {
+        ManagerOptions options;
+        std::string registration = "per-object";
+        bool verbose = false;
+
+        CLI::App app{"Configuration Manager"};
+        app.add_option("--config-dir", options.store.configDir,
+                       "Directory with application JSON configs")
+            ->default_val(options.store.configDir);
+
+        app.add_option("--bundle", options.store.bundle,
+                       "Compiled configuration bundle to load instead of "
+                       "--config-dir")
+            ->check(CLI::ExistingFile);
+
+        app.add_option("--registration", registration,
+                       "D-Bus object registration mode")
+            ->check(CLI::IsMember({"per-object", "fallback"}))
+            ->default_val("per-object");
+
+        app.add_option("--blob-threshold", options.store.blobThreshold,
+                       "Byte strings of at least this size are stored in "
+                       "sealed memfds")
+            ->check(CLI::PositiveNumber)
+            ->default_val(options.store.blobThreshold);
+
+        app.add_option("--service-name", options.serviceName,
+                       "Well-known bus name, to run several managers")
+            ->default_val(options.serviceName);
+
+        app.add_option("--sync-socket", options.syncSocket,
+                       "Unix socket to serve anti-entropy requests on");
+
+        app.add_option("--sync-peer", options.syncPeer,
+                       "Anti-entropy socket of a manager to pull changes from");
+
+        auto* handoffOption = app.add_option(
+            "--handoff-socket", options.handoffSocket,
+            "Unix socket a restarted manager takes the state over from");
+
+        auto* takeOverOption = app.add_option(
+            "--take-over", options.takeOver,
+            "Handoff socket of the running manager to replace");
+
+        app.add_option("--publish-dir", options.publishDir,
+                       "Directory to publish every application's "
+                       "configuration to for bus-less readers");
+
+        app.add_option("--peer-socket", options.peerSocket,
+                       "Unix socket for direct D-Bus connections that bypass "
+                       "the bus daemon");
+
+        app.add_option("--native-socket", options.nativeSocket,
+                       "Unix socket serving the native binary protocol");
+
+        std::vector<std::string> tenants;
+        // Only the first manager's state is handed over, so a restart would
+        // silently reset every tenant.
+        app.add_option("--tenant", tenants,
+                       "Another manager to run in this process, as "
+                       "<service-name>=<config-dir>; repeatable")
+            ->excludes(handoffOption)
+            ->excludes(takeOverOption);
+
+        size_t threads = std::max(1u, std::thread::hardware_concurrency());
+        app.add_option("--threads", threads,
+                       "Worker threads shared by all managers for parsing "
+                       "and reloading")
+            ->check(CLI::PositiveNumber)
+            ->default_val(threads);
+
+        int64_t syncInterval = options.syncInterval.count();
+        app.add_option("--sync-interval", syncInterval,
+                       "Seconds between anti-entropy rounds with --sync-peer")
+            ->check(CLI::PositiveNumber)
+            ->default_val(syncInterval);
+
+        int64_t loopLagInterval = options.loopLagInterval.count();
+        app.add_option("--loop-lag-interval-ms", loopLagInterval,
+                       "Milliseconds between event-loop lag samples")
+            ->check(CLI::PositiveNumber)
+            ->default_val(loopLagInterval);
+
+        int64_t loopLagThreshold = options.loopLagThreshold.count();
+        app.add_option("--loop-lag-threshold-ms", loopLagThreshold,
+                       "Event-loop lag in milliseconds from which the slowest "
+                       "handler is logged")
+            ->check(CLI::PositiveNumber)
+            ->default_val(loopLagThreshold);
+
+        app.add_option("--read-service-name", options.readServiceName,
+                       "Bus name serving read-only mirrors of the "
+                       "applications on a connection of its own");
+
+        app.add_flag("--signals-before-reply", options.signalsBeforeReply,
+                     "Emit the signals of a change before answering it");
+
+        app.add_flag("-v,--verbose", verbose, "Enable verbose logging");
+
+        CLI11_PARSE(app, argc, argv);
+
+        if (verbose)
+        {
+            spdlog::set_level(spdlog::level::debug);
+            spdlog::debug("Verbose logging enabled");
+        }
+        options.syncInterval = std::chrono::seconds(syncInterval);
+        options.loopLagInterval = std::chrono::milliseconds(loopLagInterval);
+        options.loopLagThreshold = std::chrono::milliseconds(loopLagThreshold);
+        if (registration == "fallback")
+        {
+            options.registrationMode = RegistrationMode::Fallback;
+        }
+
+        // Tenants share the registration mode, blob threshold, signal
+        // emission and lag monitoring; sockets, the read lane and publishing
+        // belong to the first manager only.
+        std::vector<ManagerOptions> managerOptions{options};
+        for (const auto& tenant : tenants)
+        {
+            const auto separator = tenant.find('=');
+            if (separator == std::string::npos || separator == 0 ||
+                separator + 1 == tenant.size())
+            {
+                throw std::runtime_error("Invalid --tenant " + tenant +
+                                         ", expected "
+                                         "<service-name>=<config-dir>");
+            }
+            ManagerOptions tenantOptions;
+            tenantOptions.store.configDir = tenant.substr(separator + 1);
+            tenantOptions.store.blobThreshold = options.store.blobThreshold;
+            tenantOptions.registrationMode = options.registrationMode;
+            tenantOptions.serviceName = tenant.substr(0, separator);
+            tenantOptions.loopLagInterval = options.loopLagInterval;
+            tenantOptions.loopLagThreshold = options.loopLagThreshold;
+            tenantOptions.signalsBeforeReply = options.signalsBeforeReply;
+            managerOptions.push_back(std::move(tenantOptions));
+        }
+
+        // Block termination signals before any thread is started, so they
+        // are only ever delivered to the sigwait() below.
+        sigset_t signals;
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGINT);
+        sigaddset(&signals, SIGTERM);
+        sigaddset(&signals, SIGHUP);
+        pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+        auto executor = std::make_shared<ThreadPoolExecutor>(threads);
+        auto keys = std::make_shared<KeyTable>();
+        auto watchdog = std::make_shared<SystemdWatchdog>();
+        std::vector<std::unique_ptr<ConfigurationManager>> managers;
+        for (const auto& instanceOptions : managerOptions)
+        {
+            spdlog::info("Starting ConfigurationManager {}",
+                         instanceOptions.serviceName);
+            managers.push_back(std::make_unique<ConfigurationManager>(
+                instanceOptions, executor, keys, watchdog));
+        }
+        for (auto& manager : managers)
+        {
+            manager->run();
+        }
+        spdlog::info("{} ConfigurationManager instances running",
+                     managers.size());
+
+        int signal = 0;
+        while (sigwait(&signals, &signal) == 0 && signal == SIGHUP)
+        {
+            spdlog::info("Received SIGHUP, reloading configurations");
+            for (auto& manager : managers)
+            {
+                manager->reload();
+            }
+        }
+        spdlog::info("Received signal {}, stopping", signal);
+        for (auto& manager : managers)
+        {
+            manager->stop();
+        }
+    }
+    catch (const std::exception& e)
+    {
+        spdlog::critical("Fatal error: {}", e.what());
+        return 1;
+    }
+    return 0;
+}
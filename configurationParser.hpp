@@ -0,0 +1,188 @@
+#pragma once
+
+#include "configurationArena.hpp"
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <nlohmann/json.hpp>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// File formats a configuration can be stored in, chosen by extension.
+enum class ConfigurationFormat
+{
+    Json,
+    Cbor,
+    MessagePack
+};
+
+inline bool configurationFormatFromExtension(const std::string& extension,
+                                             ConfigurationFormat& format)
+{
+    if (extension == ".json")
+        format = ConfigurationFormat::Json;
+    else if (extension == ".cbor")
+        format = ConfigurationFormat::Cbor;
+    else if (extension == ".msgpack")
+        format = ConfigurationFormat::MessagePack;
+    else
+        return false;
+    return true;
+}
+
+// SAX handler that emplaces the members of a flat top-level object straight
+// into a configuration arena, without building a json DOM first.
+//
+// Integers become `x` unless they only fit an unsigned 64-bit value (`t`),
+// floats `d`, strings `s`, booleans `b` and CBOR/MessagePack byte strings
+// `ay`. Nested objects, arrays and null are rejected.
+class ConfigurationSaxHandler
+    : public nlohmann::json_sax<nlohmann::json>
+{
+  public:
+    explicit ConfigurationSaxHandler(configuration_values& values,
+                                     binary_sink binarySink = nullptr)
+        : values(values), binarySink(std::move(binarySink))
+    {
+    }
+
+    bool null() override { return unsupported("null"); }
+
+    bool boolean(bool value) override { return store(sdbus::Variant(value)); }
+
+    bool number_integer(number_integer_t value) override
+    {
+        return store(sdbus::Variant(static_cast<int64_t>(value)));
+    }
+
+    bool number_unsigned(number_unsigned_t value) override
+    {
+        if (value <= static_cast<uint64_t>(std::numeric_limits<int64_t>::max()))
+        {
+            return store(sdbus::Variant(static_cast<int64_t>(value)));
+        }
+        return store(sdbus::Variant(static_cast<uint64_t>(value)));
+    }
+
+    bool number_float(number_float_t value, const string_t&) override
+    {
+        return store(sdbus::Variant(static_cast<double>(value)));
+    }
+
+    bool string(string_t& value) override
+    {
+        return store(sdbus::Variant(value));
+    }
+
+    bool binary(binary_t& value) override
+    {
+        const std::vector<uint8_t>& bytes = value;
+        if (binarySink)
+        {
+            return store(binarySink(currentKey, bytes));
+        }
+        return store(sdbus::Variant(bytes));
+    }
+
+    bool start_object(std::size_t) override
+    {
+        if (depth++ != 0)
+        {
+            return unsupported("object");
+        }
+        return true;
+    }
+
+    bool end_object() override
+    {
+        --depth;
+        return true;
+    }
+
+    bool start_array(std::size_t) override
+    {
+        if (depth == 0)
+        {
+            throw std::runtime_error("Config root must be an object");
+        }
+        return unsupported("array");
+    }
+
+    bool end_array() override { return true; }
+
+    bool key(string_t& value) override
+    {
+        currentKey = value;
+        return true;
+    }
+
+    bool parse_error(std::size_t, const std::string&,
+                     const nlohmann::detail::exception& e) override
+    {
+        throw std::runtime_error(e.what());
+    }
+
+  private:
+    bool store(sdbus::Variant value)
+    {
+        if (depth == 0)
+        {
+            throw std::runtime_error("Config root must be an object");
+        }
+        // Later duplicates win, as with the json DOM.
+        auto it = values.find(std::string_view(currentKey));
+        if (it != values.end())
+        {
+            it->second = std::move(value);
+        }
+        else
+        {
+            values.emplace(std::string_view(currentKey), std::move(value));
+        }
+        return true;
+    }
+
+    bool unsupported(const char* type) const
+    {
+        throw std::runtime_error("Unsupported type for variant conversion (" +
+                                 std::string(type) + ") at key '" +
+                                 currentKey + "'");
+    }
+
+    configuration_values& values;
+    binary_sink binarySink;
+    std::string currentKey;
+    int depth{0};
+};
+
+// Parses `path` in the given format into `values`.
+inline void parseConfigurationFile(const std::string& path,
+                                   ConfigurationFormat format,
+                                   configuration_values& values,
+                                   const binary_sink& binarySink = nullptr)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+    {
+        throw std::runtime_error("Could not open config file");
+    }
+
+    ConfigurationSaxHandler handler(values, binarySink);
+    switch (format)
+    {
+    case ConfigurationFormat::Json:
+        nlohmann::json::sax_parse(file, &handler);
+        break;
+    case ConfigurationFormat::Cbor:
+        nlohmann::json::sax_parse(file, &handler,
+                                  nlohmann::json::input_format_t::cbor);
+        break;
+    case ConfigurationFormat::MessagePack:
+        nlohmann::json::sax_parse(file, &handler,
+                                  nlohmann::json::input_format_t::msgpack);
+        break;
+    }
+}
@@ -0,0 +1,1087 @@
+#include "configurationStore.hpp"
+#include "allocationTracker.hpp"
+#include "configurationBundle.hpp"
+#include "configurationParser.hpp"
+#include "sealedBlob.hpp"
+#include "variantUtils.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <random>
+#include <spdlog/spdlog.h>
+#include <stdexcept>
+#include <string_view>
+#include <unordered_set>
+
+namespace fs = std::filesystem;
+
+// Nanoseconds since the epoch; write times are compared across hosts.
+static uint64_t wallClockNow()
+{
+    return static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch())
+            .count());
+}
+
+// Equal blob handles only mean equal sizes and hashes.
+static bool sameBlob(const configuration_blobs& blobs, const std::string& key,
+                     const SealedBlob& candidate)
+{
+    auto stored = blobs.find(key);
+    return stored != blobs.end() && stored->second->sameContent(candidate);
+}
+
+static uint64_t hashConfiguration(const configuration_values& values)
+{
+    uint64_t hash = 0;
+    for (const auto& [key, value] : values)
+    {
+        hash += configurationEntryHash(key, value);
+    }
+    return hash;
+}
+
+ApplicationStore::ApplicationStore(const std::string& name,
+                                   const std::string& configPath,
+                                   uint64_t generation, size_t blobThreshold,
+                                   KeyTable& keys,
+                                   const ApplicationState* state,
+                                   const ConfigurationBundle* bundle)
+    : name(name), configPath(configPath), generation(generation),
+      blobThreshold(blobThreshold), keys(keys)
+{
+    spdlog::debug("Loading {} from {}", name, configPath);
+    load(state, bundle);
+}
+
+ApplicationStore::~ApplicationStore() = default;
+
+void ApplicationStore::changeConfiguration(const std::string& key,
+                                           const sdbus::Variant& val)
+{
+    changeConfiguration(config_dict{{key, val}});
+}
+
+uint64_t ApplicationStore::changeConfiguration(const config_dict& changes)
+{
+    size_t applied = 0;
+    return applyChanges(changes, nullptr, applied);
+}
+
+bool ApplicationStore::mergeValue(const std::string& key,
+                                  const sdbus::Variant& value,
+                                  uint64_t writeTime)
+{
+    size_t applied = 0;
+    applyChanges(config_dict{{key, value}}, &writeTime, applied);
+    return applied > 0;
+}
+
+uint64_t ApplicationStore::applyChanges(const config_dict& changes,
+                                        const uint64_t* remoteWriteTime,
+                                        size_t& applied)
+{
+    AllocationScope scope(AllocationOperation::Change);
+    if (changes.empty())
+    {
+        throw std::invalid_argument("No changes given");
+    }
+    for (const auto& [key, val] : changes)
+    {
+        spdlog::debug("Changing configuration key: {}", key);
+        if (key.empty())
+        {
+            throw std::invalid_argument("Key cannot be empty");
+        }
+        if (val.isEmpty())
+        {
+            throw std::invalid_argument("Value cannot be empty");
+        }
+        if (validator)
+        {
+            validator(key, val);
+        }
+    }
+
+    // Large values are moved into sealed memfds before taking the lock;
+    // the dictionary then only holds their blob handles. One with the same
+    // content as the stored blob is skipped first, so re-asserting a large
+    // value creates and copies nothing.
+    std::vector<std::shared_ptr<const SealedBlob>> unchangedBlobs(
+        changes.size());
+    std::vector<std::shared_ptr<const SealedBlob>> blobs;
+    blobs.reserve(changes.size());
+    size_t index = 0;
+    for (const auto& [key, val] : changes)
+    {
+        const char* type = val.peekValueType();
+        if (std::strcmp(type, "h") == 0 || std::strcmp(type, "ay") == 0)
+        {
+            auto stored = findBlob(key);
+            if (stored && blobMatches(*stored, val))
+            {
+                unchangedBlobs[index] = std::move(stored);
+            }
+        }
+        blobs.push_back(unchangedBlobs[index] ? nullptr : toBlob(key, val));
+        ++index;
+    }
+
+    uint64_t changedVersion = 0;
+    uint64_t changedHash = 0;
+    config_dict changed;
+    {
+        std::lock_guard<std::mutex> lock(configurationMutex);
+        if (frozen)
+        {
+            throw std::runtime_error(
+                "Configuration is being handed over, retry later");
+        }
+        auto& values = configuration->values();
+        auto blob = blobs.begin();
+        auto unchangedBlob = unchangedBlobs.begin();
+        const uint64_t now = wallClockNow();
+        for (const auto& [key, val] : changes)
+        {
+            auto& keyBlob = *blob++;
+            if (const auto& unchanged = *unchangedBlob++)
+            {
+                auto current = configuration->blobs().find(key);
+                if (current != configuration->blobs().end() &&
+                    current->second == unchanged)
+                {
+                    spdlog::debug("Configuration key {} unchanged", key);
+                    continue;
+                }
+                // Replaced since it was compared, so store it after all.
+                keyBlob = toBlob(key, val);
+            }
+            const sdbus::Variant stored =
+                keyBlob ? sdbus::Variant(keyBlob->handle()) : val;
+            auto it = values.find(std::string_view(key));
+            auto written = writeTimes.find(key);
+            const uint64_t localWriteTime =
+                written == writeTimes.end() ? 0 : written->second;
+            if (it != values.end())
+            {
+                // Re-asserting the current value must not wake subscribers.
+                if (variantEquals(it->second, stored) &&
+                    (!keyBlob || sameBlob(configuration->blobs(), key,
+                                          *keyBlob)))
+                {
+                    spdlog::debug("Configuration key {} unchanged", key);
+                    continue;
+                }
+                // Last writer wins; equal times go to the higher entry hash,
+                // so that both sides pick the same value.
+                if (remoteWriteTime &&
+                    (*remoteWriteTime < localWriteTime ||
+                     (*remoteWriteTime == localWriteTime &&
+                      configurationEntryHash(key, stored) <=
+                          configurationEntryHash(key, it->second))))
+                {
+                    spdlog::debug("Keeping the newer local value of {}", key);
+                    continue;
+                }
+                contentHash -= configurationEntryHash(key, it->second);
+                it->second = stored;
+            }
+            else
+            {
+                values.emplace(std::string_view(key), stored);
+            }
+            contentHash += configurationEntryHash(key, stored);
+            // Local write times never go backwards, even if the clock does.
+            writeTimes[key] = remoteWriteTime
+                                  ? *remoteWriteTime
+                                  : std::max(now, localWriteTime + 1);
+            if (keyBlob)
+            {
+                configuration->blobs()[key] = std::move(keyBlob);
+            }
+            else
+            {
+                configuration->blobs().erase(key);
+            }
+            changed.emplace_hint(changed.end(), key, stored);
+        }
+        applied = changed.size();
+        if (changed.empty())
+        {
+            return version;
+        }
+        changedHash = contentHash;
+        notifyContentHash();
+        changedVersion = ++version;
+        if (changed.size() > maxChangeLogSize)
+        {
+            // The version would not fit the log as a whole, so older
+            // versions need a full fetch.
+            changeLog.clear();
+        }
+        else
+        {
+            for (const auto& [key, _] : changed)
+            {
+                logChange(changedVersion, key);
+            }
+        }
+        pendingNotifications.push_back({changedVersion, changedHash, changed});
+    }
+    notifySubscribers();
+    publish();
+    // NOTE: Maybe we should save changes back to json?
+
+    if (changed.size() == 1)
+    {
+        spdlog::info("Configuration changed for key: {}",
+                     changed.begin()->first);
+    }
+    else
+    {
+        spdlog::info("Configuration changed for {} keys", changed.size());
+    }
+    return changedVersion;
+}
+
+void ApplicationStore::reload(const ConfigurationBundle* bundle)
+{
+    auto fresh = parseConfig(bundle);
+    // An edited file is held to the same rules as a change; a rejected one
+    // leaves the current configuration in place.
+    if (validator)
+    {
+        for (const auto& [key, value] : fresh->values())
+        {
+            validator(std::string(key), value);
+        }
+    }
+    const uint64_t freshHash = hashConfiguration(fresh->values());
+    uint64_t reloadedVersion = 0;
+    config_dict changed;
+    bool removed = false;
+    {
+        std::lock_guard<std::mutex> lock(configurationMutex);
+        if (frozen)
+        {
+            spdlog::warn("Not reloading {} during a handoff", configPath);
+            return;
+        }
+        const auto& current = configuration->values();
+        for (const auto& [key, value] : fresh->values())
+        {
+            auto it = current.find(key);
+            if (it == current.end() || !variantEquals(it->second, value))
+            {
+                changed.emplace(std::string(key), value);
+                continue;
+            }
+            const std::string keyName(key);
+            auto freshBlob = fresh->blobs().find(keyName);
+            if (freshBlob != fresh->blobs().end() &&
+                !sameBlob(configuration->blobs(), keyName, *freshBlob->second))
+            {
+                changed.emplace(keyName, value);
+            }
+        }
+        for (const auto& [key, _] : current)
+        {
+            if (!fresh->values().count(key))
+            {
+                removed = true;
+                break;
+            }
+        }
+        if (changed.empty() && !removed)
+        {
+            spdlog::info("Configuration in {} unchanged", configPath);
+            return;
+        }
+
+        std::swap(configuration, fresh);
+        contentHash = freshHash;
+        const uint64_t now = wallClockNow();
+        for (const auto& [key, _] : changed)
+        {
+            auto& written = writeTimes[key];
+            written = std::max(now, written + 1);
+        }
+        if (removed)
+        {
+            const auto& values = configuration->values();
+            for (auto it = writeTimes.begin(); it != writeTimes.end();)
+            {
+                if (values.count(std::string_view(it->first)))
+                {
+                    ++it;
+                }
+                else
+                {
+                    it = writeTimes.erase(it);
+                }
+            }
+        }
+        notifyContentHash();
+        reloadedVersion = ++version;
+        if (removed || changed.size() > maxChangeLogSize)
+        {
+            // Deltas cannot express removals, and a version that does not
+            // fit the log as a whole cannot be told as one either, so older
+            // versions need a full fetch.
+            changeLog.clear();
+        }
+        else
+        {
+            for (const auto& [key, _] : changed)
+            {
+                logChange(reloadedVersion, key);
+            }
+        }
+        if (removed)
+        {
+            changed.clear();
+            for (const auto& [key, value] : configuration->values())
+            {
+                changed.emplace_hint(changed.end(), std::string(key), value);
+            }
+        }
+        pendingNotifications.push_back(
+            {reloadedVersion, freshHash, std::move(changed)});
+    }
+    fresh.reset();
+    notifySubscribers();
+    publish();
+    spdlog::info("Reloaded configuration from {}", configPath);
+}
+
+std::optional<sdbus::Variant>
+ApplicationStore::get(const std::string& key) const
+{
+    std::lock_guard<std::mutex> lock(configurationMutex);
+    auto it = configuration->values().find(std::string_view(key));
+    if (it == configuration->values().end())
+    {
+        return std::nullopt;
+    }
+    return it->second;
+}
+
+config_dict ApplicationStore::getConfiguration() const
+{
+    std::lock_guard<std::mutex> lock(configurationMutex);
+    config_dict result;
+    for (const auto& [key, value] : configuration->values())
+    {
+        result.emplace_hint(result.end(), std::string(key), value);
+    }
+    return result;
+}
+
+std::shared_ptr<const ConfigurationSnapshot>
+ApplicationStore::getSnapshot() const
+{
+    auto snapshot = std::make_shared<ConfigurationSnapshot>();
+    snapshot->generation = generation;
+    std::lock_guard<std::mutex> lock(configurationMutex);
+    snapshot->version = version;
+    snapshot->contentHash = contentHash;
+    for (const auto& [key, value] : configuration->values())
+    {
+        snapshot->values.emplace_hint(snapshot->values.end(), std::string(key),
+                                      value);
+    }
+    return snapshot;
+}
+
+std::shared_ptr<const SealedBlob>
+ApplicationStore::getValue(const std::string& key) const
+{
+    std::lock_guard<std::mutex> lock(configurationMutex);
+    const auto& values = configuration->values();
+    auto it = values.find(std::string_view(key));
+    if (it == values.end())
+    {
+        throw std::invalid_argument("Unknown key: " + key);
+    }
+    auto blob = configuration->blobs().find(key);
+    if (!isBlobHandle(it->second) || blob == configuration->blobs().end())
+    {
+        throw std::invalid_argument("Value of " + key +
+                                    " is not stored as a blob");
+    }
+    return blob->second;
+}
+
+std::tuple<uint64_t, uint64_t, uint64_t, bool, config_dict>
+ApplicationStore::getConfigurationSince(uint64_t clientGeneration,
+                                        uint64_t clientVersion) const
+{
+    std::lock_guard<std::mutex> lock(configurationMutex);
+    const auto& values = configuration->values();
+    const uint64_t oldestKnown =
+        changeLog.empty() ? version : changeLog.front().first - 1;
+    auto everything = [&]()
+    {
+        config_dict all;
+        for (const auto& [key, value] : values)
+        {
+            all.emplace_hint(all.end(), std::string(key), value);
+        }
+        return std::make_tuple(generation, version, contentHash, true,
+                               std::move(all));
+    };
+    if (clientGeneration != generation || clientVersion < oldestKnown ||
+        clientVersion > version)
+    {
+        return everything();
+    }
+    config_dict result;
+    for (auto it = changeLog.rbegin();
+         it != changeLog.rend() && it->first > clientVersion; ++it)
+    {
+        const std::string& key = *it->second;
+        if (!result.count(key))
+        {
+            auto value = values.find(std::string_view(key));
+            if (value == values.end())
+            {
+                // A logged key that is gone cannot be told as a delta.
+                return everything();
+            }
+            result.emplace(key, value->second);
+        }
+    }
+    return {generation, version, contentHash, false, std::move(result)};
+}
+
+config_dict
+ApplicationStore::getResolvedValues(const std::vector<std::string>& keys,
+                                    uint64_t& currentVersion) const
+{
+    std::lock_guard<std::mutex> lock(configurationMutex);
+    currentVersion = version;
+    if (keys.empty())
+    {
+        return resolvedConfiguration();
+    }
+    config_dict result;
+    for (const auto& key : keys)
+    {
+        auto it = configuration->values().find(std::string_view(key));
+        if (it != configuration->values().end())
+        {
+            result.emplace(key, resolveBlob(key, it->second));
+        }
+    }
+    return result;
+}
+
+config_dict ApplicationStore::resolve(const config_dict& changed) const
+{
+    std::lock_guard<std::mutex> lock(configurationMutex);
+    config_dict resolved;
+    for (const auto& [key, value] : changed)
+    {
+        resolved.emplace_hint(resolved.end(), key, resolveBlob(key, value));
+    }
+    return resolved;
+}
+
+config_dict
+ApplicationStore::getValuesForSync(const std::vector<std::string>& keys,
+                                   std::map<std::string, uint64_t>* times) const
+{
+    std::lock_guard<std::mutex> lock(configurationMutex);
+    config_dict result;
+    for (const auto& key : keys)
+    {
+        auto it = configuration->values().find(std::string_view(key));
+        if (it == configuration->values().end())
+        {
+            continue;
+        }
+        result.emplace(key, resolveBlob(key, it->second));
+        auto written = writeTimes.find(key);
+        if (times && written != writeTimes.end())
+        {
+            times->emplace(key, written->second);
+        }
+    }
+    return result;
+}
+
+std::map<std::string, uint64_t> ApplicationStore::getWriteTimes() const
+{
+    std::lock_guard<std::mutex> lock(configurationMutex);
+    return {writeTimes.begin(), writeTimes.end()};
+}
+
+std::map<std::string, uint64_t> ApplicationStore::getEntryHashes() const
+{
+    std::lock_guard<std::mutex> lock(configurationMutex);
+    std::map<std::string, uint64_t> hashes;
+    for (const auto& [key, value] : configuration->values())
+    {
+        hashes.emplace_hint(hashes.end(), std::string(key),
+                            configurationEntryHash(key, value));
+    }
+    return hashes;
+}
+
+ApplicationState ApplicationStore::exportState() const
+{
+    std::vector<std::string> keys;
+    ApplicationState state;
+    {
+        std::lock_guard<std::mutex> lock(configurationMutex);
+        state.configPath = configPath;
+        state.version = version;
+        for (const auto& [changedVersion, key] : changeLog)
+        {
+            state.changeLog.emplace_back(changedVersion, *key);
+        }
+        keys.reserve(configuration->values().size());
+        for (const auto& [key, _] : configuration->values())
+        {
+            keys.emplace_back(key);
+        }
+    }
+    state.values = getValuesForSync(keys, &state.writeTimes);
+    return state;
+}
+
+uint64_t ApplicationStore::getVersion() const
+{
+    std::lock_guard<std::mutex> lock(configurationMutex);
+    return version;
+}
+
+uint64_t ApplicationStore::getContentHash() const
+{
+    std::lock_guard<std::mutex> lock(configurationMutex);
+    return contentHash;
+}
+
+ArenaStats ApplicationStore::getArenaStats() const
+{
+    std::lock_guard<std::mutex> lock(configurationMutex);
+    return configuration->stats();
+}
+
+uint64_t ApplicationStore::subscribe(update_callback callback)
+{
+    std::lock_guard<std::mutex> lock(subscribersMutex);
+    const uint64_t id = nextSubscription++;
+    subscribers.emplace(id, std::move(callback));
+    return id;
+}
+
+void ApplicationStore::unsubscribe(uint64_t id)
+{
+    std::lock_guard<std::mutex> lock(subscribersMutex);
+    subscribers.erase(id);
+}
+
+void ApplicationStore::setValidator(change_validator changeValidator)
+{
+    validator = std::move(changeValidator);
+}
+
+void ApplicationStore::setContentHashListener(
+    std::function<void(uint64_t)> listener)
+{
+    std::lock_guard<std::mutex> lock(configurationMutex);
+    contentHashListener = std::move(listener);
+    notifyContentHash();
+}
+
+void ApplicationStore::setPublisher(
+    std::function<void(uint64_t, const config_dict&)> applicationPublisher)
+{
+    {
+        std::lock_guard<std::mutex> lock(publishMutex);
+        publisher = std::move(applicationPublisher);
+    }
+    publish();
+}
+
+void ApplicationStore::setFrozen(bool freeze)
+{
+    std::lock_guard<std::mutex> lock(configurationMutex);
+    frozen = freeze;
+}
+
+void ApplicationStore::load(const ApplicationState* state,
+                            const ConfigurationBundle* bundle)
+{
+    if (!state)
+    {
+        configuration = parseConfig(bundle);
+    }
+    else
+    {
+        configuration =
+            std::make_unique<ConfigurationArena>(state->values.size() * 64);
+        for (const auto& [key, value] : state->values)
+        {
+            auto blob = toBlob(key, value);
+            configuration->values().emplace(
+                std::string_view(key),
+                blob ? sdbus::Variant(blob->handle()) : value);
+            if (blob)
+            {
+                configuration->blobs()[key] = std::move(blob);
+            }
+        }
+        version = state->version;
+        writeTimes.insert(state->writeTimes.begin(), state->writeTimes.end());
+        for (const auto& [changedVersion, key] : state->changeLog)
+        {
+            changeLog.emplace_back(changedVersion, keys.intern(key));
+        }
+    }
+    contentHash = hashConfiguration(configuration->values());
+}
+
+std::unique_ptr<ConfigurationArena>
+ApplicationStore::parseConfig(const ConfigurationBundle* bundle) const
+{
+    AllocationScope scope(AllocationOperation::Parse);
+    if (isConfigurationBundle(configPath))
+    {
+        return readBundle(bundle);
+    }
+    try
+    {
+        spdlog::debug("Parsing config file: {}", configPath);
+        ConfigurationFormat format;
+        if (!configurationFormatFromExtension(
+                fs::path(configPath).extension().string(), format))
+        {
+            throw std::runtime_error("Unknown config file format");
+        }
+
+        // Keys and nodes take roughly as much room as the file itself.
+        auto arena = std::make_unique<ConfigurationArena>(
+            static_cast<size_t>(fs::file_size(configPath)));
+        parseConfigurationFile(configPath, format, arena->values(),
+                               blobSink(arena->blobs()));
+
+        const auto stats = arena->stats();
+        spdlog::debug("Successfully parsed config file: {} ({} "
+                      "allocations served from {} arena chunks)",
+                      configPath, stats.allocations, stats.chunks);
+        return arena;
+    }
+    catch (const std::exception& e)
+    {
+        spdlog::error("Failed to parse config file: {}", configPath);
+        throw std::runtime_error("Config parsing failed: " +
+                                 std::string(e.what()));
+    }
+}
+
+std::unique_ptr<ConfigurationArena>
+ApplicationStore::readBundle(const ConfigurationBundle* bundle) const
+{
+    try
+    {
+        std::unique_ptr<ConfigurationBundle> mapped;
+        if (!bundle)
+        {
+            mapped = std::make_unique<ConfigurationBundle>(configPath);
+            bundle = mapped.get();
+        }
+        auto index = bundle->findApplication(name);
+        if (!index)
+        {
+            throw std::runtime_error("Application " + name +
+                                     " is missing from the bundle");
+        }
+        auto arena = std::make_unique<ConfigurationArena>(0);
+        bundle->readApplication(*index, arena->values(),
+                                blobSink(arena->blobs()));
+        return arena;
+    }
+    catch (const std::exception& e)
+    {
+        spdlog::error("Failed to read bundle: {}", configPath);
+        throw std::runtime_error("Config parsing failed: " +
+                                 std::string(e.what()));
+    }
+}
+
+// Keeps byte strings of at least blobThreshold bytes in sealed memfds.
+binary_sink ApplicationStore::blobSink(configuration_blobs& blobs) const
+{
+    return [this, &blobs](const std::string& key,
+                          const std::vector<uint8_t>& bytes)
+    {
+        if (bytes.size() < blobThreshold)
+        {
+            return sdbus::Variant(bytes);
+        }
+        auto blob = SealedBlob::fromBytes(key, bytes.data(), bytes.size());
+        sdbus::Variant handle(blob->handle());
+        blobs[key] = std::move(blob);
+        return handle;
+    };
+}
+
+std::shared_ptr<const SealedBlob>
+ApplicationStore::toBlob(const std::string& key,
+                         const sdbus::Variant& value) const
+{
+    const std::string type = value.peekValueType();
+    if (type == "h")
+    {
+        return SealedBlob::fromFd(key, value.get<sdbus::UnixFd>().get());
+    }
+    if (type == "ay")
+    {
+        const auto bytes = value.get<std::vector<uint8_t>>();
+        if (bytes.size() >= blobThreshold)
+        {
+            return SealedBlob::fromBytes(key, bytes.data(), bytes.size());
+        }
+    }
+    return nullptr;
+}
+
+std::shared_ptr<const SealedBlob>
+ApplicationStore::findBlob(const std::string& key) const
+{
+    std::lock_guard<std::mutex> lock(configurationMutex);
+    auto blob = configuration->blobs().find(key);
+    return blob == configuration->blobs().end() ? nullptr : blob->second;
+}
+
+bool ApplicationStore::blobMatches(const SealedBlob& stored,
+                                   const sdbus::Variant& value) const
+{
+    const char* type = value.peekValueType();
+    if (!type)
+    {
+        return false;
+    }
+    if (std::strcmp(type, "h") == 0)
+    {
+        return stored.sameContent(value.get<sdbus::UnixFd>().get());
+    }
+    if (std::strcmp(type, "ay") == 0)
+    {
+        const auto bytes = value.get<std::vector<uint8_t>>();
+        return bytes.size() >= blobThreshold &&
+               stored.sameContent(bytes.data(), bytes.size());
+    }
+    return false;
+}
+
+sdbus::Variant ApplicationStore::resolveBlob(const std::string& key,
+                                             const sdbus::Variant& value) const
+{
+    if (isBlobHandle(value))
+    {
+        auto blob = configuration->blobs().find(key);
+        if (blob != configuration->blobs().end())
+        {
+            return sdbus::Variant(blob->second->bytes());
+        }
+    }
+    return value;
+}
+
+config_dict ApplicationStore::resolvedConfiguration() const
+{
+    config_dict values;
+    for (const auto& [key, value] : configuration->values())
+    {
+        const std::string keyName(key);
+        values.emplace_hint(values.end(), keyName, resolveBlob(keyName, value));
+    }
+    return values;
+}
+
+void ApplicationStore::notifyContentHash() const
+{
+    if (contentHashListener)
+    {
+        contentHashListener(contentHash);
+    }
+}
+
+void ApplicationStore::logChange(uint64_t changedVersion,
+                                 const std::string& key)
+{
+    changeLog.emplace_back(changedVersion, keys.intern(key));
+    if (changeLog.size() > maxChangeLogSize)
+    {
+        // Versions are dropped as a whole, or a partially logged version
+        // would still look complete to getConfigurationSince(). The one
+        // being logged is never dropped; callers clear the log instead when
+        // it does not fit.
+        const uint64_t dropped = changeLog.front().first;
+        while (dropped != changedVersion && !changeLog.empty() &&
+               changeLog.front().first == dropped)
+        {
+            changeLog.pop_front();
+        }
+    }
+}
+
+// Notifications are queued in version order under configurationMutex and
+// delivered by whichever committing thread holds subscribersMutex, until the
+// queue is empty. So when this returns, the caller's own notification went
+// out, and no two writers can deliver their versions out of order.
+//
+// A subscriber that fails must not fail the change that is being announced,
+// nor keep the others from hearing about it.
+void ApplicationStore::notifySubscribers()
+{
+    std::lock_guard<std::mutex> lock(subscribersMutex);
+    for (;;)
+    {
+        PendingNotification next;
+        {
+            std::lock_guard<std::mutex> queueLock(configurationMutex);
+            if (pendingNotifications.empty())
+            {
+                return;
+            }
+            next = std::move(pendingNotifications.front());
+            pendingNotifications.pop_front();
+        }
+        for (const auto& [_, callback] : subscribers)
+        {
+            try
+            {
+                callback(next.version, next.contentHash, next.changed);
+            }
+            catch (const std::exception& e)
+            {
+                spdlog::error("Failed to notify a subscriber of {}: {}", name,
+                              e.what());
+            }
+        }
+    }
+}
+
+// Snapshots are taken under publishMutex, so when two changes race the
+// later publication always carries the newer state.
+void ApplicationStore::publish() const
+{
+    std::lock_guard<std::mutex> publishLock(publishMutex);
+    if (!publisher)
+    {
+        return;
+    }
+    uint64_t publishedVersion = 0;
+    config_dict values;
+    {
+        std::lock_guard<std::mutex> lock(configurationMutex);
+        publishedVersion = version;
+        values = resolvedConfiguration();
+    }
+    try
+    {
+        publisher(publishedVersion, values);
+    }
+    catch (const std::exception& e)
+    {
+        spdlog::error("Failed to publish {}: {}", configPath, e.what());
+    }
+}
+
+ConfigurationStore::ConfigurationStore(const StoreOptions& options,
+                                       std::shared_ptr<Executor> executor,
+                                       std::shared_ptr<KeyTable> keys)
+    : configDir(options.configDir), bundlePath(options.bundle),
+      blobThreshold(options.blobThreshold),
+      generation(std::random_device{}() |
+                 (static_cast<uint64_t>(std::random_device{}()) << 32)),
+      executor(std::move(executor)), keys(std::move(keys))
+{
+}
+
+void ConfigurationStore::load()
+{
+    // Config file path and application name of every application.
+    std::vector<std::pair<std::string, std::string>> applicationsData;
+    std::unique_ptr<ConfigurationBundle> bundle;
+    if (!bundlePath.empty())
+    {
+        bundle = std::make_unique<ConfigurationBundle>(bundlePath);
+        applicationsData.reserve(bundle->applicationCount());
+        for (size_t i = 0; i < bundle->applicationCount(); ++i)
+        {
+            applicationsData.emplace_back(
+                bundlePath, std::string(bundle->applicationName(i)));
+        }
+        spdlog::info("Mapped bundle {} with {} applications ({} bytes)",
+                     bundlePath, applicationsData.size(), bundle->size());
+    }
+    else
+    {
+        applicationsData = getApplicationsConfigs();
+        spdlog::info("Found {} application configs", applicationsData.size());
+    }
+
+    std::vector<std::unique_ptr<ApplicationStore>> loaded(
+        applicationsData.size());
+    runAll(*executor, applicationsData.size(),
+           [&](size_t i)
+           {
+               const auto& [path, name] = applicationsData[i];
+               loaded[i] = std::make_unique<ApplicationStore>(
+                   name, path, generation, blobThreshold, *keys, nullptr,
+                   bundle.get());
+           });
+    applicationStores.reserve(loaded.size());
+    for (auto& application : loaded)
+    {
+        const std::string name = application->getName();
+        applicationStores[name] = std::move(application);
+    }
+
+    const auto total = getArenaStats();
+    spdlog::info("Parsed {} applications: {} allocations ({} bytes) "
+                 "served from {} arena chunks ({} bytes)",
+                 applicationStores.size(), total.allocations, total.bytes,
+                 total.chunks, total.chunkBytes);
+}
+
+void ConfigurationStore::load(
+    const std::unordered_map<std::string, ApplicationState>& states,
+    uint64_t handedOverGeneration)
+{
+    generation = handedOverGeneration;
+    applicationStores.reserve(states.size());
+    for (const auto& [name, state] : states)
+    {
+        applicationStores[name] = std::make_unique<ApplicationStore>(
+            name, state.configPath, generation, blobThreshold, *keys, &state);
+    }
+}
+
+void ConfigurationStore::reload()
+{
+    std::unique_ptr<ConfigurationBundle> mappedBundle;
+    if (!bundlePath.empty())
+    {
+        try
+        {
+            mappedBundle = std::make_unique<ConfigurationBundle>(bundlePath);
+        }
+        catch (const std::exception& e)
+        {
+            spdlog::error("Not reloading: {}", e.what());
+            return;
+        }
+    }
+    std::vector<ApplicationStore*> applications;
+    applications.reserve(applicationStores.size());
+    for (const auto& [_, application] : applicationStores)
+    {
+        applications.push_back(application.get());
+    }
+    runAll(*executor, applications.size(),
+           [&](size_t i)
+           {
+               try
+               {
+                   applications[i]->reload(mappedBundle.get());
+               }
+               catch (const std::exception& e)
+               {
+                   spdlog::error("Failed to reload {}: {}",
+                                 applications[i]->getName(), e.what());
+               }
+           });
+    const auto total = getArenaStats();
+    spdlog::info("Reloaded {} applications: {} allocations ({} bytes) "
+                 "served from {} arena chunks ({} bytes)",
+                 applicationStores.size(), total.allocations, total.bytes,
+                 total.chunks, total.chunkBytes);
+}
+
+ApplicationStore* ConfigurationStore::find(const std::string& name) const
+{
+    auto it = applicationStores.find(name);
+    return it != applicationStores.end() ? it->second.get() : nullptr;
+}
+
+std::vector<std::string> ConfigurationStore::getApplicationNames() const
+{
+    std::vector<std::string> names;
+    names.reserve(applicationStores.size());
+    for (const auto& [name, _] : applicationStores)
+    {
+        names.push_back(name);
+    }
+    return names;
+}
+
+ArenaStats ConfigurationStore::getArenaStats() const
+{
+    ArenaStats total;
+    for (const auto& [_, application] : applicationStores)
+    {
+        total += application->getArenaStats();
+    }
+    return total;
+}
+
+std::vector<std::pair<std::string, std::string>>
+ConfigurationStore::getApplicationsConfigs() const
+{
+    spdlog::debug("Scanning config directory: {}", configDir);
+    std::vector<std::pair<std::string, std::string>> applicationsData;
+    std::unordered_set<std::string> applicationNames;
+    std::string actualConfigDir = configDir;
+    if (actualConfigDir.find("~/") == 0)
+    { // Maybe too much but why not ^_^
+        const char* home = std::getenv("HOME");
+        if (!home)
+        {
+            throw std::runtime_error("HOME environment variable not set");
+        }
+        actualConfigDir.replace(0, 1, home);
+    }
+    try
+    {
+        for (const auto& entry : fs::directory_iterator(actualConfigDir))
+        {
+            ConfigurationFormat format;
+            if (!entry.is_regular_file() ||
+                !configurationFormatFromExtension(
+                    entry.path().extension().string(), format))
+            {
+                continue;
+            }
+            auto name = entry.path().stem().string();
+            if (!applicationNames.insert(name).second)
+            {
+                throw std::runtime_error(
+                    "More than one config file for application " + name);
+            }
+            applicationsData.emplace_back(entry.path().string(),
+                                          std::move(name));
+        }
+    }
+    catch (const fs::filesystem_error& e)
+    {
+        throw std::runtime_error("Error accessing config directory: " +
+                                 std::string(e.what()));
+    }
+
+    if (applicationsData.empty())
+    {
+        throw std::runtime_error("No valid configuration files found in " +
+                                 actualConfigDir);
+    }
+    spdlog::debug("Found {} valid config files", applicationsData.size());
+    return applicationsData;
+}
@@ -0,0 +1,326 @@
+#pragma once
+
+#include "configurationArena.hpp"
+#include "executor.hpp"
+#include "keyTable.hpp"
+#include "variantUtils.hpp"
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <sdbus-c++/sdbus-c++.h>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+using config_dict = std::map<std::string, sdbus::Variant>;
+
+class ConfigurationBundle;
+class SealedBlob;
+
+// Everything a successor manager needs to serve an application without
+// parsing its config file again.
+struct ApplicationState
+{
+    std::string configPath;
+    uint64_t version{0};
+    std::deque<std::pair<uint64_t, std::string>> changeLog;
+    // Blob values resolved into their bytes.
+    config_dict values;
+    // See ApplicationStore::getWriteTimes().
+    std::map<std::string, uint64_t> writeTimes;
+};
+
+// The configuration as of one version. Never changes once taken, so it can
+// be read from any thread without holding the store's lock.
+struct ConfigurationSnapshot
+{
+    uint64_t generation{0};
+    uint64_t version{0};
+    uint64_t contentHash{0};
+    // As stored, blob handles included.
+    config_dict values;
+};
+
+// Called with every committed version: the content hash after it and the
+// keys it changed, as stored (large byte strings are blob handles, see
+// ApplicationStore::resolve()). A reload that removed keys passes the
+// whole configuration instead.
+using update_callback = std::function<void(
+    uint64_t version, uint64_t contentHash, const config_dict& changed)>;
+
+// Throws std::invalid_argument to reject a change before it is applied.
+using change_validator =
+    std::function<void(const std::string& key, const sdbus::Variant& value)>;
+
+// One application's configuration: loading, storage, versioning and change
+// notification, without any transport. The manager exports it on D-Bus;
+// embedders call it directly. Every member is safe to call from any thread.
+class ApplicationStore
+{
+  public:
+    // Starts from `state` instead of the config file when one is handed
+    // over. A `configPath` naming a bundle is read from `bundle` if it is
+    // already mapped, otherwise from the bundle file itself. `keys` has to
+    // outlive the store.
+    ApplicationStore(const std::string& name, const std::string& configPath,
+                     uint64_t generation, size_t blobThreshold, KeyTable& keys,
+                     const ApplicationState* state = nullptr,
+                     const ConfigurationBundle* bundle = nullptr);
+    ~ApplicationStore();
+
+    ApplicationStore(const ApplicationStore&) = delete;
+    ApplicationStore& operator=(const ApplicationStore&) = delete;
+
+    const std::string& getName() const { return name; }
+    uint64_t getGeneration() const { return generation; }
+
+    void changeConfiguration(const std::string& key, const sdbus::Variant& val);
+
+    // Applies every change under a single version, which is returned. All
+    // of them are checked before any is applied; keys that keep their value
+    // are left out of the announced delta.
+    uint64_t changeConfiguration(const config_dict& changes);
+
+    // Anti-entropy: adopts `value` written elsewhere at `writeTime` only if
+    // that is later than the key's own last write. Equal times go to the
+    // higher entry hash, so two managers settle on the same value whichever
+    // pulls first. Returns whether the value was adopted.
+    bool mergeValue(const std::string& key, const sdbus::Variant& value,
+                    uint64_t writeTime);
+
+    // Parses the config file into a fresh arena and swaps it in; the old
+    // arena is released as a whole once nobody references it any more.
+    // A file that did not change leaves version and subscribers alone, and
+    // one without removed keys is announced as a delta.
+    void reload(const ConfigurationBundle* bundle = nullptr);
+
+    // The stored value, blob handles included. Empty for unknown keys.
+    std::optional<sdbus::Variant> get(const std::string& key) const;
+
+    config_dict getConfiguration() const;
+
+    std::shared_ptr<const ConfigurationSnapshot> getSnapshot() const;
+
+    // Returns the memfd behind a blob value. The caller may keep using it
+    // after the key has been changed.
+    std::shared_ptr<const SealedBlob> getValue(const std::string& key) const;
+
+    // Returns what a client at (`clientGeneration`, `clientVersion`) misses:
+    // only the keys changed since then when the change log still covers that
+    // version, the whole configuration otherwise.
+    std::tuple<uint64_t, uint64_t, uint64_t, bool, config_dict>
+    getConfigurationSince(uint64_t clientGeneration,
+                          uint64_t clientVersion) const;
+
+    // Current values of `keys` (every key if none are given) with blob
+    // handles replaced by their content, and the version they belong to.
+    // Unknown keys are left out.
+    config_dict getResolvedValues(const std::vector<std::string>& keys,
+                                  uint64_t& currentVersion) const;
+
+    // `changed` as passed to an update_callback, with blob handles replaced
+    // by their current content.
+    config_dict resolve(const config_dict& changed) const;
+
+    // Values of `keys` for transfer to another manager, with blob handles
+    // replaced by their content, and optionally their write times. Unknown
+    // keys are left out.
+    config_dict
+    getValuesForSync(const std::vector<std::string>& keys,
+                     std::map<std::string, uint64_t>* times = nullptr) const;
+
+    // When keys were last changed or reloaded, in wall-clock nanoseconds
+    // since the epoch. Keys never written since the first load are left
+    // out, which counts as older than any write.
+    std::map<std::string, uint64_t> getWriteTimes() const;
+
+    // Key -> configurationEntryHash(), the lowest level of the Merkle tree.
+    std::map<std::string, uint64_t> getEntryHashes() const;
+
+    ApplicationState exportState() const;
+
+    uint64_t getVersion() const;
+    uint64_t getContentHash() const;
+    ArenaStats getArenaStats() const;
+
+    // Callbacks run in version order, one at a time, after the change is
+    // visible to readers: on the thread that committed it, or on one that
+    // committed a later version meanwhile. They must not subscribe,
+    // unsubscribe or change this store; what they throw is logged and
+    // otherwise ignored.
+    uint64_t subscribe(update_callback callback);
+    // Returns once no call of the callback is in progress any more.
+    void unsubscribe(uint64_t id);
+
+    // Runs before every change is applied and on every key of a reloaded
+    // file. Set it before the store is shared between threads.
+    void setValidator(change_validator validator);
+
+    // Called with every new content hash, while the change is applied.
+    void setContentHashListener(std::function<void(uint64_t)> listener);
+
+    // Called with the version and full content (blobs resolved) after every
+    // committed change, and once right away.
+    void setPublisher(
+        std::function<void(uint64_t, const config_dict&)> applicationPublisher);
+
+    // While frozen every change is rejected, so a snapshot taken afterwards
+    // stays current.
+    void setFrozen(bool freeze);
+
+  private:
+    // `remoteWriteTime` turns it into a last-writer-wins merge. `applied` is
+    // set to the number of keys that changed.
+    uint64_t applyChanges(const config_dict& changes,
+                          const uint64_t* remoteWriteTime, size_t& applied);
+    void load(const ApplicationState* state, const ConfigurationBundle* bundle);
+    std::unique_ptr<ConfigurationArena>
+    parseConfig(const ConfigurationBundle* bundle = nullptr) const;
+    std::unique_ptr<ConfigurationArena>
+    readBundle(const ConfigurationBundle* bundle) const;
+    binary_sink blobSink(configuration_blobs& blobs) const;
+    // Byte strings of at least blobThreshold bytes and file descriptors are
+    // stored as blobs; returns nullptr for every other value.
+    std::shared_ptr<const SealedBlob> toBlob(const std::string& key,
+                                             const sdbus::Variant& value) const;
+    std::shared_ptr<const SealedBlob> findBlob(const std::string& key) const;
+    // Whether `value` would be stored as a blob with the content of `stored`.
+    bool blobMatches(const SealedBlob& stored,
+                     const sdbus::Variant& value) const;
+
+    // Expects configurationMutex to be held.
+    sdbus::Variant resolveBlob(const std::string& key,
+                               const sdbus::Variant& value) const;
+    // Expects configurationMutex to be held.
+    config_dict resolvedConfiguration() const;
+    // Expects configurationMutex to be held.
+    void notifyContentHash() const;
+    // Expects configurationMutex to be held.
+    void logChange(uint64_t changedVersion, const std::string& key);
+
+    // Delivers every queued notification in version order.
+    void notifySubscribers();
+    void publish() const;
+
+    const std::string name;
+    const std::string configPath;
+    // Versions are only comparable within one generation (manager run).
+    const uint64_t generation;
+    const size_t blobThreshold;
+    KeyTable& keys;
+    change_validator validator;
+
+    mutable std::mutex configurationMutex;
+    std::unique_ptr<ConfigurationArena> configuration;
+    uint64_t version{0};
+    // Sum of configurationEntryHash() over all keys.
+    uint64_t contentHash{0};
+    std::function<void(uint64_t)> contentHashListener;
+    // Last write time of every key written since the first load.
+    std::unordered_map<std::string, uint64_t> writeTimes;
+    bool frozen{false};
+    static constexpr size_t maxChangeLogSize = 1024;
+    std::deque<std::pair<uint64_t, interned_key>> changeLog;
+
+    struct PendingNotification
+    {
+        uint64_t version{0};
+        uint64_t contentHash{0};
+        config_dict changed;
+    };
+    // Committed versions not yet announced, oldest first.
+    std::deque<PendingNotification> pendingNotifications;
+
+    // Held while callbacks run, so notifications never overlap. Taken
+    // before configurationMutex, never while holding it.
+    mutable std::mutex subscribersMutex;
+    uint64_t nextSubscription{1};
+    std::map<uint64_t, update_callback> subscribers;
+
+    mutable std::mutex publishMutex;
+    std::function<void(uint64_t, const config_dict&)> publisher;
+};
+
+struct StoreOptions
+{
+    std::string configDir{"~/com.system.configurationManager/"};
+    // Compiled bundle (see configc) to load instead of configDir.
+    std::string bundle;
+    // Byte strings of at least this size are kept in sealed memfds.
+    size_t blobThreshold{64 * 1024};
+};
+
+// Every application of a config directory or bundle, keyed by application
+// name (the config file stem). Applications are parsed and reloaded in
+// parallel on `executor`, which several stores may share along with their
+// KeyTable. Embed it to read and change configuration in-process without a
+// bus:
+//
+//   ConfigurationStore store(StoreOptions{"/etc/myService/config"});
+//   store.load();
+//   auto* application = store.find("myService");
+//   application->subscribe([](uint64_t version, uint64_t hash,
+//                             const config_dict& changed) { ... });
+//   application->changeConfiguration("Timeout", sdbus::Variant(int64_t{5}));
+class ConfigurationStore
+{
+  public:
+    using application_map =
+        std::unordered_map<std::string, std::unique_ptr<ApplicationStore>>;
+
+    explicit ConfigurationStore(
+        const StoreOptions& options = StoreOptions{},
+        std::shared_ptr<Executor> executor = std::make_shared<InlineExecutor>(),
+        std::shared_ptr<KeyTable> keys = std::make_shared<KeyTable>());
+
+    ConfigurationStore(const ConfigurationStore&) = delete;
+    ConfigurationStore& operator=(const ConfigurationStore&) = delete;
+
+    // Loads every application from the bundle, or else the config
+    // directory, under a fresh generation. Like reload(), it must not be
+    // called from a task of the executor.
+    void load();
+
+    // Serves the applications handed over by a predecessor, which keeps
+    // its generation so that clients continue from their versions.
+    void load(const std::unordered_map<std::string, ApplicationState>& states,
+              uint64_t handedOverGeneration);
+
+    // Reloads every application; one that fails keeps its configuration.
+    void reload();
+
+    // nullptr for unknown applications.
+    ApplicationStore* find(const std::string& name) const;
+
+    // Applications are only added by load(), so the map may be iterated
+    // from any thread afterwards.
+    const application_map& applications() const { return applicationStores; }
+
+    std::vector<std::string> getApplicationNames() const;
+
+    // Identifies this manager run; clients drop incremental state whenever
+    // it changes.
+    uint64_t getGeneration() const { return generation; }
+
+    ArenaStats getArenaStats() const;
+
+  private:
+    // Config file path and application name of every config file.
+    std::vector<std::pair<std::string, std::string>>
+    getApplicationsConfigs() const;
+
+    const std::string configDir;
+    const std::string bundlePath;
+    const size_t blobThreshold;
+    uint64_t generation;
+    const std::shared_ptr<Executor> executor;
+    // Declared before the applications, whose change logs refer to it.
+    const std::shared_ptr<KeyTable> keys;
+    application_map applicationStores;
+};
@@ -0,0 +1,287 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <spdlog/spdlog.h>
+#include <stdexcept>
+#include <string>
+#include <sys/timerfd.h>
+#include <systemd/sd-daemon.h>
+#include <unistd.h>
+#include <unordered_map>
+
+// The systemd watchdog of the process (WatchdogSec= in the unit). Every
+// monitored event loop reports each timely tick; WATCHDOG=1 is only sent
+// once all of them ticked since the previous notification, so a single
+// blocked loop lets the watchdog expire.
+class SystemdWatchdog
+{
+  public:
+    SystemdWatchdog()
+    {
+        uint64_t usec = 0;
+        if (sd_watchdog_enabled(0, &usec) > 0)
+        {
+            // Notifying twice per period leaves room for scheduling jitter.
+            interval = std::chrono::microseconds(usec / 2);
+            spdlog::info("systemd watchdog enabled, notifying every {} ms",
+                         interval.count() / 1000);
+        }
+    }
+
+    SystemdWatchdog(const SystemdWatchdog&) = delete;
+    SystemdWatchdog& operator=(const SystemdWatchdog&) = delete;
+
+    // Zero when the watchdog is off.
+    std::chrono::microseconds getInterval() const { return interval; }
+
+    uint64_t addLoop()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        const uint64_t id = nextLoop++;
+        ticked.emplace(id, false);
+        return id;
+    }
+
+    void removeLoop(uint64_t id)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        ticked.erase(id);
+    }
+
+    void alive(uint64_t id)
+    {
+        if (interval.count() == 0)
+        {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        ticked[id] = true;
+        const auto now = std::chrono::steady_clock::now();
+        if (now - lastNotification < interval ||
+            !std::all_of(ticked.begin(), ticked.end(),
+                         [](const auto& loop) { return loop.second; }))
+        {
+            return;
+        }
+        sd_notify(0, "WATCHDOG=1");
+        lastNotification = now;
+        for (auto& [_, loopTicked] : ticked)
+        {
+            loopTicked = false;
+        }
+    }
+
+  private:
+    std::chrono::microseconds interval{0};
+    std::mutex mutex;
+    uint64_t nextLoop{1};
+    std::unordered_map<uint64_t, bool> ticked;
+    std::chrono::steady_clock::time_point lastNotification;
+};
+
+// Measures how late an event loop handles a timer that is due every
+// `interval`, which is how long anything queued on the loop waits. Lags go
+// into a histogram; one above `threshold` is logged with the slowest
+// handler that ran since the previous tick. Timely ticks feed the watchdog.
+//
+// The loop polls getFd() and calls onTimer() when it is readable. Handlers
+// name themselves with a HandlerScope, which is free on threads that are not
+// attached to a monitor.
+class EventLoopMonitor
+{
+  public:
+    // Lag histogram: bucket i counts lags below 2^i microseconds, the last
+    // one everything above.
+    static constexpr size_t bucketCount = 32;
+
+    EventLoopMonitor(const std::string& loopName,
+                     std::chrono::milliseconds interval,
+                     std::chrono::milliseconds threshold,
+                     std::shared_ptr<SystemdWatchdog> systemdWatchdog)
+        : loopName(loopName), interval(interval), threshold(threshold),
+          watchdog(std::move(systemdWatchdog))
+    {
+        const auto watchdogInterval = watchdog->getInterval();
+        if (watchdogInterval.count() > 0 && watchdogInterval < this->interval)
+        {
+            this->interval = std::max(
+                std::chrono::duration_cast<std::chrono::milliseconds>(
+                    watchdogInterval),
+                std::chrono::milliseconds(1));
+        }
+        timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+        if (timerFd < 0)
+        {
+            throw std::runtime_error("Failed to create timerfd: " +
+                                     std::string(strerror(errno)));
+        }
+        watchdogLoop = watchdog->addLoop();
+    }
+
+    ~EventLoopMonitor()
+    {
+        watchdog->removeLoop(watchdogLoop);
+        close(timerFd);
+    }
+
+    EventLoopMonitor(const EventLoopMonitor&) = delete;
+    EventLoopMonitor& operator=(const EventLoopMonitor&) = delete;
+
+    int getFd() const { return timerFd; }
+
+    // Called on the loop thread before it starts polling.
+    void attachToCurrentThread()
+    {
+        current() = this;
+        arm();
+    }
+
+    void onTimer()
+    {
+        uint64_t expirations = 0;
+        if (read(timerFd, &expirations, sizeof(expirations)) < 0)
+        {
+            return;
+        }
+        const auto lag = std::max(
+            std::chrono::duration_cast<std::chrono::microseconds>(
+                Clock::now() - due),
+            std::chrono::microseconds::zero());
+        {
+            std::lock_guard<std::mutex> lock(histogramMutex);
+            ++histogram[bucketOf(lag)];
+        }
+        if (lag > threshold)
+        {
+            if (slowestHandler)
+            {
+                spdlog::warn("Event loop of {} lagged {} ms; slowest handler "
+                             "since the last tick: {} ({} ms)",
+                             loopName, lag.count() / 1000, slowestHandler,
+                             slowestDuration.count() / 1000);
+            }
+            else
+            {
+                spdlog::warn("Event loop of {} lagged {} ms outside of any "
+                             "named handler",
+                             loopName, lag.count() / 1000);
+            }
+        }
+        slowestHandler = nullptr;
+        slowestDuration = std::chrono::microseconds::zero();
+        watchdog->alive(watchdogLoop);
+        arm();
+    }
+
+    // Upper bound of every non-empty bucket in microseconds -> count.
+    std::map<uint64_t, uint64_t> getHistogram() const
+    {
+        std::lock_guard<std::mutex> lock(histogramMutex);
+        std::map<uint64_t, uint64_t> result;
+        for (size_t i = 0; i < bucketCount; ++i)
+        {
+            if (histogram[i])
+            {
+                const uint64_t bound = i + 1 < bucketCount
+                                           ? uint64_t{1} << i
+                                           : UINT64_MAX;
+                result.emplace(bound, histogram[i]);
+            }
+        }
+        return result;
+    }
+
+    class HandlerScope
+    {
+      public:
+        explicit HandlerScope(const char* name)
+            : monitor(current()), name(name)
+        {
+            if (monitor)
+            {
+                start = Clock::now();
+            }
+        }
+
+        ~HandlerScope()
+        {
+            if (!monitor)
+            {
+                return;
+            }
+            const auto duration =
+                std::chrono::duration_cast<std::chrono::microseconds>(
+                    Clock::now() - start);
+            if (duration >= monitor->slowestDuration)
+            {
+                monitor->slowestHandler = name;
+                monitor->slowestDuration = duration;
+            }
+        }
+
+        HandlerScope(const HandlerScope&) = delete;
+        HandlerScope& operator=(const HandlerScope&) = delete;
+
+      private:
+        EventLoopMonitor* monitor;
+        const char* name;
+        std::chrono::steady_clock::time_point start;
+    };
+
+  private:
+    using Clock = std::chrono::steady_clock;
+
+    static EventLoopMonitor*& current()
+    {
+        thread_local EventLoopMonitor* monitor = nullptr;
+        return monitor;
+    }
+
+    static size_t bucketOf(std::chrono::microseconds lag)
+    {
+        size_t bucket = 0;
+        for (auto value = static_cast<uint64_t>(lag.count()); value;
+             value >>= 1)
+        {
+            ++bucket;
+        }
+        return std::min(bucket, bucketCount - 1);
+    }
+
+    // One-shot, so a late tick does not queue up further expirations.
+    void arm()
+    {
+        itimerspec spec{};
+        spec.it_value.tv_sec = interval.count() / 1000;
+        spec.it_value.tv_nsec = (interval.count() % 1000) * 1000000;
+        due = Clock::now() + interval;
+        if (timerfd_settime(timerFd, 0, &spec, nullptr) < 0)
+        {
+            spdlog::error("Failed to arm the event loop timer: {}",
+                          strerror(errno));
+        }
+    }
+
+    const std::string loopName;
+    std::chrono::milliseconds interval;
+    const std::chrono::milliseconds threshold;
+    const std::shared_ptr<SystemdWatchdog> watchdog;
+    uint64_t watchdogLoop{0};
+    int timerFd{-1};
+    Clock::time_point due;
+
+    // Only touched by the loop thread.
+    const char* slowestHandler{nullptr};
+    std::chrono::microseconds slowestDuration{0};
+
+    mutable std::mutex histogramMutex;
+    std::array<uint64_t, bucketCount> histogram{};
+};
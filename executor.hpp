@@ -0,0 +1,229 @@
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <sys/eventfd.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// Where client callbacks run.
+class Executor
+{
+  public:
+    virtual ~Executor() = default;
+    virtual void post(std::function<void()> task) = 0;
+};
+
+// Runs tasks right away on the posting thread (the D-Bus event loop).
+class InlineExecutor : public Executor
+{
+  public:
+    void post(std::function<void()> task) override { task(); }
+};
+
+// Runs tasks on a fixed set of worker threads. With a single thread, tasks
+// run in the order they were posted.
+class ThreadPoolExecutor : public Executor
+{
+  public:
+    explicit ThreadPoolExecutor(size_t threads)
+    {
+        workers.reserve(threads);
+        for (size_t i = 0; i < threads; ++i)
+        {
+            workers.emplace_back([this]() { work(); });
+        }
+    }
+
+    ~ThreadPoolExecutor()
+    {
+        {
+            std::lock_guard<std::mutex> lock(tasksMutex);
+            running = false;
+        }
+        tasksCondition.notify_all();
+        for (auto& worker : workers)
+        {
+            worker.join();
+        }
+    }
+
+    ThreadPoolExecutor(const ThreadPoolExecutor&) = delete;
+    ThreadPoolExecutor& operator=(const ThreadPoolExecutor&) = delete;
+
+    void post(std::function<void()> task) override
+    {
+        {
+            std::lock_guard<std::mutex> lock(tasksMutex);
+            tasks.push_back(std::move(task));
+        }
+        tasksCondition.notify_one();
+    }
+
+  private:
+    void work()
+    {
+        while (true)
+        {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(tasksMutex);
+                tasksCondition.wait(lock,
+                                    [this]() { return !running || !tasks.empty(); });
+                if (tasks.empty())
+                {
+                    return;
+                }
+                task = std::move(tasks.front());
+                tasks.pop_front();
+            }
+            task();
+        }
+    }
+
+    std::mutex tasksMutex;
+    std::condition_variable tasksCondition;
+    std::deque<std::function<void()>> tasks;
+    bool running{true};
+    std::vector<std::thread> workers;
+};
+
+// A single dedicated thread, so callbacks never block the event loop but
+// still observe changes in order.
+class ThreadExecutor : public ThreadPoolExecutor
+{
+  public:
+    ThreadExecutor() : ThreadPoolExecutor(1) {}
+};
+
+// Runs tasks on the thread of an event loop, which polls getFd() and calls
+// runPending() whenever it is readable, in the order they were posted. Use
+// it for work that has to happen on the loop's own connection, such as
+// sending on a bus that must not be used from two threads. With
+// `inlineOnLoop`, tasks posted by the loop thread itself run right away.
+class LoopExecutor : public Executor
+{
+  public:
+    explicit LoopExecutor(bool inlineOnLoop = false)
+        : inlineOnLoop(inlineOnLoop),
+          wakeFd(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK))
+    {
+        if (wakeFd < 0)
+        {
+            throw std::runtime_error("Failed to create eventfd: " +
+                                     std::string(strerror(errno)));
+        }
+    }
+
+    ~LoopExecutor() { close(wakeFd); }
+
+    LoopExecutor(const LoopExecutor&) = delete;
+    LoopExecutor& operator=(const LoopExecutor&) = delete;
+
+    void post(std::function<void()> task) override
+    {
+        if (inlineOnLoop && loopThread.load() == std::this_thread::get_id())
+        {
+            task();
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(tasksMutex);
+            tasks.push_back(std::move(task));
+        }
+        const uint64_t one = 1;
+        if (write(wakeFd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+        {
+            throw std::runtime_error("Failed to wake the event loop: " +
+                                     std::string(strerror(errno)));
+        }
+    }
+
+    // Called on the loop thread before it starts polling.
+    void attachToCurrentThread() { loopThread = std::this_thread::get_id(); }
+
+    int getFd() const { return wakeFd; }
+
+    // Runs every task posted so far and returns whether there were any.
+    // Only the loop thread calls it, or the thread that joined it.
+    bool runPending()
+    {
+        uint64_t count = 0;
+        if (read(wakeFd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+        {
+            throw std::runtime_error("Failed to read the event loop wakeup: " +
+                                     std::string(strerror(errno)));
+        }
+        std::deque<std::function<void()>> ready;
+        {
+            std::lock_guard<std::mutex> lock(tasksMutex);
+            ready.swap(tasks);
+        }
+        for (auto& task : ready)
+        {
+            task();
+        }
+        return !ready.empty();
+    }
+
+  private:
+    const bool inlineOnLoop;
+    const int wakeFd;
+    std::atomic<std::thread::id> loopThread{};
+    std::mutex tasksMutex;
+    std::deque<std::function<void()>> tasks;
+};
+
+// Runs task(0) to task(count - 1) on `executor` and waits until all of them
+// are done, then rethrows the first exception any of them threw. Must not
+// be called from a task of the executor it waits on.
+inline void runAll(Executor& executor, size_t count,
+                   const std::function<void(size_t)>& task)
+{
+    std::mutex doneMutex;
+    std::condition_variable doneCondition;
+    size_t remaining = count;
+    std::exception_ptr failure;
+    for (size_t i = 0; i < count; ++i)
+    {
+        executor.post(
+            [&, i]()
+            {
+                std::exception_ptr error;
+                try
+                {
+                    task(i);
+                }
+                catch (...)
+                {
+                    error = std::current_exception();
+                }
+                std::lock_guard<std::mutex> lock(doneMutex);
+                if (error && !failure)
+                {
+                    failure = error;
+                }
+                if (--remaining == 0)
+                {
+                    doneCondition.notify_all();
+                }
+            });
+    }
+    std::unique_lock<std::mutex> lock(doneMutex);
+    doneCondition.wait(lock, [&remaining]() { return remaining == 0; });
+    if (failure)
+    {
+        std::rethrow_exception(failure);
+    }
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+// A key shared by everyone who interned the same name.
+using interned_key = std::shared_ptr<const std::string>;
+
+// Interning table for configuration keys, shared by every store of a
+// process. Change logs hold interned keys, so a key that is changed over
+// and over, in any number of applications or manager instances, is stored
+// once. An entry goes away with its last holder; the table has to outlive
+// every key it handed out.
+class KeyTable
+{
+  public:
+    KeyTable() = default;
+    KeyTable(const KeyTable&) = delete;
+    KeyTable& operator=(const KeyTable&) = delete;
+
+    interned_key intern(std::string_view key)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = keys.find(key);
+        if (it != keys.end())
+        {
+            if (auto existing = it->second.lock())
+            {
+                return existing;
+            }
+            // Its last holder is about to release it; see release().
+            keys.erase(it);
+        }
+        interned_key interned(new std::string(key),
+                              [this](const std::string* released)
+                              { release(released); });
+        keys.emplace(*interned, interned);
+        return interned;
+    }
+
+    size_t size() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return keys.size();
+    }
+
+  private:
+    void release(const std::string* released)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = keys.find(*released);
+            // The entry may already belong to a newer copy of the key.
+            if (it != keys.end() && it->first.data() == released->data())
+            {
+                keys.erase(it);
+            }
+        }
+        delete released;
+    }
+
+    mutable std::mutex mutex;
+    // Views point into the interned strings, which are only deleted once
+    // their entry is gone.
+    std::unordered_map<std::string_view, std::weak_ptr<const std::string>>
+        keys;
+};
@@ -0,0 +1,93 @@
+#pragma once
+
+#include "variantUtils.hpp"
+#include <array>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Hash tree over all applications of a manager, used to find differences
+// between two managers without exchanging their configurations:
+//
+//   root -> bucketCount buckets -> applications -> keys
+//
+// Applications are spread over buckets by name. Every level is the
+// wrapping sum of the level below, so updating one application's content
+// hash adjusts its bucket and the root in O(1). The key level is each
+// application's own content hash (see configurationEntryHash()).
+class MerkleTree
+{
+  public:
+    static constexpr size_t bucketCount = 256;
+
+    static size_t bucketOf(const std::string& application)
+    {
+        return hashBytes(application.data(), application.size()) % bucketCount;
+    }
+
+    void update(const std::string& application, uint64_t contentHash)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        const size_t bucket = bucketOf(application);
+        auto& members = applications[bucket];
+        auto it = members.find(application);
+        if (it != members.end())
+        {
+            const uint64_t old = leafHash(application, it->second);
+            bucketHashes[bucket] -= old;
+            rootHash -= old;
+            it->second = contentHash;
+        }
+        else
+        {
+            members.emplace(application, contentHash);
+        }
+        const uint64_t leaf = leafHash(application, contentHash);
+        bucketHashes[bucket] += leaf;
+        rootHash += leaf;
+    }
+
+    uint64_t root() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return rootHash;
+    }
+
+    std::vector<uint64_t> buckets() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return std::vector<uint64_t>(bucketHashes.begin(), bucketHashes.end());
+    }
+
+    // Application -> content hash for every application in `buckets`.
+    std::map<std::string, uint64_t>
+    applicationsIn(const std::vector<size_t>& buckets) const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::map<std::string, uint64_t> result;
+        for (size_t bucket : buckets)
+        {
+            if (bucket < bucketCount)
+            {
+                result.insert(applications[bucket].begin(),
+                              applications[bucket].end());
+            }
+        }
+        return result;
+    }
+
+  private:
+    static uint64_t leafHash(const std::string& application,
+                             uint64_t contentHash)
+    {
+        return mixHash(
+            hashBytes(application.data(), application.size(), contentHash));
+    }
+
+    mutable std::mutex mutex;
+    uint64_t rootHash{0};
+    std::array<uint64_t, bucketCount> bucketHashes{};
+    std::array<std::map<std::string, uint64_t>, bucketCount> applications;
+};
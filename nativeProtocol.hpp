@@ -0,0 +1,106 @@
+#pragma once
+
+#include "syncProtocol.hpp"
+#include <cstdint>
+#include <nlohmann/json.hpp>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Protocol of the manager's --native-socket endpoint, for consumers that
+// need more throughput than D-Bus gives. Frames are the ones of
+// sync_protocol (a 4-byte big-endian length and a CBOR map) and values are
+// encoded with sync_protocol::encodeValue(), so they keep their D-Bus type;
+// blobs travel as their bytes.
+//
+// Every request carries an "id" that its reply echoes. Requests may be
+// pipelined; replies come back in request order.
+//
+//   {"type": "get", "application": a, "key": k}
+//     -> {"value": v}
+//   {"type": "get-many", "application": a, "keys": [k, ...]}
+//     -> {"version": n, "values": {k: v, ...}}
+//        Unknown keys are left out; without "keys" every key is returned.
+//   {"type": "change-batch", "application": a, "changes": {k: v, ...}}
+//     -> {"version": n}
+//        Applied like ChangeConfiguration, all under one version.
+//   {"type": "subscribe", "application": a}
+//     -> {"generation": g, "version": n, "values": {k: v, ...}}
+//        followed by one frame per later change, which has no "id":
+//        {"type": "updated", "application": a, "generation": g,
+//         "version": n, "hash": h, "values": {changed k: v, ...}}
+//        Updates up to the snapshot's version may still arrive and can be
+//        ignored. An update too large for one frame comes with empty
+//        "values" and "incomplete": true; fetch them with get-many.
+//   {"type": "unsubscribe", "application": a}
+//     -> {}
+//
+// Failed requests are answered with {"id": i, "error": message}, as are
+// requests whose reply would not fit into one frame. A subscribe answered
+// with an error leaves the application unsubscribed.
+namespace native_protocol
+{
+// Appends one frame holding `message` to `buffer`.
+inline void appendFrame(std::vector<uint8_t>& buffer,
+                        const nlohmann::json& message)
+{
+    const size_t header = buffer.size();
+    buffer.resize(header + 4);
+    nlohmann::json::to_cbor(message, buffer);
+    const auto size = static_cast<uint32_t>(buffer.size() - header - 4);
+    buffer[header] = static_cast<uint8_t>(size >> 24);
+    buffer[header + 1] = static_cast<uint8_t>(size >> 16);
+    buffer[header + 2] = static_cast<uint8_t>(size >> 8);
+    buffer[header + 3] = static_cast<uint8_t>(size);
+}
+
+// Appends `reply`, or an error reply with the same "id" if `reply` does not
+// fit into one frame. Returns false in that case.
+inline bool appendReply(std::vector<uint8_t>& buffer,
+                        const nlohmann::json& reply)
+{
+    const size_t start = buffer.size();
+    appendFrame(buffer, reply);
+    const size_t size = buffer.size() - start - 4;
+    if (size <= sync_protocol::maxFrameSize)
+    {
+        return true;
+    }
+    buffer.resize(start);
+    buffer.shrink_to_fit();
+    nlohmann::json error{{"error", "Reply of " + std::to_string(size) +
+                                       " bytes exceeds the frame limit"}};
+    if (reply.contains("id"))
+    {
+        error["id"] = reply["id"];
+    }
+    appendFrame(buffer, error);
+    return false;
+}
+
+// Decodes the frame at `offset` if `buffer` holds all of it, and moves
+// `offset` past it. Throws on oversized or malformed frames.
+inline bool takeFrame(const std::vector<uint8_t>& buffer, size_t& offset,
+                      nlohmann::json& message)
+{
+    if (buffer.size() - offset < 4)
+    {
+        return false;
+    }
+    const uint8_t* header = buffer.data() + offset;
+    const uint32_t size = (uint32_t{header[0]} << 24) |
+                          (uint32_t{header[1]} << 16) |
+                          (uint32_t{header[2]} << 8) | uint32_t{header[3]};
+    if (size > sync_protocol::maxFrameSize)
+    {
+        throw std::runtime_error("Frame too large");
+    }
+    if (buffer.size() - offset - 4 < size)
+    {
+        return false;
+    }
+    message = nlohmann::json::from_cbor(header + 4, header + 4 + size);
+    offset += 4 + size;
+    return true;
+}
+} // namespace native_protocol
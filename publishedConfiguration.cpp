@@ -0,0 +1,153 @@
+#include "publishedConfiguration.hpp"
+#include "configurationBundle.hpp"
+#include <cerrno>
+#include <cstring>
+#include <spdlog/spdlog.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+PublishedConfiguration::PublishedConfiguration(
+    const std::string& directory, const std::string& applicationName)
+    : applicationName(applicationName),
+      imagePath(directory + "/" + applicationName +
+                configurationBundleExtension)
+{
+    inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotifyFd < 0)
+    {
+        throw std::runtime_error("Failed to create inotify instance: " +
+                                 std::string(strerror(errno)));
+    }
+    // Images are renamed into place, so the directory is watched rather
+    // than the file, whose inode changes with every publication.
+    if (inotify_add_watch(inotifyFd, directory.c_str(),
+                          IN_MOVED_TO | IN_CLOSE_WRITE) < 0)
+    {
+        const std::string reason = strerror(errno);
+        ::close(inotifyFd);
+        throw std::runtime_error("Failed to watch " + directory + ": " +
+                                 reason);
+    }
+    image = load();
+}
+
+PublishedConfiguration::~PublishedConfiguration() { ::close(inotifyFd); }
+
+bool PublishedConfiguration::refresh()
+{
+    const std::string imageName =
+        applicationName + configurationBundleExtension;
+    bool replaced = false;
+    alignas(inotify_event) char buffer[4096];
+    for (;;)
+    {
+        ssize_t length = ::read(inotifyFd, buffer, sizeof(buffer));
+        if (length < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (length <= 0)
+        {
+            break;
+        }
+        for (ssize_t offset = 0; offset < length;)
+        {
+            const auto* event =
+                reinterpret_cast<const inotify_event*>(buffer + offset);
+            if (event->len > 0 && imageName == event->name)
+            {
+                replaced = true;
+            }
+            offset += static_cast<ssize_t>(sizeof(inotify_event) + event->len);
+        }
+    }
+    if (!replaced)
+    {
+        return false;
+    }
+
+    auto fresh = load();
+    std::lock_guard<std::mutex> lock(imageMutex);
+    const bool changed =
+        fresh && (!image || fresh->generation != image->generation ||
+                  fresh->version != image->version);
+    if (fresh)
+    {
+        image = std::move(fresh);
+    }
+    return changed;
+}
+
+uint64_t PublishedConfiguration::getGeneration() const
+{
+    auto snapshot = current();
+    return snapshot ? snapshot->generation : 0;
+}
+
+uint64_t PublishedConfiguration::getVersion() const
+{
+    auto snapshot = current();
+    return snapshot ? snapshot->version : 0;
+}
+
+std::optional<sdbus::Variant>
+PublishedConfiguration::get(const std::string& key) const
+{
+    auto snapshot = current();
+    if (!snapshot)
+    {
+        return std::nullopt;
+    }
+    return snapshot->bundle->findValue(snapshot->index, key);
+}
+
+config_dict PublishedConfiguration::getConfiguration() const
+{
+    config_dict result;
+    auto snapshot = current();
+    if (!snapshot)
+    {
+        return result;
+    }
+    ConfigurationArena values(0);
+    snapshot->bundle->readApplication(snapshot->index, values.values());
+    for (const auto& [key, value] : values.values())
+    {
+        result.emplace_hint(result.end(), std::string(key), value);
+    }
+    return result;
+}
+
+std::shared_ptr<const PublishedConfiguration::Image>
+PublishedConfiguration::load() const
+{
+    try
+    {
+        auto bundle = std::make_unique<const ConfigurationBundle>(imagePath);
+        auto index = bundle->findApplication(applicationName);
+        if (!index)
+        {
+            throw std::runtime_error("Image does not contain " +
+                                     applicationName);
+        }
+        auto loaded = std::make_shared<Image>();
+        loaded->generation = bundle->applicationGeneration(*index);
+        loaded->version = bundle->applicationVersion(*index);
+        loaded->index = *index;
+        loaded->bundle = std::move(bundle);
+        return loaded;
+    }
+    catch (const std::exception& e)
+    {
+        spdlog::debug("No published configuration in {}: {}", imagePath,
+                      e.what());
+        return nullptr;
+    }
+}
+
+std::shared_ptr<const PublishedConfiguration::Image>
+PublishedConfiguration::current() const
+{
+    std::lock_guard<std::mutex> lock(imageMutex);
+    return image;
+}
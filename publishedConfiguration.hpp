@@ -0,0 +1,67 @@
+#pragma once
+
+#include "applicationConfigurationClient.hpp"
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+
+class ConfigurationBundle;
+
+// Reads one application's configuration from the image the manager
+// publishes with --publish-dir, for processes without a bus connection.
+// Lookups go straight to a read-only mapping of the image; the manager
+// replaces the file by rename on every change, which an inotify watch on
+// the directory reports.
+//
+//   PublishedConfiguration configuration(runtimeDir, applicationName);
+//   poll(configuration.getFd()) ... configuration.refresh();
+class PublishedConfiguration
+{
+  public:
+    // Throws if `directory` cannot be watched. A missing image is not an
+    // error; it is picked up once the manager publishes it.
+    PublishedConfiguration(const std::string& directory,
+                           const std::string& applicationName);
+    ~PublishedConfiguration();
+
+    PublishedConfiguration(const PublishedConfiguration&) = delete;
+    PublishedConfiguration& operator=(const PublishedConfiguration&) = delete;
+
+    // Non-blocking inotify descriptor; readable when refresh() has work.
+    int getFd() const { return inotifyFd; }
+
+    // Maps the image again if it was replaced. Returns true when the
+    // generation or the version changed. Never blocks.
+    bool refresh();
+
+    // 0 until an image has been mapped. Versions only compare within one
+    // generation.
+    uint64_t getGeneration() const;
+    uint64_t getVersion() const;
+
+    std::optional<sdbus::Variant> get(const std::string& key) const;
+
+    config_dict getConfiguration() const;
+
+  private:
+    struct Image
+    {
+        std::unique_ptr<const ConfigurationBundle> bundle;
+        size_t index{0};
+        uint64_t generation{0};
+        uint64_t version{0};
+    };
+
+    std::shared_ptr<const Image> load() const;
+    std::shared_ptr<const Image> current() const;
+
+    const std::string applicationName;
+    const std::string imagePath;
+    int inotifyFd{-1};
+
+    mutable std::mutex imageMutex;
+    // Readers keep their snapshot alive while a refresh swaps it.
+    std::shared_ptr<const Image> image;
+};
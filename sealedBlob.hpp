@@ -0,0 +1,336 @@
+#pragma once
+
+#include "variantUtils.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+// A large configuration value stored once in a sealed memfd. The
+// configuration dictionary only carries its blob handle; clients fetch the
+// descriptor with GetValue and map it themselves, so the payload never
+// crosses the bus by copy.
+class SealedBlob
+{
+  public:
+    static std::shared_ptr<const SealedBlob>
+    fromBytes(const std::string& name, const uint8_t* data, size_t size)
+    {
+        int fd = createMemfd(name);
+        size_t written = 0;
+        while (written < size)
+        {
+            ssize_t r = ::write(fd, data + written, size - written);
+            if (r < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (r <= 0)
+            {
+                fail(fd, "Failed to write blob");
+            }
+            written += static_cast<size_t>(r);
+        }
+        seal(fd);
+        return std::shared_ptr<const SealedBlob>(
+            new SealedBlob(fd, size, fnv1a(data, size)));
+    }
+
+    // Largest file a client may hand in as a blob.
+    static constexpr size_t maxDescriptorSize = size_t{256} << 20;
+
+    // Takes a descriptor handed in by a client, which has to refer to a
+    // regular file or memfd of at most maxDescriptorSize bytes; anything
+    // else (pipes, sockets, devices) is rejected with std::invalid_argument
+    // before it is read. A memfd that is already sealed against writes and
+    // resizes is shared as it is; anything else is copied into a fresh
+    // sealed memfd.
+    static std::shared_ptr<const SealedBlob> fromFd(const std::string& name,
+                                                    int fd)
+    {
+        const size_t expected = checkDescriptor(fd);
+        constexpr int required = F_SEAL_WRITE | F_SEAL_SHRINK | F_SEAL_GROW;
+        int seals = fcntl(fd, F_GET_SEALS);
+        if (seals >= 0 && (seals & required) == required)
+        {
+            int own = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+            if (own < 0)
+            {
+                throw std::runtime_error("Failed to duplicate blob: " +
+                                         std::string(strerror(errno)));
+            }
+            return std::shared_ptr<const SealedBlob>(
+                new SealedBlob(own, expected, hashDescriptor(own, expected)));
+        }
+
+        int copy = createMemfd(name);
+        uint8_t buffer[64 * 1024];
+        uint64_t hash = fnv1aBasis;
+        size_t size = 0;
+        for (;;)
+        {
+            ssize_t r = pread(fd, buffer, sizeof(buffer),
+                              static_cast<off_t>(size));
+            if (r < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (r < 0)
+            {
+                fail(copy, "Failed to read blob");
+            }
+            if (r == 0)
+            {
+                break;
+            }
+            if (size + static_cast<size_t>(r) > maxDescriptorSize)
+            {
+                ::close(copy);
+                throw std::invalid_argument("Blob " + name +
+                                            " grew beyond the size limit");
+            }
+            if (::write(copy, buffer, static_cast<size_t>(r)) != r)
+            {
+                fail(copy, "Failed to write blob");
+            }
+            hash = fnv1a(buffer, static_cast<size_t>(r), hash);
+            size += static_cast<size_t>(r);
+        }
+        seal(copy);
+        return std::shared_ptr<const SealedBlob>(
+            new SealedBlob(copy, size, hash));
+    }
+
+    // Whether the blob holds exactly these bytes. Size and hash only rule
+    // a match out quickly; a match is confirmed byte by byte, since FNV-1a
+    // collisions are easy to come by.
+    bool sameContent(const uint8_t* data, size_t size) const
+    {
+        if (size != length || fnv1a(data, size) != contentHash)
+        {
+            return false;
+        }
+        return withContent([data, size](const uint8_t* content)
+                           { return std::memcmp(content, data, size) == 0; });
+    }
+
+    bool sameContent(const SealedBlob& other) const
+    {
+        if (&other == this)
+        {
+            return true;
+        }
+        if (other.length != length || other.contentHash != contentHash)
+        {
+            return false;
+        }
+        return withContent(
+            [&other](const uint8_t* content)
+            {
+                return other.withContent(
+                    [content, size = other.length](const uint8_t* theirs)
+                    { return std::memcmp(content, theirs, size) == 0; });
+            });
+    }
+
+    // The same for a descriptor fromFd() accepts, which is read in place.
+    bool sameContent(int fd) const
+    {
+        if (checkDescriptor(fd) != length)
+        {
+            return false;
+        }
+        return withContent(
+            [this, fd](const uint8_t* content)
+            {
+                uint8_t buffer[64 * 1024];
+                size_t done = 0;
+                while (done < length)
+                {
+                    ssize_t r = pread(
+                        fd, buffer,
+                        std::min<size_t>(sizeof(buffer), length - done),
+                        static_cast<off_t>(done));
+                    if (r < 0 && errno == EINTR)
+                    {
+                        continue;
+                    }
+                    if (r <= 0)
+                    {
+                        // Shrunk or unreadable: let fromFd() sort it out.
+                        return false;
+                    }
+                    if (std::memcmp(content + done, buffer,
+                                    static_cast<size_t>(r)) != 0)
+                    {
+                        return false;
+                    }
+                    done += static_cast<size_t>(r);
+                }
+                return true;
+            });
+    }
+
+    ~SealedBlob() { ::close(descriptor); }
+
+    SealedBlob(const SealedBlob&) = delete;
+    SealedBlob& operator=(const SealedBlob&) = delete;
+
+    int fd() const { return descriptor; }
+    uint64_t size() const { return length; }
+    uint64_t hash() const { return contentHash; }
+    blob_handle handle() const { return blob_handle{length, contentHash}; }
+
+    // Copies the content out, for the rare paths that need it in memory.
+    std::vector<uint8_t> bytes() const
+    {
+        std::vector<uint8_t> content(length);
+        size_t done = 0;
+        while (done < content.size())
+        {
+            ssize_t r = pread(descriptor, content.data() + done,
+                              content.size() - done, static_cast<off_t>(done));
+            if (r < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (r <= 0)
+            {
+                throw std::runtime_error("Failed to read blob: " +
+                                         std::string(strerror(errno)));
+            }
+            done += static_cast<size_t>(r);
+        }
+        return content;
+    }
+
+  private:
+    SealedBlob(int fd, uint64_t size, uint64_t hash)
+        : descriptor(fd), length(size), contentHash(hash)
+    {
+    }
+
+    static constexpr uint64_t fnv1aBasis = 14695981039346656037ull;
+
+    static uint64_t fnv1a(const uint8_t* data, size_t size,
+                          uint64_t hash = fnv1aBasis)
+    {
+        for (size_t i = 0; i < size; ++i)
+        {
+            hash = (hash ^ data[i]) * 1099511628211ull;
+        }
+        return hash;
+    }
+
+    // Calls `compare` with the content mapped into memory.
+    template <typename Compare>
+    bool withContent(Compare&& compare) const
+    {
+        if (length == 0)
+        {
+            return true;
+        }
+        void* mapped =
+            mmap(nullptr, length, PROT_READ, MAP_PRIVATE, descriptor, 0);
+        if (mapped == MAP_FAILED)
+        {
+            throw std::runtime_error("Failed to map blob: " +
+                                     std::string(strerror(errno)));
+        }
+        bool same = false;
+        try
+        {
+            same = compare(static_cast<const uint8_t*>(mapped));
+        }
+        catch (...)
+        {
+            munmap(mapped, length);
+            throw;
+        }
+        munmap(mapped, length);
+        return same;
+    }
+
+    static uint64_t hashDescriptor(int fd, size_t size)
+    {
+        if (size == 0)
+        {
+            return fnv1aBasis;
+        }
+        void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped == MAP_FAILED)
+        {
+            fail(fd, "Failed to map blob");
+        }
+        auto hash = fnv1a(static_cast<const uint8_t*>(mapped), size);
+        munmap(mapped, size);
+        return hash;
+    }
+
+    // Returns the size of a descriptor fromFd() accepts.
+    static size_t checkDescriptor(int fd)
+    {
+        struct stat status;
+        if (fstat(fd, &status) < 0)
+        {
+            throw std::invalid_argument("Invalid blob descriptor: " +
+                                        std::string(strerror(errno)));
+        }
+        // memfds are regular files as well.
+        if (!S_ISREG(status.st_mode))
+        {
+            throw std::invalid_argument(
+                "Blob descriptors must refer to a regular file or memfd");
+        }
+        const auto size = static_cast<size_t>(status.st_size);
+        if (size > maxDescriptorSize)
+        {
+            throw std::invalid_argument(
+                "Blob of " + std::to_string(size) + " bytes exceeds the " +
+                std::to_string(maxDescriptorSize) + " byte limit");
+        }
+        return size;
+    }
+
+    // The name only labels the descriptor in /proc; memfd_create rejects
+    // names above 249 bytes, so long keys are cut short.
+    static int createMemfd(const std::string& name)
+    {
+        const std::string label = name.substr(0, 249);
+        int fd = memfd_create(label.c_str(), MFD_CLOEXEC | MFD_ALLOW_SEALING);
+        if (fd < 0)
+        {
+            throw std::runtime_error("Failed to create memfd: " +
+                                     std::string(strerror(errno)));
+        }
+        return fd;
+    }
+
+    static void seal(int fd)
+    {
+        if (fcntl(fd, F_ADD_SEALS,
+                  F_SEAL_WRITE | F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0)
+        {
+            fail(fd, "Failed to seal blob");
+        }
+    }
+
+    [[noreturn]] static void fail(int fd, const char* what)
+    {
+        const std::string reason = strerror(errno);
+        ::close(fd);
+        throw std::runtime_error(std::string(what) + ": " + reason);
+    }
+
+    const int descriptor;
+    const uint64_t length;
+    const uint64_t contentHash;
+};
@@ -0,0 +1,310 @@
+#pragma once
+
+#include "variantUtils.hpp"
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <nlohmann/json.hpp>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <vector>
+
+// Framing and value encoding of the protocols spoken between managers over
+// Unix stream sockets (anti-entropy and restart handoff). Every frame is a
+// 4-byte big-endian length followed by a CBOR-encoded map; requests carry a
+// "type" and get exactly one reply.
+namespace sync_protocol
+{
+constexpr uint32_t maxFrameSize = 64 * 1024 * 1024;
+
+inline void writeAll(int fd, const uint8_t* data, size_t size)
+{
+    while (size > 0)
+    {
+        ssize_t r = ::send(fd, data, size, MSG_NOSIGNAL);
+        if (r < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (r <= 0)
+        {
+            throw std::runtime_error("Failed to send frame: " +
+                                     std::string(strerror(errno)));
+        }
+        data += r;
+        size -= static_cast<size_t>(r);
+    }
+}
+
+// Returns false on a clean end of stream before the first byte.
+inline bool readAll(int fd, uint8_t* data, size_t size)
+{
+    size_t received = 0;
+    while (received < size)
+    {
+        ssize_t r = ::recv(fd, data + received, size - received, 0);
+        if (r < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (r == 0 && received == 0)
+        {
+            return false;
+        }
+        if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            throw std::runtime_error("Timed out receiving frame");
+        }
+        if (r <= 0)
+        {
+            throw std::runtime_error("Failed to receive frame: " +
+                                     std::string(r == 0 ? "connection closed"
+                                                        : strerror(errno)));
+        }
+        received += static_cast<size_t>(r);
+    }
+    return true;
+}
+
+// Refuses a message the peer would reject, before anything is sent.
+inline std::vector<uint8_t> encodeFrame(const nlohmann::json& message)
+{
+    auto payload = nlohmann::json::to_cbor(message);
+    if (payload.size() > maxFrameSize)
+    {
+        throw std::runtime_error("Frame of " + std::to_string(payload.size()) +
+                                 " bytes exceeds the limit of " +
+                                 std::to_string(maxFrameSize));
+    }
+    return payload;
+}
+
+// Returns the number of bytes written.
+inline size_t writeEncodedFrame(int fd, const std::vector<uint8_t>& payload)
+{
+    const auto size = static_cast<uint32_t>(payload.size());
+    const uint8_t header[4] = {
+        static_cast<uint8_t>(size >> 24), static_cast<uint8_t>(size >> 16),
+        static_cast<uint8_t>(size >> 8), static_cast<uint8_t>(size)};
+    writeAll(fd, header, sizeof(header));
+    writeAll(fd, payload.data(), payload.size());
+    return sizeof(header) + payload.size();
+}
+
+inline size_t writeFrame(int fd, const nlohmann::json& message)
+{
+    return writeEncodedFrame(fd, encodeFrame(message));
+}
+
+// Returns the number of bytes read, or nothing at the end of the stream.
+inline std::optional<size_t> readFrame(int fd, nlohmann::json& message)
+{
+    uint8_t header[4];
+    if (!readAll(fd, header, sizeof(header)))
+    {
+        return std::nullopt;
+    }
+    const uint32_t size = (uint32_t{header[0]} << 24) |
+                          (uint32_t{header[1]} << 16) |
+                          (uint32_t{header[2]} << 8) | uint32_t{header[3]};
+    if (size > maxFrameSize)
+    {
+        throw std::runtime_error("Frame too large");
+    }
+    std::vector<uint8_t> payload(size);
+    if (size > 0 && !readAll(fd, payload.data(), size))
+    {
+        throw std::runtime_error("Connection closed inside a frame");
+    }
+    message = nlohmann::json::from_cbor(payload);
+    return sizeof(header) + size;
+}
+
+inline sockaddr_un socketAddress(const std::string& path)
+{
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path))
+    {
+        throw std::runtime_error("Socket path too long: " + path);
+    }
+    std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    return address;
+}
+
+// Client end of one anti-entropy or handoff session.
+class Connection
+{
+  public:
+    explicit Connection(const std::string& path)
+        : fd(::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0))
+    {
+        if (fd < 0)
+        {
+            throw std::runtime_error("Failed to create socket: " +
+                                     std::string(strerror(errno)));
+        }
+        const auto address = socketAddress(path);
+        if (::connect(fd, reinterpret_cast<const sockaddr*>(&address),
+                      sizeof(address)) < 0)
+        {
+            const std::string reason = strerror(errno);
+            ::close(fd);
+            throw std::runtime_error("Failed to connect to " + path + ": " +
+                                     reason);
+        }
+    }
+
+    ~Connection() { ::close(fd); }
+
+    Connection(const Connection&) = delete;
+    Connection& operator=(const Connection&) = delete;
+
+    void send(const nlohmann::json& message)
+    {
+        bytes += writeFrame(fd, message);
+    }
+
+    // Error replies are thrown.
+    nlohmann::json receive()
+    {
+        nlohmann::json reply;
+        auto received = readFrame(fd, reply);
+        if (!received)
+        {
+            throw std::runtime_error("Peer closed the connection");
+        }
+        bytes += *received;
+        if (reply.contains("error"))
+        {
+            throw std::runtime_error("Peer error: " +
+                                     reply["error"].get<std::string>());
+        }
+        return reply;
+    }
+
+    // Sends one request and returns its reply.
+    nlohmann::json request(const nlohmann::json& message)
+    {
+        send(message);
+        return receive();
+    }
+
+    // Bytes sent and received so far.
+    size_t transferred() const { return bytes; }
+
+  private:
+    int fd;
+    size_t bytes{0};
+};
+
+// Values travel as [signature, payload] so that they keep their D-Bus type:
+// every basic type but file descriptors, string arrays, byte strings and
+// nested `a{sv}` dictionaries. Any other type yields nullopt. Blob handles
+// must be resolved into their bytes (`ay`) by the caller.
+inline std::optional<nlohmann::json> encodeValue(const sdbus::Variant& value)
+{
+    const char* signature = value.peekValueType();
+    if (!signature)
+    {
+        return std::nullopt;
+    }
+    const std::string type = signature;
+    nlohmann::json payload;
+    if (type == "s")
+        payload = value.get<std::string>();
+    else if (type == "x")
+        payload = value.get<int64_t>();
+    else if (type == "t")
+        payload = value.get<uint64_t>();
+    else if (type == "i")
+        payload = value.get<int32_t>();
+    else if (type == "u")
+        payload = value.get<uint32_t>();
+    else if (type == "n")
+        payload = value.get<int16_t>();
+    else if (type == "q")
+        payload = value.get<uint16_t>();
+    else if (type == "y")
+        payload = value.get<uint8_t>();
+    else if (type == "o")
+        payload = std::string(value.get<sdbus::ObjectPath>());
+    else if (type == "d")
+        payload = value.get<double>();
+    else if (type == "b")
+        payload = value.get<bool>();
+    else if (type == "ay")
+        payload = nlohmann::json::binary(value.get<std::vector<uint8_t>>());
+    else if (type == "as")
+        payload = value.get<std::vector<std::string>>();
+    else if (type == "a{sv}")
+    {
+        payload = nlohmann::json::object();
+        for (const auto& [key, nested] :
+             value.get<std::map<std::string, sdbus::Variant>>())
+        {
+            auto encoded = encodeValue(nested);
+            if (!encoded)
+            {
+                return std::nullopt;
+            }
+            payload[key] = std::move(*encoded);
+        }
+    }
+    else
+        return std::nullopt;
+    return nlohmann::json::array({type, std::move(payload)});
+}
+
+inline sdbus::Variant decodeValue(const nlohmann::json& encoded)
+{
+    if (!encoded.is_array() || encoded.size() != 2 || !encoded[0].is_string())
+    {
+        throw std::runtime_error("Malformed value");
+    }
+    const auto type = encoded[0].get<std::string>();
+    const auto& payload = encoded[1];
+    if (type == "s")
+        return sdbus::Variant(payload.get<std::string>());
+    if (type == "x")
+        return sdbus::Variant(payload.get<int64_t>());
+    if (type == "t")
+        return sdbus::Variant(payload.get<uint64_t>());
+    if (type == "i")
+        return sdbus::Variant(payload.get<int32_t>());
+    if (type == "u")
+        return sdbus::Variant(payload.get<uint32_t>());
+    if (type == "n")
+        return sdbus::Variant(payload.get<int16_t>());
+    if (type == "q")
+        return sdbus::Variant(payload.get<uint16_t>());
+    if (type == "y")
+        return sdbus::Variant(payload.get<uint8_t>());
+    if (type == "o")
+        return sdbus::Variant(sdbus::ObjectPath(payload.get<std::string>()));
+    if (type == "d")
+        return sdbus::Variant(payload.get<double>());
+    if (type == "b")
+        return sdbus::Variant(payload.get<bool>());
+    if (type == "ay")
+        return sdbus::Variant(
+            static_cast<const std::vector<uint8_t>&>(payload.get_binary()));
+    if (type == "as")
+        return sdbus::Variant(payload.get<std::vector<std::string>>());
+    if (type == "a{sv}")
+    {
+        std::map<std::string, sdbus::Variant> nested;
+        for (const auto& [key, encodedNested] : payload.items())
+        {
+            nested.emplace(key, decodeValue(encodedNested));
+        }
+        return sdbus::Variant(nested);
+    }
+    throw std::runtime_error("Unsupported value type: " + type);
+}
+} // namespace sync_protocol
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <sdbus-c++/sdbus-c++.h>
+#include <stdexcept>
+#include <string>
+
+// Current configuration of an application, with blobs resolved into bytes.
+using configuration_snapshot = std::map<std::string, sdbus::Variant>;
+// Returns the snapshot and stores the version it belongs to in `version`.
+using configuration_reader =
+    std::function<configuration_snapshot(uint64_t& version)>;
+// Applies a change the same way ChangeConfiguration does.
+using configuration_writer =
+    std::function<void(const std::string& key, const sdbus::Variant& value)>;
+// Throws std::invalid_argument if `value` does not fit the schema of `key`.
+using configuration_validator =
+    std::function<void(const std::string& key, const sdbus::Variant& value)>;
+
+// Typed interface of an application with a schema (schemas/*.json), served
+// next to the generic Configuration interface. Implementations are
+// generated by config_codegen; see createTypedAdaptor() in the generated
+// configurationAdaptors.hpp. The schema itself is checked by the validator
+// from createSchemaValidator(), in every registration mode.
+class TypedAdaptor
+{
+  public:
+    virtual ~TypedAdaptor() = default;
+
+    // Emits the typed Updated signal with the current configuration and
+    // its version.
+    virtual void emitUpdated() = 0;
+};
+
+// Value of `key` in `values`, or a default-constructed value if it is
+// missing or of another type.
+template <typename T>
+T typedValue(const configuration_snapshot& values, const std::string& key)
+{
+    auto it = values.find(key);
+    if (it == values.end() || !it->second.containsValueOfType<T>())
+    {
+        return T{};
+    }
+    return it->second.get<T>();
+}
@@ -0,0 +1,160 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <sdbus-c++/sdbus-c++.h>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Placeholder a configuration dictionary carries for a value stored as a
+// sealed memfd: (size, FNV-1a hash of the content). The descriptor itself is
+// fetched with GetValue.
+using blob_handle = sdbus::Struct<uint64_t, uint64_t>;
+constexpr const char* blobHandleSignature = "(tt)";
+
+inline bool isBlobHandle(const sdbus::Variant& value)
+{
+    const char* type = value.peekValueType();
+    return type && std::strcmp(type, blobHandleSignature) == 0;
+}
+
+// Value comparison for the types configurations carry in practice. Variants
+// of any other type never compare equal, so they are always treated as
+// changed.
+inline bool variantEquals(const sdbus::Variant& lhs, const sdbus::Variant& rhs)
+{
+    const char* lhsType = lhs.peekValueType();
+    const char* rhsType = rhs.peekValueType();
+    if (!lhsType || !rhsType)
+    {
+        return !lhsType && !rhsType;
+    }
+    if (std::strcmp(lhsType, rhsType) != 0)
+    {
+        return false;
+    }
+
+    const std::string type = lhsType;
+    if (type == "s")
+        return lhs.get<std::string>() == rhs.get<std::string>();
+    if (type == "x")
+        return lhs.get<int64_t>() == rhs.get<int64_t>();
+    if (type == "t")
+        return lhs.get<uint64_t>() == rhs.get<uint64_t>();
+    if (type == "i")
+        return lhs.get<int32_t>() == rhs.get<int32_t>();
+    if (type == "u")
+        return lhs.get<uint32_t>() == rhs.get<uint32_t>();
+    if (type == "n")
+        return lhs.get<int16_t>() == rhs.get<int16_t>();
+    if (type == "q")
+        return lhs.get<uint16_t>() == rhs.get<uint16_t>();
+    if (type == "y")
+        return lhs.get<uint8_t>() == rhs.get<uint8_t>();
+    if (type == "d")
+        return lhs.get<double>() == rhs.get<double>();
+    if (type == "b")
+        return lhs.get<bool>() == rhs.get<bool>();
+    if (type == "ay")
+        return lhs.get<std::vector<uint8_t>>() ==
+               rhs.get<std::vector<uint8_t>>();
+    if (type == blobHandleSignature)
+        return lhs.get<blob_handle>() == rhs.get<blob_handle>();
+    if (type == "as")
+        return lhs.get<std::vector<std::string>>() ==
+               rhs.get<std::vector<std::string>>();
+    return false;
+}
+
+// 64-bit finalizer of splitmix64; spreads every input bit over the result.
+inline uint64_t mixHash(uint64_t h)
+{
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ull;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111ebull;
+    return h ^ (h >> 31);
+}
+
+// Fast non-cryptographic hash of a byte range, eight bytes per step.
+inline uint64_t hashBytes(const void* data, size_t size, uint64_t seed = 0)
+{
+    const auto* p = static_cast<const uint8_t*>(data);
+    uint64_t h = seed ^ (size * 0x9e3779b97f4a7c15ull);
+    for (; size >= 8; size -= 8, p += 8)
+    {
+        uint64_t block;
+        std::memcpy(&block, p, sizeof(block));
+        h = mixHash(h ^ block);
+    }
+    uint64_t tail = 0;
+    std::memcpy(&tail, p, size);
+    return mixHash(h ^ tail ^ 0xff);
+}
+
+// Hash of the value's type signature and content, for the same types
+// variantEquals() compares. Values of other types hash by signature only.
+inline uint64_t variantHash(const sdbus::Variant& value, uint64_t seed = 0)
+{
+    const char* signature = value.peekValueType();
+    if (!signature)
+    {
+        return mixHash(seed);
+    }
+    const std::string type = signature;
+    uint64_t h = hashBytes(type.data(), type.size(), seed);
+    auto hashScalar = [&h](auto scalar)
+    { h = hashBytes(&scalar, sizeof(scalar), h); };
+
+    if (type == "s")
+    {
+        const auto s = value.get<std::string>();
+        h = hashBytes(s.data(), s.size(), h);
+    }
+    else if (type == "x")
+        hashScalar(value.get<int64_t>());
+    else if (type == "t")
+        hashScalar(value.get<uint64_t>());
+    else if (type == "i")
+        hashScalar(value.get<int32_t>());
+    else if (type == "u")
+        hashScalar(value.get<uint32_t>());
+    else if (type == "n")
+        hashScalar(value.get<int16_t>());
+    else if (type == "q")
+        hashScalar(value.get<uint16_t>());
+    else if (type == "y")
+        hashScalar(value.get<uint8_t>());
+    else if (type == "d")
+        hashScalar(value.get<double>());
+    else if (type == "b")
+        hashScalar(static_cast<uint8_t>(value.get<bool>()));
+    else if (type == "ay")
+    {
+        const auto bytes = value.get<std::vector<uint8_t>>();
+        h = hashBytes(bytes.data(), bytes.size(), h);
+    }
+    else if (type == blobHandleSignature)
+    {
+        const auto handle = value.get<blob_handle>();
+        hashScalar(std::get<0>(handle));
+        hashScalar(std::get<1>(handle));
+    }
+    else if (type == "as")
+    {
+        for (const auto& s : value.get<std::vector<std::string>>())
+        {
+            h = hashBytes(s.data(), s.size(), h);
+        }
+    }
+    return h;
+}
+
+// Contribution of one key to a configuration's content hash. The content
+// hash is the wrapping sum over all keys, so it does not depend on order
+// and a single change is folded in by subtracting the old contribution and
+// adding the new one.
+inline uint64_t configurationEntryHash(std::string_view key,
+                                       const sdbus::Variant& value)
+{
+    return mixHash(variantHash(value, hashBytes(key.data(), key.size())));
+}